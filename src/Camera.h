@@ -0,0 +1,63 @@
+#pragma once
+
+#include <opencv2/core.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "FaceBudget.h"
+#include "FaceColorCache.h"
+#include "JpegFrame.h"
+#include "OutputSink.h"
+#include "PresenceGate.h"
+#include "ReorderBuffer.h"
+
+// One capture source with its own frame slots, sequence numbers, outputs and metrics
+struct Camera
+{
+    typedef std::chrono::steady_clock clock;
+
+    Camera(int index, int devnum) :
+        index(index), devnum(devnum), state(0),
+        captured(0), processed(0), skipped(0), latencyMicros(0), latencyMaxMicros(0)
+    {
+    }
+
+    int index;
+    int devnum;
+
+    // 0 while opening, 1 when capturing, 2 when the device could not be opened
+    std::atomic_int state;
+    std::thread thread;
+
+    // Latest captured frame and latest processed RGBA frame, guarded by mutex
+    std::mutex mutex;
+    cv::Mat frameBGR;
+    std::shared_ptr<const JpegFrame> frameJpeg;    // instead of frameBGR when capturing MJPEG
+    unsigned long frameSeq = 0;
+    clock::time_point frameTime;
+    cv::Mat frameRGB;
+    unsigned long outputSeq = 0;
+
+    std::vector<std::unique_ptr<OutputSink>> sinks;
+    std::unique_ptr<PresenceGate> gate;
+    std::unique_ptr<FaceColorCache> colors;
+    std::unique_ptr<FaceBudget> budget;
+    std::unique_ptr<ReorderBuffer> reorder;
+
+    // Scheduling state, guarded by the FrameScheduler
+    unsigned int inFlight = 0;      // frames taken by workers and not finished yet
+    unsigned long scheduledSeq = 0;
+    clock::time_point lastScheduled, nextDue, lastCaptured;
+    double captureInterval = 0;     // running average seconds between captured frames
+    double cost = 0;                // running average seconds to process one frame
+    double targetFps = 0;           // processing rate granted by the scheduler, 0 is unlimited
+
+    // Metrics
+    std::atomic_ulong captured, processed, skipped;
+    std::atomic_ulong latencyMicros, latencyMaxMicros;
+};
@@ -0,0 +1,200 @@
+#include "FaceBudget.h"
+
+#include <algorithm>
+#include <cmath>
+#include <tuple>
+
+// Entries of faces not seen for this many frames are dropped
+static const unsigned long MAX_UNUSED = 30;
+
+// How much a face moving by its own width per refresh counts against being stale one more frame
+static const double MOTION_WEIGHT = 4.0;
+
+// Weight of the latest frame in the refresh cost estimate
+static const double COST_SMOOTHING = 0.2;
+
+// How far and how much a face moved or resized since its last refresh, relative to its size
+static double motion(const cv::Rect &from, const cv::Rect &to)
+{
+    if (from.width <= 0 || from.height <= 0)
+        return 0;
+    double dx = (to.x + to.width / 2.0) - (from.x + from.width / 2.0);
+    double dy = (to.y + to.height / 2.0) - (from.y + from.height / 2.0);
+    return std::sqrt(dx * dx + dy * dy) / from.width + std::abs(to.width - from.width) / (double)from.width;
+}
+
+FaceBudget::FaceBudget(double budget_seconds, int min_size, int max_stale) :
+    budget_seconds(std::max(0.0, budget_seconds)), min_size(std::max(0, min_size)), max_stale(std::max(0, max_stale))
+{
+}
+
+std::vector<FaceBudget::Action> FaceBudget::plan(const std::vector<cv::Rect> &faces, const std::vector<int> &tracks)
+{
+    std::unique_lock<std::mutex> l(mutex);
+    frame++;
+    shown.clear();
+
+    std::vector<Action> actions(faces.size(), SKIP);
+
+    // Faces that cannot be shown from their last patch any more come first,
+    // then the stalest and fastest moving ones
+    std::vector<std::tuple<bool, double, size_t>> candidates;
+    for (size_t i = 0; i < faces.size(); i++)
+    {
+        if (std::min(faces[i].width, faces[i].height) < min_size)
+        {
+            culls++;
+            continue;
+        }
+
+        Entry &e = entries[tracks[i]];
+        bool cached = e.source_track >= 0;
+        unsigned long age = cached ? frame - e.refreshed : max_stale + 1;
+        e.seen = faces[i];
+        e.used = frame;
+
+        double priority = age * (1 + MOTION_WEIGHT * (cached ? motion(e.rect, faces[i]) : 0));
+        candidates.push_back(std::make_tuple(age >= (unsigned long)max_stale, priority, i));
+    }
+    std::sort(candidates.begin(), candidates.end(),
+              [](const std::tuple<bool, double, size_t> &a, const std::tuple<bool, double, size_t> &b)
+              {
+                  return std::get<0>(a) != std::get<0>(b) ? std::get<0>(a) : std::get<1>(a) > std::get<1>(b);
+              });
+
+    // At least one face is refreshed per frame, so every face gets its turn
+    double spent = 0;
+    bool any = false;
+    for (const auto &candidate : candidates)
+    {
+        size_t i = std::get<2>(candidate);
+        const Entry &e = entries[tracks[i]];
+        double cost = seconds_per_pixel * faces[i].area();
+
+        if (budget_seconds == 0 || !any || spent + cost <= budget_seconds)
+        {
+            actions[i] = REFRESH;
+            spent += cost;
+            any = true;
+        }
+        else if (e.source_track >= 0 && frame - e.refreshed <= (unsigned long)max_stale)
+            actions[i] = REUSE;
+        else
+            skips++;
+    }
+
+    for (auto it = entries.begin(); it != entries.end();)
+    {
+        if (frame - it->second.used > MAX_UNUSED)
+            it = entries.erase(it);
+        else
+            ++it;
+    }
+
+    return actions;
+}
+
+bool FaceBudget::landmarks(int track, const cv::Rect &face, std::vector<cv::Point2f> &points, std::vector<std::vector<int>> &triangles)
+{
+    std::unique_lock<std::mutex> l(mutex);
+    auto it = entries.find(track);
+    if (it == entries.end() || it->second.points.empty() || it->second.rect.area() == 0)
+        return false;
+
+    const Entry &e = it->second;
+    float sx = (float)face.width / e.rect.width, sy = (float)face.height / e.rect.height;
+    points.clear();
+    for (const cv::Point2f &p : e.points)
+        points.push_back(cv::Point2f(face.x + (p.x - e.rect.x) * sx, face.y + (p.y - e.rect.y) * sy));
+
+    // Moving and scaling keeps the triangulation
+    triangles = e.triangles;
+    return true;
+}
+
+void FaceBudget::storeLandmarks(int track, const cv::Rect &face, const std::vector<cv::Point2f> &points, const std::vector<std::vector<int>> &triangles)
+{
+    std::unique_lock<std::mutex> l(mutex);
+    Entry &e = entries[track];
+    e.rect = face;
+    e.points = points;
+    e.triangles = triangles;
+}
+
+bool FaceBudget::reusePatch(int track, int source_track, const cv::Rect &face, const cv::Rect &frame_rect, FacePatch &patch)
+{
+    std::unique_lock<std::mutex> l(mutex);
+    auto it = entries.find(track);
+    if (it == entries.end() || it->second.source_track != source_track || it->second.patch.mask.empty())
+    {
+        skips++;
+        return false;
+    }
+
+    // The patch follows the centre of the face, its pixels are shared, not copied
+    const Entry &e = it->second;
+    cv::Point shift((face.x + face.width / 2) - (e.rect.x + e.rect.width / 2),
+                    (face.y + face.height / 2) - (e.rect.y + e.rect.height / 2));
+    cv::Rect moved = e.patch.rect + shift;
+    cv::Rect visible = moved & frame_rect;
+    if (visible.area() == 0)
+    {
+        skips++;
+        return false;
+    }
+
+    patch.rect = visible;
+    // Outside the hull the pixels are the background of the frame the patch was made
+    // from, only the hull moves with the face
+    cv::Rect inside(visible.tl() - moved.tl(), visible.size());
+    patch.pixels = e.patch.pixels(inside);
+    patch.mask = e.patch.mask(inside);
+
+    unsigned long staleness = frame - e.refreshed;
+    reuses++;
+    staleness_sum += staleness;
+    staleness_count++;
+    staleness_max = std::max(staleness_max, staleness);
+    shown.push_back(std::make_pair(track, staleness));
+    return true;
+}
+
+void FaceBudget::storePatch(int track, int source_track, const FacePatch &patch)
+{
+    std::unique_lock<std::mutex> l(mutex);
+    Entry &e = entries[track];
+    e.patch = patch;
+    e.source_track = source_track;
+    e.refreshed = frame;
+
+    // Counted here, a planned refresh can still come to nothing
+    refreshes++;
+    staleness_count++;
+    shown.push_back(std::make_pair(track, 0ul));
+}
+
+void FaceBudget::refreshed(double seconds, double area)
+{
+    if (area <= 0)
+        return;
+
+    std::unique_lock<std::mutex> l(mutex);
+    double sample = seconds / area;
+    seconds_per_pixel = seconds_per_pixel == 0 ? sample : (1 - COST_SMOOTHING) * seconds_per_pixel + COST_SMOOTHING * sample;
+}
+
+FaceBudget::Stats FaceBudget::stats()
+{
+    std::unique_lock<std::mutex> l(mutex);
+    Stats s;
+    s.refreshed = refreshes;
+    s.reused = reuses;
+    s.skipped = skips;
+    s.culled = culls;
+    s.staleness_max = staleness_max;
+    s.staleness_mean = staleness_count ? (double)staleness_sum / staleness_count : 0;
+    s.faces = shown;
+
+    staleness_sum = staleness_count = staleness_max = 0;
+    return s;
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <opencv2/core.hpp>
+
+#include <map>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "FaceWarp.h"
+
+// Bounds the per face work of one camera in crowded scenes. Every frame each
+// tracked face is either refreshed (landmarks, warp, colour correction and
+// blend), shown with its last patch moved along with the face, or skipped and
+// left as it is. Refreshes are given to the stalest and fastest moving faces
+// until the estimated cost reaches the frame budget, faces smaller than
+// min_size are never swapped, and no patch older than max_stale frames is
+// shown: a face that cannot be refreshed in time is skipped instead.
+class FaceBudget
+{
+public:
+    enum Action
+    {
+        REFRESH,
+        REUSE,
+        SKIP
+    };
+
+    struct Stats
+    {
+        unsigned long refreshed, reused, skipped, culled;
+        // Staleness in frames of the faces shown since the last call
+        unsigned long staleness_max;
+        double staleness_mean;
+        // Frames since the last refresh of each face shown in the latest frame, by track id
+        std::vector<std::pair<int, unsigned long>> faces;
+    };
+
+    // budget_seconds == 0 refreshes every face on every frame
+    FaceBudget(double budget_seconds, int min_size, int max_stale);
+
+    // Decides what this frame does with each face, faces[i] is tracked as tracks[i]
+    std::vector<Action> plan(const std::vector<cv::Rect> &faces, const std::vector<int> &tracks);
+
+    // Landmarks and triangles of a face from its last refresh, moved and scaled to where it is now
+    bool landmarks(int track, const cv::Rect &face, std::vector<cv::Point2f> &points, std::vector<std::vector<int>> &triangles);
+    void storeLandmarks(int track, const cv::Rect &face, const std::vector<cv::Point2f> &points, const std::vector<std::vector<int>> &triangles);
+
+    // The last patch of a face moved along with it, only when it still shows source_track
+    bool reusePatch(int track, int source_track, const cv::Rect &face, const cv::Rect &frame, FacePatch &patch);
+    void storePatch(int track, int source_track, const FacePatch &patch);
+
+    // Time the refreshes of a frame took, for the cost estimate of the next plans
+    void refreshed(double seconds, double area);
+
+    // Counters since the start, staleness since the last call
+    Stats stats();
+
+private:
+    struct Entry
+    {
+        cv::Rect rect;                  // where the face was at its last refresh
+        cv::Rect seen;                  // where it was in the latest frame
+        std::vector<cv::Point2f> points;
+        std::vector<std::vector<int>> triangles;
+        FacePatch patch;
+        int source_track = -1;          // face shown by the patch, -1 without a patch
+        unsigned long refreshed = 0;    // frame of the last refresh
+        unsigned long used = 0;         // frame of the last plan that saw the face
+    };
+
+    double budget_seconds;
+    int min_size;
+    int max_stale;
+
+    std::mutex mutex;
+    std::map<int, Entry> entries;
+    unsigned long frame = 0;
+    double seconds_per_pixel = 0;
+
+    unsigned long refreshes = 0, reuses = 0, skips = 0, culls = 0;
+    unsigned long staleness_sum = 0, staleness_count = 0, staleness_max = 0;
+    std::vector<std::pair<int, unsigned long>> shown;
+};
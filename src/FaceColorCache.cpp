@@ -0,0 +1,209 @@
+#include "FaceColorCache.h"
+#include "FaceSwapper.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+// Overlap needed to continue a track, and frames a track survives without a detection
+static const double MIN_OVERLAP = 0.3;
+static const int MAX_MISSED = 5;
+
+// Entries of face pairs not seen for this many frames are dropped
+static const unsigned long MAX_UNUSED = 30;
+
+// Only every STATS_STEP-th row and column is looked at for the drift statistics
+static const int STATS_STEP = 4;
+
+static double overlap(const cv::Rect &a, const cv::Rect &b)
+{
+    double both = (a & b).area();
+    double either = a.area() + b.area() - both;
+    return either > 0 ? both / either : 0;
+}
+
+// Mean and standard deviation per channel of the masked pixels, on a sparse grid
+static void colorStatistics(const cv::Mat &image, const cv::Mat &mask, double mean[3], double std_dev[3])
+{
+    double sum[3] = { 0, 0, 0 }, squares[3] = { 0, 0, 0 };
+    unsigned long count = 0;
+
+    for (int i = 0; i < mask.rows; i += STATS_STEP)
+    {
+        const uint8_t *mask_pixel = mask.ptr<uint8_t>(i);
+        const uint8_t *pixel = image.ptr<uint8_t>(i);
+
+        for (int j = 0; j < mask.cols; j += STATS_STEP)
+        {
+            if (mask_pixel[j] != 0)
+            {
+                for (int c = 0; c < 3; c++)
+                {
+                    double v = pixel[3 * j + c];
+                    sum[c] += v;
+                    squares[c] += v * v;
+                }
+                count++;
+            }
+        }
+    }
+
+    for (int c = 0; c < 3; c++)
+    {
+        mean[c] = count ? sum[c] / count : 0;
+        std_dev[c] = count ? std::sqrt(std::max(0.0, squares[c] / count - mean[c] * mean[c])) : 0;
+    }
+}
+
+FaceColorCache::FaceColorCache(int refresh_frames, double drift, double smoothing) :
+    refresh_frames(refresh_frames), drift(drift), smoothing(std::min(1.0, std::max(0.01, smoothing)))
+{
+}
+
+std::vector<int> FaceColorCache::track(const std::vector<cv::Rect> &faces)
+{
+    std::unique_lock<std::mutex> l(mutex);
+    frame++;
+
+    // Greedy association, the best overlapping pairs are matched first
+    std::vector<std::pair<double, std::pair<size_t, size_t>>> candidates;
+    for (size_t f = 0; f < faces.size(); f++)
+    {
+        for (size_t t = 0; t < tracks.size(); t++)
+        {
+            double o = overlap(faces[f], tracks[t].rect);
+            if (o >= MIN_OVERLAP)
+                candidates.push_back(std::make_pair(o, std::make_pair(f, t)));
+        }
+    }
+    std::sort(candidates.begin(), candidates.end(),
+              [](const std::pair<double, std::pair<size_t, size_t>> &a, const std::pair<double, std::pair<size_t, size_t>> &b)
+              { return a.first > b.first; });
+
+    std::vector<int> ids(faces.size(), -1);
+    std::vector<bool> matched(tracks.size(), false);
+    for (auto &candidate : candidates)
+    {
+        size_t f = candidate.second.first, t = candidate.second.second;
+        if (ids[f] != -1 || matched[t])
+            continue;
+        ids[f] = tracks[t].id;
+        matched[t] = true;
+        tracks[t].rect = faces[f];
+        tracks[t].missed = 0;
+    }
+
+    // Tracks survive a few frames without a detection
+    for (size_t t = 0; t < tracks.size(); t++)
+        if (!matched[t])
+            tracks[t].missed++;
+    tracks.erase(std::remove_if(tracks.begin(), tracks.end(), [](const Track &t) { return t.missed > MAX_MISSED; }), tracks.end());
+
+    for (size_t f = 0; f < faces.size(); f++)
+    {
+        if (ids[f] == -1)
+        {
+            ids[f] = next_id++;
+            tracks.push_back(Track{ ids[f], faces[f], 0 });
+        }
+    }
+
+    std::vector<int> live;
+    for (const Track &t : tracks)
+        live.push_back(t.id);
+    evict(live);
+
+    return ids;
+}
+
+void FaceColorCache::endFrame(const std::vector<int> &live_tracks)
+{
+    std::unique_lock<std::mutex> l(mutex);
+    frame++;
+    evict(live_tracks);
+}
+
+void FaceColorCache::evict(const std::vector<int> &live_tracks)
+{
+    // Forget the tables of pairs that are gone: a pair with a face that is no
+    // longer tracked goes as soon as a track would, any pair after MAX_UNUSED
+    auto live = [&live_tracks](int id) { return std::find(live_tracks.begin(), live_tracks.end(), id) != live_tracks.end(); };
+    for (auto it = entries.begin(); it != entries.end(); )
+    {
+        unsigned long unused = frame - it->second.used;
+        bool gone = !live(it->first.first) || !live(it->first.second);
+        if (unused > MAX_UNUSED || (gone && unused > (unsigned long)MAX_MISSED))
+            it = entries.erase(it);
+        else
+            ++it;
+    }
+}
+
+void FaceColorCache::correct(int target_track, int source_track, const cv::Mat &source, cv::Mat target, const cv::Mat &mask)
+{
+    double source_mean[3], source_std[3], target_mean[3], target_std[3];
+    colorStatistics(source, mask, source_mean, source_std);
+    colorStatistics(target, mask, target_mean, target_std);
+
+    std::unique_lock<std::mutex> l(mutex);
+    lookups++;
+
+    auto key = std::make_pair(target_track, source_track);
+    auto it = entries.find(key);
+    bool fresh = it == entries.end();
+    Entry &entry = entries[key];
+
+    if (fresh || entry.age >= refresh_frames || drifted(entry, source_mean, source_std, target_mean, target_std))
+    {
+        uint8_t lut[3][256];
+        FaceSwapper::buildHistogramLUT(source, target, mask, lut);
+        rebuilds++;
+
+        // A new face pair starts from the table as built, later tables are
+        // blended in so the colours change gradually
+        float weight = fresh ? 1.0f : (float)smoothing;
+        for (int c = 0; c < 3; c++)
+        {
+            for (int i = 0; i < 256; i++)
+            {
+                entry.lut[c][i] = fresh ? lut[c][i] : entry.lut[c][i] + weight * (lut[c][i] - entry.lut[c][i]);
+                entry.table[c][i] = cv::saturate_cast<uint8_t>(entry.lut[c][i]);
+            }
+
+            entry.source_mean[c] = source_mean[c];
+            entry.source_std[c] = source_std[c];
+            entry.target_mean[c] = target_mean[c];
+            entry.target_std[c] = target_std[c];
+        }
+        entry.age = 0;
+    }
+    else
+    {
+        entry.age++;
+    }
+    entry.used = frame;
+
+    uint8_t table[3][256];
+    std::memcpy(table, entry.table, sizeof(table));
+    l.unlock();
+
+    FaceSwapper::applyLUT(target, mask, table);
+}
+
+bool FaceColorCache::drifted(const Entry &entry, const double source_mean[3], const double source_std[3],
+                             const double target_mean[3], const double target_std[3]) const
+{
+    for (int c = 0; c < 3; c++)
+    {
+        if (std::fabs(source_mean[c] - entry.source_mean[c]) > drift || std::fabs(source_std[c] - entry.source_std[c]) > drift ||
+            std::fabs(target_mean[c] - entry.target_mean[c]) > drift || std::fabs(target_std[c] - entry.target_std[c]) > drift)
+            return true;
+    }
+    return false;
+}
+
+FaceColorCache::Stats FaceColorCache::stats()
+{
+    std::unique_lock<std::mutex> l(mutex);
+    return Stats{ lookups, rebuilds, tracks.size() };
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <opencv2/core.hpp>
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+// Keeps the colour transfer lookup tables of one camera across frames.
+// Faces are followed from frame to frame by overlap of their rectangles and
+// every pair of tracked faces keeps its own LUT. The LUT is only rebuilt from
+// the histograms every refresh_frames frames or when the mean or standard
+// deviation of a channel drifted by more than drift levels, and rebuilt tables
+// are blended into the previous one, so most frames are a plain table lookup
+// and the correction does not flicker.
+class FaceColorCache
+{
+public:
+    struct Stats
+    {
+        unsigned long lookups;
+        unsigned long rebuilds;
+        size_t tracks;
+    };
+
+    // refresh_frames == 0 rebuilds on every frame, smoothing is the weight of a
+    // rebuilt table against the previous one, 1 replaces it
+    FaceColorCache(int refresh_frames, double drift, double smoothing);
+
+    // Track ids for faces of a new frame, in the same order
+    std::vector<int> track(const std::vector<cv::Rect> &faces);
+
+    // Repaints the masked part of target to the colours of source, for the
+    // face tracked as target_track showing the face of source_track
+    void correct(int target_track, int source_track, const cv::Mat &source, cv::Mat target, const cv::Mat &mask);
+
+    // Ends a frame whose faces are tracked elsewhere, as face_worker gets them
+    // from the host, and drops the tables of pairs that are gone. track() does
+    // this itself.
+    void endFrame(const std::vector<int> &live_tracks);
+
+    Stats stats();
+
+private:
+    struct Track
+    {
+        int id;
+        cv::Rect rect;
+        int missed;
+    };
+
+    struct Entry
+    {
+        float lut[3][256];
+        uint8_t table[3][256];
+        double source_mean[3], source_std[3];
+        double target_mean[3], target_std[3];
+        int age;
+        unsigned long used;
+    };
+
+    // With mutex held
+    void evict(const std::vector<int> &live_tracks);
+
+    bool drifted(const Entry &entry, const double source_mean[3], const double source_std[3],
+                 const double target_mean[3], const double target_std[3]) const;
+
+    int refresh_frames;
+    double drift;
+    double smoothing;
+
+    std::mutex mutex;
+    std::vector<Track> tracks;
+    int next_id = 0;
+    unsigned long frame = 0;
+    std::map<std::pair<int, int>, Entry> entries;
+
+    unsigned long lookups = 0, rebuilds = 0;
+};
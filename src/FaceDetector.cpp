@@ -0,0 +1,83 @@
+#include "FaceDetector.h"
+
+#include <dlib/opencv.h>
+
+#include <cmath>
+#include <iostream>
+#include <stdexcept>
+
+FaceDetector::~FaceDetector()
+{
+}
+
+std::unique_ptr<FaceDetector> FaceDetector::create(const std::string &spec)
+{
+    std::string name = spec;
+    std::string path;
+    size_t colon = spec.find(':');
+    if (colon != std::string::npos)
+    {
+        name = spec.substr(0, colon);
+        path = spec.substr(colon + 1);
+    }
+
+    try
+    {
+        if (name == "hog")
+            return std::unique_ptr<FaceDetector>(new HogFaceDetector());
+        if (name == "haar")
+            return std::unique_ptr<FaceDetector>(new CascadeFaceDetector(name, path.empty() ? "haarcascade_frontalface.xml" : path));
+        if (name == "lbp")
+            return std::unique_ptr<FaceDetector>(new CascadeFaceDetector(name, path.empty() ? "lbpcascade_frontalface.xml" : path));
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << "Detector " << name << " : " << e.what() << std::endl;
+        return nullptr;
+    }
+
+    std::cerr << "Unknown detector " << name << ", use hog, haar or lbp" << std::endl;
+    return nullptr;
+}
+
+std::vector<cv::Rect> FaceDetector::detect(const cv::Mat &gray_small, double scale)
+{
+    std::vector<cv::Rect> faces;
+    detectSmall(gray_small, faces);
+
+    for (cv::Rect &face : faces)
+    {
+        face = cv::Rect(cvRound(face.x * scale), cvRound(face.y * scale),
+                        cvRound(face.width * scale), cvRound(face.height * scale));
+    }
+
+    return faces;
+}
+
+HogFaceDetector::HogFaceDetector() :
+    detector_name("hog"), detector(dlib::get_frontal_face_detector())
+{
+}
+
+void HogFaceDetector::detectSmall(const cv::Mat &gray_small, std::vector<cv::Rect> &faces)
+{
+    // Grayscale input saves dlib its own colour conversion
+    dlib::cv_image<unsigned char> img(gray_small);
+
+    for (const dlib::rectangle &r : detector(img))
+        faces.push_back(cv::Rect(r.left(), r.top(), r.width(), r.height()));
+}
+
+CascadeFaceDetector::CascadeFaceDetector(const std::string &name, const std::string &cascade_path) :
+    detector_name(name)
+{
+    if (!cascade.load(cascade_path))
+        throw std::runtime_error("unable to load " + cascade_path);
+}
+
+void CascadeFaceDetector::detectSmall(const cv::Mat &gray_small, std::vector<cv::Rect> &faces)
+{
+    // Same scale step as face.cpp; the minimum size is the cascade window
+    // because the frame is already downscaled.
+    cascade.detectMultiScale(gray_small, faces, 1.3, 3, cv::CASCADE_SCALE_IMAGE, cv::Size(20, 20));
+}
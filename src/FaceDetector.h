@@ -0,0 +1,63 @@
+#pragma once
+
+#include <opencv2/core.hpp>
+#include <opencv2/objdetect.hpp>
+
+#include <dlib/image_processing/frontal_face_detector.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+// Common interface of the face detection backends. All of them work on the
+// same downscaled grayscale frame and report faces in full frame coordinates.
+class FaceDetector
+{
+public:
+    virtual ~FaceDetector();
+
+    // Creates a backend by name: hog, haar or lbp, optionally followed by :cascade.xml
+    static std::unique_ptr<FaceDetector> create(const std::string &spec);
+
+    // Finds faces in gray_small, which is the full frame shrunk by scale
+    std::vector<cv::Rect> detect(const cv::Mat &gray_small, double scale);
+
+    virtual const std::string &name() const = 0;
+
+protected:
+    // Finds faces in gray_small, in gray_small coordinates
+    virtual void detectSmall(const cv::Mat &gray_small, std::vector<cv::Rect> &faces) = 0;
+};
+
+// dlib HOG sliding window detector, the one the landmark model was trained with
+class HogFaceDetector : public FaceDetector
+{
+public:
+    HogFaceDetector();
+
+    const std::string &name() const override { return detector_name; }
+
+protected:
+    void detectSmall(const cv::Mat &gray_small, std::vector<cv::Rect> &faces) override;
+
+private:
+    std::string detector_name;
+    dlib::frontal_face_detector detector;
+};
+
+// OpenCV Haar or LBP cascade, LBP is several times cheaper on the Cortex-A8
+class CascadeFaceDetector : public FaceDetector
+{
+public:
+    // Throws std::runtime_error when the cascade file can not be loaded
+    CascadeFaceDetector(const std::string &name, const std::string &cascade_path);
+
+    const std::string &name() const override { return detector_name; }
+
+protected:
+    void detectSmall(const cv::Mat &gray_small, std::vector<cv::Rect> &faces) override;
+
+private:
+    std::string detector_name;
+    cv::CascadeClassifier cascade;
+};
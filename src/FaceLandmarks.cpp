@@ -0,0 +1,73 @@
+#include "FaceLandmarks.h"
+
+#include <opencv2/imgproc.hpp>
+
+#include <dlib/opencv.h>
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+int landmarkLevel(int face_width, int target_width)
+{
+    if (target_width <= 0)
+        return 0;
+
+    int level = 0;
+    while (level + 1 < FramePyramid::MAX_LEVELS && (face_width >> (level + 1)) >= target_width)
+        level++;
+    return level;
+}
+
+// Predicts on img, which is the full resolution image shrunk by 2^level with
+// its origin at full resolution pixel origin, so pixel p of img sits on pixel
+// origin + offset + p * 2^level. offset is 0 for levels made with pyrDown,
+// which keeps every second pixel of the level above, and (2^level - 1) / 2
+// for levels decoded at their scale (FramePyramid::grayOffset).
+template <typename image_type>
+static dlib::full_object_detection predictShrunk(const dlib::shape_predictor &model, const image_type &img, int level, cv::Point origin, double offset, const dlib::rectangle &face)
+{
+    double s = 1 << level;
+    auto shrink = [&](long v, int o) { return (long)std::lround((v - o - offset) / s); };
+    dlib::rectangle small(shrink(face.left(), origin.x), shrink(face.top(), origin.y), shrink(face.right(), origin.x), shrink(face.bottom(), origin.y));
+    dlib::full_object_detection shape = model(img, small);
+    if (level == 0 && origin == cv::Point())
+        return shape;
+
+    std::vector<dlib::point> parts(shape.num_parts());
+    for (unsigned long i = 0; i < shape.num_parts(); i++)
+        parts[i] = dlib::point(std::lround(origin.x + offset + shape.part(i).x() * s), std::lround(origin.y + offset + shape.part(i).y() * s));
+    return dlib::full_object_detection(face, parts);
+}
+
+dlib::full_object_detection predictLandmarks(const dlib::shape_predictor &model, FramePyramid &pyramid, const dlib::rectangle &face, int target_width)
+{
+    int level = landmarkLevel(face.width(), target_width);
+    dlib::cv_image<unsigned char> img(pyramid.gray(level));
+    return predictShrunk(model, img, level, cv::Point(), pyramid.grayOffset(level), face);
+}
+
+dlib::full_object_detection predictLandmarks(const dlib::shape_predictor &model, const cv::Mat &bgr, const dlib::rectangle &face, int target_width)
+{
+    int level = landmarkLevel(face.width(), target_width);
+    if (level == 0)
+    {
+        dlib::cv_image<dlib::bgr_pixel> img(bgr);
+        return model(img, face);
+    }
+
+    // The predictor looks a little outside the face rectangle, half a face on
+    // every side is plenty. The origin stays on the grid of the shrunk pixels.
+    long s = 1L << level;
+    long margin = face.width() / 2;
+    cv::Point origin((int)(std::max(0L, face.left() - margin) / s * s), (int)(std::max(0L, face.top() - margin) / s * s));
+    cv::Rect around = cv::Rect(origin, cv::Point((int)(face.right() + margin + 1), (int)(face.bottom() + margin + 1))) & cv::Rect(0, 0, bgr.cols, bgr.rows);
+
+    cv::Mat shrunk;
+    cv::cvtColor(bgr(around), shrunk, cv::COLOR_BGR2GRAY);
+    for (int i = 0; i < level; i++)
+        cv::pyrDown(shrunk, shrunk);
+
+    dlib::cv_image<unsigned char> img(shrunk);
+    return predictShrunk(model, img, level, origin, 0, face);
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <opencv2/core.hpp>
+
+#include <dlib/image_processing.h>
+
+#include "FramePyramid.h"
+
+// Face width in pixels the landmark model works best at. The 68 point model
+// was trained on faces found by the HOG detector, most of them 80 to 200
+// pixels wide; larger faces only make the predictor sample pixels that lie
+// far apart in memory.
+const int LANDMARK_FACE_WIDTH = 100;
+
+// Coarsest pyramid level on which a face of face_width pixels is still at
+// least target_width wide, 0 when target_width is 0
+int landmarkLevel(int face_width, int target_width);
+
+// Predicts the landmarks of face, given in full resolution coordinates, on the
+// gray pyramid level chosen by landmarkLevel. The rectangle and the landmarks
+// that come back are mapped back to full resolution.
+dlib::full_object_detection predictLandmarks(const dlib::shape_predictor &model, FramePyramid &pyramid, const dlib::rectangle &face, int target_width);
+
+// The same for a BGR image without a pyramid, only the surroundings of the
+// face are shrunk
+dlib::full_object_detection predictLandmarks(const dlib::shape_predictor &model, const cv::Mat &bgr, const dlib::rectangle &face, int target_width);
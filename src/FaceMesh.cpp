@@ -0,0 +1,57 @@
+#include "FaceMesh.h"
+
+#include <opencv2/imgproc.hpp>
+
+// Delaunay triangulation, worked out once on the mean face of the 68 point
+// layout, of the landmarks the FEATURES mesh keeps: every second jaw point,
+// the ends and middle of the brows, the nose bridge and tip, the eye corners
+// and the mouth corners and middle. Landmarks keep their order on any face
+// the model finds, so the triangles fit every face.
+static const int FEATURE_TRIANGLES[][3] = {
+    { 0, 2, 36 }, { 0, 17, 36 }, { 2, 4, 48 }, { 2, 31, 36 }, { 2, 31, 48 }, { 4, 6, 48 },
+    { 6, 8, 57 }, { 6, 48, 57 }, { 8, 10, 57 }, { 10, 12, 54 }, { 10, 54, 57 }, { 12, 14, 54 },
+    { 14, 16, 45 }, { 14, 35, 45 }, { 14, 35, 54 }, { 16, 26, 45 }, { 17, 19, 36 }, { 19, 21, 22 },
+    { 19, 21, 39 }, { 19, 22, 24 }, { 19, 36, 39 }, { 21, 22, 27 }, { 21, 27, 39 }, { 22, 24, 42 },
+    { 22, 27, 42 }, { 24, 26, 45 }, { 24, 42, 45 }, { 27, 30, 39 }, { 27, 30, 42 }, { 30, 31, 33 },
+    { 30, 31, 39 }, { 30, 33, 35 }, { 30, 35, 42 }, { 31, 33, 51 }, { 31, 36, 39 }, { 31, 48, 51 },
+    { 33, 35, 51 }, { 35, 42, 45 }, { 35, 51, 54 }, { 48, 51, 57 }, { 51, 54, 57 }
+};
+
+// Chin and outer eye corners
+static const int HULL_KEYPOINTS[3] = { 8, 36, 45 };
+
+FaceMesh::FaceMesh(int full_size, int features_size) :
+    full_area((double)full_size * full_size), features_area((double)features_size * features_size)
+{
+}
+
+FaceMesh::Level FaceMesh::levelFor(const cv::Rect &face) const
+{
+    double area = face.area();
+    if (area >= full_area)
+        return FULL;
+    return area >= features_area ? FEATURES : HULL;
+}
+
+const std::vector<std::vector<int>> &FaceMesh::featureTriangles()
+{
+    static const std::vector<std::vector<int>> triangles = []
+    {
+        std::vector<std::vector<int>> t;
+        for (const int (&triangle)[3] : FEATURE_TRIANGLES)
+            t.push_back(std::vector<int>(triangle, triangle + 3));
+        return t;
+    }();
+    return triangles;
+}
+
+cv::Mat FaceMesh::hullTransform(const cv::Point2f *src, const cv::Point2f *dst)
+{
+    cv::Point2f from[3], to[3];
+    for (int i = 0; i < 3; i++)
+    {
+        from[i] = src[HULL_KEYPOINTS[i]];
+        to[i] = dst[HULL_KEYPOINTS[i]];
+    }
+    return cv::getAffineTransform(from, to);
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <opencv2/core.hpp>
+
+#include <vector>
+
+// Levels of detail of the mesh a face is warped with. Every triangle costs a
+// bounding box, an affine transform, a warp and a mask, which small faces do
+// not need:
+//   FULL      Delaunay triangles over all 68 landmarks, about 100 of them
+//   FEATURES  triangles over the jaw contour, brows, eye corners, nose and mouth
+//   HULL      no triangles, the whole face is warped by the affine transform of
+//             the chin and the outer eye corners, as FaceSwapper does
+// The level is chosen by the pixel area of the face the warp is drawn on.
+class FaceMesh
+{
+public:
+    enum Level
+    {
+        FULL,
+        FEATURES,
+        HULL
+    };
+
+    // Faces of at least full_size² pixels get the full mesh, faces of at
+    // least features_size² the reduced one and smaller faces the hull
+    FaceMesh(int full_size = 120, int features_size = 60);
+
+    Level levelFor(const cv::Rect &face) const;
+
+    // Triangles of the FEATURES level as indices into the 68 landmarks, the
+    // same for every face. The FULL level is the Delaunay triangulation of all
+    // of them.
+    static const std::vector<std::vector<int>> &featureTriangles();
+
+    // Affine transform of the HULL level from the source to the target landmarks
+    static cv::Mat hullTransform(const cv::Point2f *src, const cv::Point2f *dst);
+
+private:
+    double full_area, features_area;
+};
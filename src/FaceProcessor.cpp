@@ -0,0 +1,215 @@
+#include "FaceProcessor.h"
+
+#include <opencv2/imgproc.hpp>
+
+#include <chrono>
+
+#include "FaceLandmarks.h"
+#include "MatTrace.h"
+
+// The detector works on the frame shrunk by this much
+static const int FACE_DOWNSAMPLE_RATIO = 4;
+
+static std::vector<cv::Point2f> landmarkPoints(const dlib::full_object_detection &d)
+{
+    std::vector<cv::Point2f> points;
+    for (unsigned long i = 0; i < d.num_parts(); ++i)
+        points.push_back(cv::Point2f(d.part(i).x(), d.part(i).y()));
+    return points;
+}
+
+FaceProcessor::FaceProcessor(const dlib::shape_predictor &model, int landmark_width, const FaceMesh &mesh) :
+    model(model), landmark_width(landmark_width), mesh(mesh)
+{
+}
+
+size_t FaceProcessor::plan(FramePyramid &pyramid, FaceDetector &detector, FaceColorCache &colors, FaceBudget &budget, Plan &planned) const
+{
+    MatTrace::Stage stage("detect");
+    planned = Plan();
+
+    // The detector and the landmark predictor read the shared grayscale
+    // pyramid levels instead of resampling and converting on their own.
+    // Rectangles come back in full resolution coordinates.
+    int detectLevel = FramePyramid::levelFor(FACE_DOWNSAMPLE_RATIO);
+    std::vector<cv::Rect> faces = detector.detect(pyramid.gray(detectLevel), FramePyramid::scale(detectLevel));
+
+    // Follow the faces across frames so their colour tables can be kept
+    std::vector<int> tracks = colors.track(faces);
+    if (faces.empty())
+        return 0;
+
+    // The budget decides per face whether it is refreshed, shown with its last
+    // patch or left alone, the swap goes around the faces that are kept
+    std::vector<FaceBudget::Action> actions = budget.plan(faces, tracks);
+    for (size_t i = 0; i < faces.size(); i++)
+    {
+        if (actions[i] == FaceBudget::SKIP)
+            continue;
+        planned.faces.push_back(faces[i]);
+        planned.tracks.push_back(tracks[i]);
+        planned.actions.push_back(actions[i]);
+    }
+    return faces.size();
+}
+
+void FaceProcessor::swap(FramePyramid &pyramid, const Plan &plan, FaceColorCache &colors, FaceBudget *budget, std::vector<FacePatch> &patches) const
+{
+    // A single face has nobody to swap with
+    size_t count = plan.faces.size();
+    if (count < 2)
+        return;
+
+    MatTrace::Stage stage("landmarks");
+    auto refreshStart = std::chrono::steady_clock::now();
+    double refreshedArea = 0;
+
+    // The captured frame is never written to, only replaced by the capture
+    // thread, so it is used without a copy
+    const cv::Mat &frame = pyramid.bgr(0);
+    cv::Rect frameRect(0, 0, frame.cols, frame.rows);
+
+    std::vector<FaceBudget::Action> actions = plan.actions;
+    std::vector<std::vector<cv::Point2f>> points(count), hulls(count);
+    std::vector<std::vector<std::vector<int>>> dts(count);
+
+    for (size_t k = 0; k < count; ++k)
+    {
+        const cv::Rect &face = plan.faces[k];
+
+        // Faces that are not refreshed keep the landmarks of their last refresh
+        if (actions[k] == FaceBudget::REFRESH || !budget || !budget->landmarks(plan.tracks[k], face, points[k], dts[k]))
+        {
+            // Landmark detection on the pyramid level that brings the face
+            // closest to the model's scale, mapped back to full resolution
+            dlib::rectangle r(face.x, face.y, face.x + face.width - 1, face.y + face.height - 1);
+            points[k] = landmarkPoints(predictLandmarks(model, pyramid, r, landmark_width));
+
+            dts[k].clear();
+            calculateDelaunayTriangles(frameRect, points[k], dts[k]);
+            if (budget)
+                budget->storeLandmarks(plan.tracks[k], face, points[k], dts[k]);
+            actions[k] = FaceBudget::REFRESH;
+        }
+
+        std::vector<int> hullIndex;
+        cv::convexHull(points[k], hullIndex, false, false);
+        for (int index : hullIndex)
+            hulls[k].push_back(points[k][index]);
+    }
+
+    // Only the face regions are touched. Each refreshed face gets a patch over
+    // the bounding box of its hull, the triangles warped onto it and its blend
+    // mask all lie inside that box, so the float work scales with the faces.
+    // Face k shows face k - 1, the others reuse their last patch.
+    TriangleBatch batch;
+    std::vector<cv::Point2f> sourcePoints, targetPoints;
+    std::vector<std::vector<int>> clippedTriangles;
+    for (size_t k = 0; k < count; k++)
+    {
+        size_t s = (k + count - 1) % count;
+        int targetTrack = plan.tracks[k], sourceTrack = plan.tracks[s];
+
+        FacePatch patch;
+        patch.track = targetTrack;
+        patch.source_track = sourceTrack;
+        if (actions[k] == FaceBudget::REUSE)
+        {
+            stage.set("reuse");
+            if (budget && budget->reusePatch(targetTrack, sourceTrack, plan.faces[k], frameRect, patch))
+                patches.push_back(patch);
+            continue;
+        }
+
+        cv::Rect hullRect = cv::boundingRect(hulls[k]), sourceHullRect = cv::boundingRect(hulls[s]);
+        cv::Rect r = hullRect & frameRect;
+        cv::Rect sourceRect = sourceHullRect & frameRect;
+        if (r.area() == 0 || sourceRect.area() == 0)
+            continue;
+        stage.set("warp");
+        patch.rect = r;
+        refreshedArea += plan.faces[k].area();
+
+        // Landmarks relative to the patches
+        sourcePoints.clear();
+        targetPoints.clear();
+        for (const cv::Point2f &p : points[s])
+            sourcePoints.push_back(p - cv::Point2f(sourceRect.tl()));
+        for (const cv::Point2f &p : points[k])
+            targetPoints.push_back(p - cv::Point2f(r.tl()));
+
+        // The smaller the face is drawn, the fewer triangles it is warped with,
+        // the smallest ones are warped in one piece
+        FaceMesh::Level level = mesh.levelFor(plan.faces[k]);
+        if (level == FaceMesh::HULL)
+        {
+            cv::warpAffine(frame(sourceRect), patch.pixels, FaceMesh::hullTransform(sourcePoints.data(), targetPoints.data()),
+                           r.size(), cv::INTER_LINEAR, cv::BORDER_REFLECT_101);
+        }
+        else
+        {
+            const std::vector<std::vector<int>> *triangles = &dts[s];
+            if (level == FaceMesh::FEATURES)
+                triangles = &FaceMesh::featureTriangles();
+
+            // The feature table does not know the frame, nor do the triangles
+            // of landmarks moved along from an earlier frame. Of a face partly
+            // outside the frame only the triangles inside it are warped.
+            if (r != hullRect || sourceRect != sourceHullRect)
+            {
+                cv::Rect sourceArea(cv::Point(), sourceRect.size()), targetArea(cv::Point(), r.size());
+                clippedTriangles.clear();
+                for (const std::vector<int> &t : *triangles)
+                {
+                    cv::Rect from = cv::boundingRect(std::vector<cv::Point2f>{ sourcePoints[t[0]], sourcePoints[t[1]], sourcePoints[t[2]] });
+                    cv::Rect to = cv::boundingRect(std::vector<cv::Point2f>{ targetPoints[t[0]], targetPoints[t[1]], targetPoints[t[2]] });
+                    if ((from & sourceArea) == from && (to & targetArea) == to)
+                        clippedTriangles.push_back(t);
+                }
+                triangles = &clippedTriangles;
+            }
+
+            // Apply affine transformation to Delaunay triangles
+            tracedCopy(frame(r), patch.pixels);
+            cv::Mat source, target;
+            tracedConvert(frame(sourceRect), source, CV_32F);
+            tracedConvert(patch.pixels, target, CV_32F);
+            computeTriangleTransforms(sourcePoints.data(), targetPoints.data(), *triangles, batch);
+            warpTriangles(source, target, batch);
+            tracedConvert(target, patch.pixels, CV_8UC3);
+        }
+
+        // Calculate mask
+        stage.set("color");
+        std::vector<cv::Point> hull8U;
+        for (const cv::Point2f &p : hulls[k])
+            hull8U.push_back(cv::Point(p.x, p.y) - r.tl());
+
+        cv::Mat mask(r.size(), CV_8UC1, cv::Scalar::all(0));
+        cv::fillConvexPoly(mask, &hull8U[0], hull8U.size(), cv::Scalar(255, 0, 0));
+        colors.correct(targetTrack, sourceTrack, frame(r), patch.pixels, mask);
+        patch.mask = mask;
+
+        stage.set("blend");
+        cv::Mat weights; tracedConvert(mask, weights, CV_32F, 1.0 / 255.0);
+        cv::Mat_<cv::Vec3f> left; tracedConvert(patch.pixels, left, CV_32F, 1.0 / 255.0);
+        cv::Mat_<cv::Vec3f> right; tracedConvert(frame(r), right, CV_32F, 1.0 / 255.0);
+        cv::Mat_<cv::Vec3f> blend = LaplacianBlend(left, right, weights);
+        tracedConvert(blend, patch.pixels, CV_8UC3, 255);
+
+        if (budget)
+            budget->storePatch(targetTrack, sourceTrack, patch);
+        patches.push_back(patch);
+    }
+
+    if (budget)
+        budget->refreshed(std::chrono::duration<double>(std::chrono::steady_clock::now() - refreshStart).count(), refreshedArea);
+}
+
+size_t FaceProcessor::process(FramePyramid &pyramid, FaceDetector &detector, FaceColorCache &colors, FaceBudget &budget, std::vector<FacePatch> &patches) const
+{
+    Plan faces;
+    size_t detected = plan(pyramid, detector, colors, budget, faces);
+    swap(pyramid, faces, colors, &budget, patches);
+    return detected;
+}
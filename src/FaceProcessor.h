@@ -0,0 +1,55 @@
+#pragma once
+
+#include <opencv2/core.hpp>
+
+#include <dlib/image_processing.h>
+
+#include <vector>
+
+#include "FaceBudget.h"
+#include "FaceColorCache.h"
+#include "FaceDetector.h"
+#include "FaceMesh.h"
+#include "FaceWarp.h"
+#include "FramePyramid.h"
+
+// The face swap of one frame, shared by the model threads of sfml and by
+// face_worker: faces are detected, followed across frames and planned by the
+// budget, then landmarked, warped, colour corrected and blended into patches
+// over the frame. The frame itself is never written to.
+//
+// Planning needs the state of the camera and stays on the capture host, the
+// swap of a plan can run anywhere the frame pixels around the faces are.
+class FaceProcessor
+{
+public:
+    // Faces of one frame that take part in the swap, face k shows face k - 1
+    struct Plan
+    {
+        std::vector<cv::Rect> faces;
+        std::vector<int> tracks;
+        std::vector<FaceBudget::Action> actions;    // REFRESH or REUSE
+    };
+
+    // model is shared and only read
+    FaceProcessor(const dlib::shape_predictor &model, int landmark_width, const FaceMesh &mesh);
+
+    // Detects and tracks the faces of a frame and has the budget plan them,
+    // returns the number of faces detected. Fewer than two planned faces
+    // leave nothing to swap.
+    size_t plan(FramePyramid &pyramid, FaceDetector &detector, FaceColorCache &colors, FaceBudget &budget, Plan &planned) const;
+
+    // Patches for the faces of plan, in full frame coordinates. With a budget
+    // reused faces get their last patch, faces that are not refreshed keep
+    // their last landmarks and refreshes are recorded. Without one every face
+    // is landmarked and only the refreshed ones get a patch.
+    void swap(FramePyramid &pyramid, const Plan &plan, FaceColorCache &colors, FaceBudget *budget, std::vector<FacePatch> &patches) const;
+
+    // plan and swap of one frame, returns the number of faces detected
+    size_t process(FramePyramid &pyramid, FaceDetector &detector, FaceColorCache &colors, FaceBudget &budget, std::vector<FacePatch> &patches) const;
+
+private:
+    const dlib::shape_predictor &model;
+    int landmark_width;
+    FaceMesh mesh;
+};
@@ -1,4 +1,6 @@
 #include "FaceSwapper.h"
+#include "ImageKernels.h"
+#include "MatTrace.h"
 
 #include <iostream>
 
@@ -18,6 +20,12 @@ FaceSwapper::FaceSwapper(const std::string landmarks_path)
             << "You can download the file from http://sourceforge.net/projects/dclib/files/dlib/v18.10/shape_predictor_68_face_landmarks.dat.bz2" << std::endl;
         exit(-1);
     }
+
+    if (pose_model.num_parts() != Landmarks68::PARTS && pose_model.num_parts() != Landmarks5::PARTS)
+    {
+        std::cerr << "Landmarks in " << landmarks_path << " have " << pose_model.num_parts() << " parts, only the 68 and 5 point models are supported" << std::endl;
+        exit(-1);
+    }
 }
 
 
@@ -27,6 +35,7 @@ FaceSwapper::~FaceSwapper()
 
 void FaceSwapper::swapFaces(cv::Mat &frame, cv::Rect &rect_ann, cv::Rect &rect_bob)
 {
+    MatTrace::Stage stage("swap:landmarks");
     small_frame = getMinFrame(frame, rect_ann, rect_bob);
 
     frame_size = cv::Size(small_frame.cols, small_frame.rows);
@@ -35,6 +44,7 @@ void FaceSwapper::swapFaces(cv::Mat &frame, cv::Rect &rect_ann, cv::Rect &rect_b
 
     getTransformationMatrices();
 
+    stage.set("swap:masks");
     mask_ann.create(frame_size, CV_8UC1);
     mask_bob.create(frame_size, CV_8UC1);
     getMasks();
@@ -43,12 +53,15 @@ void FaceSwapper::swapFaces(cv::Mat &frame, cv::Rect &rect_ann, cv::Rect &rect_b
 
     refined_masks = getRefinedMasks();
 
+    stage.set("swap:warp");
     extractFaces();
 
     warpped_faces = getWarppedFaces();
 
+    stage.set("swap:color");
     colorCorrectFaces();
 
+    stage.set("swap:paste");
     featherMask(refined_masks(big_rect_ann));
     featherMask(refined_masks(big_rect_bob));
 
@@ -80,49 +93,25 @@ void FaceSwapper::getFacePoints(const cv::Mat &frame)
     dlib_rects[0] = rectangle(rect_ann.x, rect_ann.y, rect_ann.x + rect_ann.width, rect_ann.y + rect_ann.height);
     dlib_rects[1] = rectangle(rect_bob.x, rect_bob.y, rect_bob.x + rect_bob.width, rect_bob.y + rect_bob.height);
 
-    dlib_frame = frame;
-
-    shapes[0] = pose_model(dlib_frame, dlib_rects[0]);
-    shapes[1] = pose_model(dlib_frame, dlib_rects[1]);
-
-    auto getPoint = [&](int shape_index, int part_index) -> const cv::Point2i
-    {
-        const auto &p = shapes[shape_index].part(part_index);
-        return cv::Point2i(p.x(), p.y());
-    };
-
-    points_ann[0] = getPoint(0, 0);
-    points_ann[1] = getPoint(0, 3);
-    points_ann[2] = getPoint(0, 5);
-    points_ann[3] = getPoint(0, 8);
-    points_ann[4] = getPoint(0, 11);
-    points_ann[5] = getPoint(0, 13);
-    points_ann[6] = getPoint(0, 16);
-
-    cv::Point2i nose_length = getPoint(0, 27) - getPoint(0, 30);
-    points_ann[7] = getPoint(0, 26) + nose_length;
-    points_ann[8] = getPoint(0, 17) + nose_length;
-
-
-    points_bob[0] = getPoint(1, 0);
-    points_bob[1] = getPoint(1, 3);
-    points_bob[2] = getPoint(1, 5);
-    points_bob[3] = getPoint(1, 8);
-    points_bob[4] = getPoint(1, 11);
-    points_bob[5] = getPoint(1, 13);
-    points_bob[6] = getPoint(1, 16);
+    // Large faces are shrunk towards the scale the model was trained at
+    shapes[0] = predictLandmarks(pose_model, frame, dlib_rects[0], landmark_width);
+    shapes[1] = predictLandmarks(pose_model, frame, dlib_rects[1], landmark_width);
 
-    nose_length = getPoint(1, 27) - getPoint(1, 30);
-    points_bob[7] = getPoint(1, 26) + nose_length;
-    points_bob[8] = getPoint(1, 17) + nose_length;
+    // The hull and the affine keypoints come from whichever layout the model has
+    if (pose_model.num_parts() == Landmarks5::PARTS)
+        extractFacePoints<Landmarks5>();
+    else
+        extractFacePoints<Landmarks68>();
+}
 
-    affine_transform_keypoints_ann[0] = points_ann[3];
-    affine_transform_keypoints_ann[1] = getPoint(0, 36);
-    affine_transform_keypoints_ann[2] = getPoint(0, 45);
+template <class Layout>
+void FaceSwapper::extractFacePoints()
+{
+    Layout::hull(shapes[0], points_ann);
+    Layout::hull(shapes[1], points_bob);
 
-    affine_transform_keypoints_bob[0] = points_bob[3];
-    affine_transform_keypoints_bob[1] = getPoint(1, 36);
-    affine_transform_keypoints_bob[2] = getPoint(1, 45);
+    Layout::keypoints(shapes[0], points_ann, affine_transform_keypoints_ann);
+    Layout::keypoints(shapes[1], points_bob, affine_transform_keypoints_bob);
 
     feather_amount.width = feather_amount.height = (int)cv::norm(points_ann[0] - points_ann[6]) / 8;
 }
@@ -154,16 +143,16 @@ cv::Mat FaceSwapper::getRefinedMasks()
     cv::bitwise_and(mask_bob, warpped_mask_ann, refined_bob_and_ann_warpped);
 
     cv::Mat refined_masks(frame_size, CV_8UC1, cv::Scalar(0));
-    refined_ann_and_bob_warpped.copyTo(refined_masks, refined_ann_and_bob_warpped);
-    refined_bob_and_ann_warpped.copyTo(refined_masks, refined_bob_and_ann_warpped);
+    tracedCopy(refined_ann_and_bob_warpped, refined_masks, refined_ann_and_bob_warpped);
+    tracedCopy(refined_bob_and_ann_warpped, refined_masks, refined_bob_and_ann_warpped);
 
     return refined_masks;
 }
 
 void FaceSwapper::extractFaces()
 {
-    small_frame.copyTo(face_ann, mask_ann);
-    small_frame.copyTo(face_bob, mask_bob);
+    tracedCopy(small_frame, face_ann, mask_ann);
+    tracedCopy(small_frame, face_bob, mask_bob);
 }
 
 cv::Mat FaceSwapper::getWarppedFaces()
@@ -173,8 +162,8 @@ cv::Mat FaceSwapper::getWarppedFaces()
     cv::warpAffine(face_ann, warpped_face_ann, trans_ann_to_bob, frame_size, cv::INTER_NEAREST, cv::BORDER_CONSTANT, cv::Scalar(0, 0, 0));
     cv::warpAffine(face_bob, warpped_face_bob, trans_bob_to_ann, frame_size, cv::INTER_NEAREST, cv::BORDER_CONSTANT, cv::Scalar(0, 0, 0));
 
-    warpped_face_ann.copyTo(warpped_faces, warpped_mask_ann);
-    warpped_face_bob.copyTo(warpped_faces, warpped_mask_bob);
+    tracedCopy(warpped_face_ann, warpped_faces, warpped_mask_ann);
+    tracedCopy(warpped_face_bob, warpped_faces, warpped_mask_bob);
 
     return warpped_faces;
 }
@@ -192,59 +181,34 @@ void FaceSwapper::featherMask(cv::Mat refined_masks)
     cv::blur(refined_masks, refined_masks, feather_amount, cv::Point(-1, -1), cv::BORDER_CONSTANT);
 }
 
-inline void FaceSwapper::pasteFacesOnFrame()
+void FaceSwapper::pasteFacesOnFrame()
 {
-    for (size_t i = 0; i < small_frame.rows; i++)
-    {
-        auto frame_pixel = small_frame.row(i).data;
-        auto faces_pixel = warpped_faces.row(i).data;
-        auto masks_pixel = refined_masks.row(i).data;
-
-        for (size_t j = 0; j < small_frame.cols; j++)
-        {
-            if (*masks_pixel != 0)
-            {
-                *frame_pixel = ((255 - *masks_pixel) * (*frame_pixel) + (*masks_pixel) * (*faces_pixel)) >> 8; // divide by 256
-                *(frame_pixel + 1) = ((255 - *(masks_pixel + 1)) * (*(frame_pixel + 1)) + (*(masks_pixel + 1)) * (*(faces_pixel + 1))) >> 8;
-                *(frame_pixel + 2) = ((255 - *(masks_pixel + 2)) * (*(frame_pixel + 2)) + (*(masks_pixel + 2)) * (*(faces_pixel + 2))) >> 8;
-            }
-
-            frame_pixel += 3;
-            faces_pixel += 3;
-            masks_pixel++;
-        }
-    }
+    auto blend = kernels().blendMasked8u;
+    for (int i = 0; i < small_frame.rows; i++)
+        blend(small_frame.ptr<uint8_t>(i), warpped_faces.ptr<uint8_t>(i), refined_masks.ptr<uint8_t>(i), small_frame.cols);
 }
 
 void FaceSwapper::specifiyHistogram(const cv::Mat source_image, cv::Mat target_image, cv::Mat mask)
 {
+    buildHistogramLUT(source_image, target_image, mask, LUT);
+    applyLUT(target_image, mask, LUT);
+}
 
-    std::memset(source_hist_int, 0, sizeof(int) * 3 * 256);
-    std::memset(target_hist_int, 0, sizeof(int) * 3 * 256);
+void FaceSwapper::buildHistogramLUT(const cv::Mat source_image, const cv::Mat target_image, const cv::Mat mask, uint8_t lut[3][256])
+{
+    uint32_t source_hist_int[3][256];
+    uint32_t target_hist_int[3][256];
+    float source_histogram[3][256];
+    float target_histogram[3][256];
 
-    for (size_t i = 0; i < mask.rows; i++)
-    {
-        auto current_mask_pixel = mask.row(i).data;
-        auto current_source_pixel = source_image.row(i).data;
-        auto current_target_pixel = target_image.row(i).data;
+    std::memset(source_hist_int, 0, sizeof(source_hist_int));
+    std::memset(target_hist_int, 0, sizeof(target_hist_int));
 
-        for (size_t j = 0; j < mask.cols; j++)
-        {
-            if (*current_mask_pixel != 0) {
-                source_hist_int[0][*current_source_pixel]++;
-                source_hist_int[1][*(current_source_pixel + 1)]++;
-                source_hist_int[2][*(current_source_pixel + 2)]++;
-
-                target_hist_int[0][*current_target_pixel]++;
-                target_hist_int[1][*(current_target_pixel + 1)]++;
-                target_hist_int[2][*(current_target_pixel + 2)]++;
-            }
-
-            // Advance to next pixel
-            current_source_pixel += 3; 
-            current_target_pixel += 3; 
-            current_mask_pixel++; 
-        }
+    auto histogram = kernels().histogramMasked3;
+    for (int i = 0; i < mask.rows; i++)
+    {
+        histogram(source_image.ptr<uint8_t>(i), mask.ptr<uint8_t>(i), mask.cols, source_hist_int);
+        histogram(target_image.ptr<uint8_t>(i), mask.ptr<uint8_t>(i), mask.cols, target_hist_int);
     }
 
     // Calc CDF
@@ -290,28 +254,16 @@ void FaceSwapper::specifiyHistogram(const cv::Mat source_image, cv::Mat target_i
 
     for (size_t i = 0; i < 256; i++)
     {
-        LUT[0][i] = binary_search(target_histogram[0][i], source_histogram[0]);
-        LUT[1][i] = binary_search(target_histogram[1][i], source_histogram[1]);
-        LUT[2][i] = binary_search(target_histogram[2][i], source_histogram[2]);
+        lut[0][i] = binary_search(target_histogram[0][i], source_histogram[0]);
+        lut[1][i] = binary_search(target_histogram[1][i], source_histogram[1]);
+        lut[2][i] = binary_search(target_histogram[2][i], source_histogram[2]);
     }
+}
 
+void FaceSwapper::applyLUT(cv::Mat target_image, const cv::Mat mask, const uint8_t lut[3][256])
+{
     // repaint pixels
-    for (size_t i = 0; i < mask.rows; i++)
-    {
-        auto current_mask_pixel = mask.row(i).data;
-        auto current_target_pixel = target_image.row(i).data;
-        for (size_t j = 0; j < mask.cols; j++)
-        {
-            if (*current_mask_pixel != 0)
-            {
-                *current_target_pixel = LUT[0][*current_target_pixel];
-                *(current_target_pixel + 1) = LUT[1][*(current_target_pixel + 1)];
-                *(current_target_pixel + 2) = LUT[2][*(current_target_pixel + 2)];
-            }
-
-            // Advance to next pixel
-            current_target_pixel += 3;
-            current_mask_pixel++;
-        }
-    }
+    auto remap = kernels().lutMasked3;
+    for (int i = 0; i < mask.rows; i++)
+        remap(target_image.ptr<uint8_t>(i), mask.ptr<uint8_t>(i), mask.cols, lut);
 }
@@ -15,6 +15,9 @@
 #include <dlib/image_processing.h>
 #include <dlib/gui_widgets.h>
 
+#include "FaceLandmarks.h"
+#include "LandmarkLayout.h"
+
 class FaceSwapper
 {
 public:
@@ -29,9 +32,14 @@ public:
     // Returns minimal Mat containing both faces
     cv::Mat getMinFrame(const cv::Mat &frame, cv::Rect &rect_ann, cv::Rect &rect_bob);
 
-    // Finds facial landmarks on faces and extracts the useful points
+    // Finds facial landmarks on faces and extracts the useful points, with the
+    // 68 or the 5 point model
     void getFacePoints(const cv::Mat &frame);
 
+    // Derives the hull and affine keypoints of both faces from shapes
+    template <class Layout>
+    void extractFacePoints();
+
     // Calculates transformation matrices based on points extracted by getFacePoints
     void getTransformationMatrices();
 
@@ -62,13 +70,20 @@ public:
     // Calculates source image histogram and changes target_image to match source hist
     void specifiyHistogram(const cv::Mat source_image, cv::Mat target_image, cv::Mat mask);
 
+    // Builds the per channel lookup table that maps the masked histogram of target_image onto source_image
+    static void buildHistogramLUT(const cv::Mat source_image, const cv::Mat target_image, const cv::Mat mask, uint8_t lut[3][256]);
+
+    // Repaints the masked pixels of target_image through lut
+    static void applyLUT(cv::Mat target_image, const cv::Mat mask, const uint8_t lut[3][256]);
+
     cv::Rect rect_ann, rect_bob;
     cv::Rect big_rect_ann, big_rect_bob;
 
     dlib::shape_predictor pose_model;
     dlib::full_object_detection shapes[2];
     dlib::rectangle dlib_rects[2];
-    dlib::cv_image<dlib::bgr_pixel> dlib_frame;
+    // Faces wider than this get their landmarks on a shrunk copy, 0 keeps full resolution
+    int landmark_width = LANDMARK_FACE_WIDTH;
     cv::Point2f affine_transform_keypoints_ann[3], affine_transform_keypoints_bob[3];
 
     cv::Mat refined_ann_and_bob_warpped, refined_bob_and_ann_warpped;
@@ -89,9 +104,5 @@ public:
     cv::Size feather_amount;
 
     uint8_t LUT[3][256];
-    int source_hist_int[3][256];
-    int target_hist_int[3][256];
-    float source_histogram[3][256];
-    float target_histogram[3][256];
 };
 
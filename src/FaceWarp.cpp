@@ -0,0 +1,275 @@
+#include "FaceWarp.h"
+
+#include <opencv2/imgproc.hpp>
+#include <opencv2/imgproc/types_c.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+using namespace cv;
+
+class LaplacianBlending {
+private:
+    Mat_<Vec3f> left;
+    Mat_<Vec3f> right;
+    Mat_<float> blendMask;
+
+    std::vector<Mat_<Vec3f> > leftLapPyr,rightLapPyr,resultLapPyr;
+    Mat leftSmallestLevel, rightSmallestLevel, resultSmallestLevel;
+    std::vector<Mat_<Vec3f> > maskGaussianPyramid; //masks are 3-channels for easier multiplication with RGB
+
+    int levels;
+
+
+    void buildPyramids() {
+        buildLaplacianPyramid(left,leftLapPyr,leftSmallestLevel);
+        buildLaplacianPyramid(right,rightLapPyr,rightSmallestLevel);
+        buildGaussianPyramid();
+    }
+
+    void buildGaussianPyramid() {
+        assert(leftLapPyr.size()>0);
+
+        maskGaussianPyramid.clear();
+        Mat currentImg;
+        cvtColor(blendMask, currentImg, CV_GRAY2BGR);
+        maskGaussianPyramid.push_back(currentImg); //highest level
+
+        currentImg = blendMask;
+        for (unsigned int l=1; l<levels+1; l++) {
+            Mat _down;
+            if (leftLapPyr.size() > l) {
+                pyrDown(currentImg, _down, leftLapPyr[l].size());
+            } else {
+                pyrDown(currentImg, _down, leftSmallestLevel.size()); //smallest level
+            }
+
+            Mat down;
+            cvtColor(_down, down, CV_GRAY2BGR);
+            maskGaussianPyramid.push_back(down);
+            currentImg = _down;
+        }
+    }
+
+    void buildLaplacianPyramid(const Mat& img, std::vector<Mat_<Vec3f> >& lapPyr, Mat& smallestLevel) {
+        lapPyr.clear();
+        Mat currentImg = img;
+        for (int l=0; l<levels; l++) {
+            Mat down,up;
+            pyrDown(currentImg, down);
+            pyrUp(down, up, currentImg.size());
+            Mat lap = currentImg - up;
+            lapPyr.push_back(lap);
+            currentImg = down;
+        }
+        currentImg.copyTo(smallestLevel);
+    }
+
+    Mat_<Vec3f> reconstructImgFromLapPyramid() {
+        Mat currentImg = resultSmallestLevel;
+        for (int l=levels-1; l>=0; l--) {
+            Mat up;
+
+            pyrUp(currentImg, up, resultLapPyr[l].size());
+            currentImg = up + resultLapPyr[l];
+        }
+        return currentImg;
+    }
+
+    void blendLapPyrs() {
+        resultSmallestLevel = leftSmallestLevel.mul(maskGaussianPyramid.back()) +
+                                    rightSmallestLevel.mul(Scalar(1.0,1.0,1.0) - maskGaussianPyramid.back());
+        for (int l=0; l<levels; l++) {
+            Mat A = leftLapPyr[l].mul(maskGaussianPyramid[l]);
+            Mat antiMask = Scalar(1.0,1.0,1.0) - maskGaussianPyramid[l];
+            Mat B = rightLapPyr[l].mul(antiMask);
+            Mat_<Vec3f> blendedLevel = A + B;
+
+            resultLapPyr.push_back(blendedLevel);
+        }
+    }
+
+public:
+    LaplacianBlending(const Mat_<Vec3f>& _left, const Mat_<Vec3f>& _right, const Mat_<float>& _blendMask, int _levels):
+    left(_left),right(_right),blendMask(_blendMask),levels(_levels)
+    {
+        assert(_left.size() == _right.size());
+        assert(_left.size() == _blendMask.size());
+        buildPyramids();
+        blendLapPyrs();
+    };
+
+    Mat_<Vec3f> blend() {
+        return reconstructImgFromLapPyramid();
+    }
+};
+
+Mat_<Vec3f> LaplacianBlend(const Mat_<Vec3f>& l, const Mat_<Vec3f>& r, const Mat_<float>& m) {
+    LaplacianBlending lb(l,r,m,4);
+    return lb.blend();
+}
+
+// Apply affine transform calculated using srcTri and dstTri to src
+void applyAffineTransform(Mat &warpImage, Mat &src, std::vector<Point2f> &srcTri, std::vector<Point2f> &dstTri)
+{
+    // Given a pair of triangles, find the affine transform.
+    Mat warpMat = getAffineTransform( srcTri, dstTri );
+
+    // Apply the Affine Transform just found to the src image
+    warpAffine( src, warpImage, warpMat, warpImage.size(), INTER_LINEAR, BORDER_REFLECT_101);
+}
+
+// Warps and alpha blends triangular regions from img1 and img2 to img
+void warpTriangle(Mat &img1, Mat &img2, std::vector<Point2f> &t1, std::vector<Point2f> &t2)
+{
+
+    cv::Rect r1 = boundingRect(t1);
+    cv::Rect r2 = boundingRect(t2);
+
+    // Offset points by left top corner of the respective rectangles
+    std::vector<Point2f> t1Rect, t2Rect;
+    std::vector<Point> t2RectInt;
+    for(int i = 0; i < 3; i++)
+    {
+
+        t1Rect.push_back( Point2f( t1[i].x - r1.x, t1[i].y -  r1.y) );
+        t2Rect.push_back( Point2f( t2[i].x - r2.x, t2[i].y - r2.y) );
+        t2RectInt.push_back( Point(t2[i].x - r2.x, t2[i].y - r2.y) ); // for fillConvexPoly
+
+    }
+
+    // Get mask by filling triangle
+    Mat mask = Mat::zeros(r2.height, r2.width, CV_32FC3);
+    fillConvexPoly(mask, t2RectInt, Scalar(1.0, 1.0, 1.0), 16, 0);
+
+    // Apply warpImage to small rectangular patches
+    Mat img1Rect;
+    img1(r1).copyTo(img1Rect);
+
+    Mat img2Rect = Mat::zeros(r2.height, r2.width, img1Rect.type());
+
+    applyAffineTransform(img2Rect, img1Rect, t1Rect, t2Rect);
+
+    if (img2.type() == CV_32FC3 && img2Rect.type() == CV_32FC3)
+    {
+        Mat dst = img2(r2);
+        auto blend = kernels().blendMasked32f;
+        for (int i = 0; i < dst.rows; i++)
+            blend(dst.ptr<float>(i), img2Rect.ptr<float>(i), mask.ptr<float>(i), dst.cols * 3);
+    }
+    else
+    {
+        multiply(img2Rect,mask, img2Rect);
+        multiply(img2(r2), Scalar(1.0,1.0,1.0) - mask, img2(r2));
+        img2(r2) = img2(r2) + img2Rect;
+    }
+
+
+}
+
+int computeTriangleTransforms(const Point2f *src, const Point2f *dst, const std::vector< std::vector<int> > &triangles, TriangleBatch &batch)
+{
+    batch.count = (int)std::min(triangles.size(), (size_t)TriangleBatch::MAX_TRIANGLES);
+
+    for (int i = 0; i < batch.count; i++)
+    {
+        const std::vector<int> &t = triangles[i];
+        for (int j = 0; j < 3; j++)
+        {
+            batch.src[2 * j][i] = src[t[j]].x;
+            batch.src[2 * j + 1][i] = src[t[j]].y;
+            batch.dst[2 * j][i] = dst[t[j]].x;
+            batch.dst[2 * j + 1][i] = dst[t[j]].y;
+        }
+    }
+
+    kernels().triangleAffine(&batch.src[0][0], &batch.dst[0][0], batch.count, &batch.boxes[0][0], &batch.affine[0][0]);
+    return batch.count;
+}
+
+void warpTriangles(Mat &img1, Mat &img2, const TriangleBatch &batch)
+{
+    // One patch and mask buffer as large as the largest destination box, every
+    // triangle works on a view of them so nothing is allocated per triangle
+    int maxWidth = 0, maxHeight = 0;
+    for (int i = 0; i < batch.count; i++)
+    {
+        maxWidth = std::max(maxWidth, batch.boxes[6][i]);
+        maxHeight = std::max(maxHeight, batch.boxes[7][i]);
+    }
+    if (maxWidth == 0 || maxHeight == 0)
+        return;
+
+    Mat patchBuffer(maxHeight, maxWidth, img1.type());
+    Mat maskBuffer(maxHeight, maxWidth, CV_32FC3);
+    auto blend = kernels().blendMasked32f;
+
+    for (int i = 0; i < batch.count; i++)
+    {
+        Rect r1 = batch.sourceBox(i);
+        Rect r2 = batch.destinationBox(i);
+
+        // Get mask by filling triangle
+        Mat mask = maskBuffer(Rect(0, 0, r2.width, r2.height));
+        mask.setTo(Scalar::all(0));
+        Point t2RectInt[3];
+        for (int j = 0; j < 3; j++)
+            t2RectInt[j] = Point(batch.dst[2 * j][i] - r2.x, batch.dst[2 * j + 1][i] - r2.y);
+        fillConvexPoly(mask, t2RectInt, 3, Scalar(1.0, 1.0, 1.0), 16, 0);
+
+        // warpAffine only reads inside the source view, borders are reflected at its edges
+        float m[6] = { batch.affine[0][i], batch.affine[1][i], batch.affine[2][i], batch.affine[3][i], batch.affine[4][i], batch.affine[5][i] };
+        Mat warpMat(2, 3, CV_32F, m);
+        Mat img2Rect = patchBuffer(Rect(0, 0, r2.width, r2.height));
+        warpAffine(img1(r1), img2Rect, warpMat, r2.size(), INTER_LINEAR, BORDER_REFLECT_101);
+
+        if (img2.type() == CV_32FC3 && img2Rect.type() == CV_32FC3)
+        {
+            Mat dst = img2(r2);
+            for (int y = 0; y < dst.rows; y++)
+                blend(dst.ptr<float>(y), img2Rect.ptr<float>(y), mask.ptr<float>(y), dst.cols * 3);
+        }
+        else
+        {
+            multiply(img2Rect, mask, img2Rect);
+            multiply(img2(r2), Scalar(1.0, 1.0, 1.0) - mask, img2(r2));
+            img2(r2) = img2(r2) + img2Rect;
+        }
+    }
+}
+
+// Calculate Delaunay triangles for set of points
+// Returns the vector of indices of 3 points for each triangle
+void calculateDelaunayTriangles(cv::Rect rect, std::vector<Point2f> &points, std::vector< std::vector<int> > &delaunayTri){
+
+	// Create an instance of Subdiv2D
+    Subdiv2D subdiv(rect);
+
+	// Insert points into subdiv
+    for( std::vector<Point2f>::iterator it = points.begin(); it != points.end(); it++)
+    	if(rect.contains(Point2f(it.base()->x, it.base()->y)))
+    	   subdiv.insert(*it);
+
+	std::vector<Vec6f> triangleList;
+	subdiv.getTriangleList(triangleList);
+	std::vector<Point2f> pt(3);
+	std::vector<int> ind(3);
+
+	for( size_t i = 0; i < triangleList.size(); i++ )
+	{
+		Vec6f t = triangleList[i];
+		pt[0] = Point2f(t[0], t[1]);
+		pt[1] = Point2f(t[2], t[3]);
+		pt[2] = Point2f(t[4], t[5]);
+
+		if ( rect.contains(pt[0]) && rect.contains(pt[1]) && rect.contains(pt[2])){
+			for(int j = 0; j < 3; j++)
+				for(size_t k = 0; k < points.size(); k++)
+         			if(abs(pt[j].x - points[k].x) < 1.0 && abs(pt[j].y - points[k].y) < 1.0)
+     					ind[j] = k;
+
+			delaunayTri.push_back(ind);
+		}
+	}
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <opencv2/core.hpp>
+
+#include <vector>
+
+#include "ImageKernels.h"
+
+// Geometry and blending helpers of the face swap in sfml.cpp, kept apart so
+// that the benchmarks can run them without a camera or a window.
+
+// A region of an output frame that differs from the captured frame, pasted over it
+struct FacePatch
+{
+    cv::Rect rect;
+    cv::Mat pixels;         // BGR, rect.size()
+    cv::Mat mask;           // CV_8UC1, rect.size(), the face hull, only its pixels are pasted
+    int track = -1;         // face the patch covers
+    int source_track = -1;  // face it shows
+};
+
+// Blends l over r with the float mask m through 4 level Laplacian pyramids
+cv::Mat_<cv::Vec3f> LaplacianBlend(const cv::Mat_<cv::Vec3f>& l, const cv::Mat_<cv::Vec3f>& r, const cv::Mat_<float>& m);
+
+// Apply affine transform calculated using srcTri and dstTri to src
+void applyAffineTransform(cv::Mat &warpImage, cv::Mat &src, std::vector<cv::Point2f> &srcTri, std::vector<cv::Point2f> &dstTri);
+
+// Warps and alpha blends triangular regions from img1 and img2 to img
+void warpTriangle(cv::Mat &img1, cv::Mat &img2, std::vector<cv::Point2f> &t1, std::vector<cv::Point2f> &t2);
+
+// Per triangle geometry of one source/destination face pair as structure of
+// arrays, filled by computeTriangleTransforms and consumed by warpTriangles.
+// Fixed size so that it lives on the stack.
+struct TriangleBatch
+{
+    static const int MAX_TRIANGLES = TRIANGLE_STRIDE;
+
+    int count = 0;
+
+    // Triangle vertices, rows x0 y0 x1 y1 x2 y2
+    float src[6][MAX_TRIANGLES];
+    float dst[6][MAX_TRIANGLES];
+
+    // Rows x y width height of the source boxes, then of the destination boxes
+    int boxes[8][MAX_TRIANGLES];
+
+    // Source box to destination box transforms, rows a00 a01 a02 a10 a11 a12
+    float affine[6][MAX_TRIANGLES];
+
+    cv::Rect sourceBox(int i) const { return cv::Rect(boxes[0][i], boxes[1][i], boxes[2][i], boxes[3][i]); }
+    cv::Rect destinationBox(int i) const { return cv::Rect(boxes[4][i], boxes[5][i], boxes[6][i], boxes[7][i]); }
+};
+
+// Gathers the triangles of a face pair from their landmarks and computes all
+// bounding boxes and affine transforms in one vectorized pass, without heap
+// allocation. Triangles past MAX_TRIANGLES are left out. Returns batch.count.
+int computeTriangleTransforms(const cv::Point2f *src, const cv::Point2f *dst, const std::vector< std::vector<int> > &triangles, TriangleBatch &batch);
+
+// Warps and alpha blends every triangle of batch from img1 to img2, like
+// warpTriangle does for one triangle, reusing one patch and mask buffer
+void warpTriangles(cv::Mat &img1, cv::Mat &img2, const TriangleBatch &batch);
+
+// Calculate Delaunay triangles for set of points
+// Returns the vector of indices of 3 points for each triangle
+void calculateDelaunayTriangles(cv::Rect rect, std::vector<cv::Point2f> &points, std::vector< std::vector<int> > &delaunayTri);
@@ -0,0 +1,168 @@
+#include "FramePool.h"
+#include "MatTrace.h"
+
+#include <algorithm>
+#include <fstream>
+#include <string>
+
+FramePool framePool;
+
+FramePool::FramePool(size_t budget_bytes)
+{
+    counters.budget = budget_bytes;
+}
+
+FramePool::~FramePool()
+{
+    for (auto &bucket : free_buffers)
+        for (void *buffer : bucket.second)
+            cv::fastFree(buffer);
+}
+
+void FramePool::setBudget(size_t budget_bytes)
+{
+    std::unique_lock<std::mutex> l(mutex);
+    counters.budget = budget_bytes;
+}
+
+FramePool::Stats FramePool::stats() const
+{
+    std::unique_lock<std::mutex> l(mutex);
+    return counters;
+}
+
+static size_t readStatus(const std::string &key)
+{
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line))
+        if (line.compare(0, key.size(), key) == 0)
+            return std::stoul(line.substr(key.size())) * 1024;
+    return 0;
+}
+
+size_t FramePool::currentRss()
+{
+    return readStatus("VmRSS:");
+}
+
+size_t FramePool::peakRss()
+{
+    return readStatus("VmHWM:");
+}
+
+void FramePool::trim(size_t needed) const
+{
+    // Drop cached buffers until needed more bytes fit in the budget
+    for (auto &bucket : free_buffers)
+    {
+        while (!bucket.second.empty() && counters.in_use + counters.cached + needed > counters.budget)
+        {
+            cv::fastFree(bucket.second.back());
+            bucket.second.pop_back();
+            counters.cached -= bucket.first;
+        }
+    }
+}
+
+void *FramePool::take(size_t size) const
+{
+    std::unique_lock<std::mutex> l(mutex);
+
+    auto bucket = free_buffers.find(size);
+    if (bucket != free_buffers.end() && !bucket->second.empty())
+    {
+        void *buffer = bucket->second.back();
+        bucket->second.pop_back();
+        counters.cached -= size;
+        counters.in_use += size;
+        counters.hits++;
+        counters.peak_in_use = std::max(counters.peak_in_use, counters.in_use);
+        return buffer;
+    }
+
+    if (counters.budget)
+    {
+        if (counters.in_use + counters.cached + size > counters.budget)
+            trim(size);
+        if (counters.in_use + size > counters.budget)
+        {
+            counters.rejected++;
+            CV_Error(cv::Error::StsNoMem, "frame memory budget exceeded");
+        }
+    }
+
+    counters.misses++;
+    counters.in_use += size;
+    counters.peak_in_use = std::max(counters.peak_in_use, counters.in_use);
+    l.unlock();
+
+    return cv::fastMalloc(size);
+}
+
+void FramePool::give(void *buffer, size_t size) const
+{
+    std::unique_lock<std::mutex> l(mutex);
+    counters.in_use -= size;
+
+    if (counters.budget && counters.in_use + counters.cached + size > counters.budget)
+    {
+        l.unlock();
+        cv::fastFree(buffer);
+        return;
+    }
+
+    free_buffers[size].push_back(buffer);
+    counters.cached += size;
+}
+
+cv::UMatData *FramePool::allocate(int dims, const int *sizes, int type, void *data0, size_t *step, int flags, cv::UMatUsageFlags usageFlags) const
+{
+    // Same layout rules as OpenCV's standard allocator
+    size_t total = CV_ELEM_SIZE(type);
+    for (int i = dims - 1; i >= 0; i--)
+    {
+        if (step)
+        {
+            if (data0 && step[i] != CV_AUTOSTEP)
+            {
+                CV_Assert(total <= step[i]);
+                total = step[i];
+            }
+            else
+                step[i] = total;
+        }
+        total *= sizes[i];
+    }
+
+    uchar *data = data0 ? (uchar *)data0 : (uchar *)take(total);
+    if (!data0)
+        matTrace.allocated(total);
+    cv::UMatData *u = new cv::UMatData(this);
+    u->data = u->origdata = data;
+    u->size = total;
+    if (data0)
+        u->flags |= cv::UMatData::USER_ALLOCATED;
+
+    return u;
+}
+
+bool FramePool::allocate(cv::UMatData *u, int accessflags, cv::UMatUsageFlags usageFlags) const
+{
+    return u != 0;
+}
+
+void FramePool::deallocate(cv::UMatData *u) const
+{
+    if (!u)
+        return;
+
+    CV_Assert(u->urefcount == 0);
+    CV_Assert(u->refcount == 0);
+    if (!(u->flags & cv::UMatData::USER_ALLOCATED))
+    {
+        give(u->origdata, u->size);
+        u->origdata = 0;
+    }
+    delete u;
+}
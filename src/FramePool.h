@@ -0,0 +1,56 @@
+#pragma once
+
+#include <opencv2/core.hpp>
+
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+// cv::MatAllocator that keeps released image buffers and hands them out again
+// for the next Mat of the same byte size. Frames in the pipeline all have a
+// handful of fixed sizes, so after the first frames nearly every allocation
+// is a hit and the heap stops fragmenting.
+//
+// The pool enforces a memory budget over the buffers it manages: cached
+// buffers are freed first, and an allocation that still does not fit throws
+// a cv::Exception so the frame is dropped instead of the board swapping.
+class FramePool : public cv::MatAllocator
+{
+public:
+    struct Stats
+    {
+        unsigned long hits = 0, misses = 0, rejected = 0;
+        size_t in_use = 0, cached = 0, peak_in_use = 0, budget = 0;
+    };
+
+    // budget_bytes == 0 means no limit
+    explicit FramePool(size_t budget_bytes = 0);
+    ~FramePool();
+
+    // Makes m take its next buffer from the pool; Mats assigned from m share the pool
+    void attach(cv::Mat &m) const { m.allocator = const_cast<FramePool *>(this); }
+
+    void setBudget(size_t budget_bytes);
+
+    Stats stats() const;
+
+    // Current and peak resident set size of the process in bytes
+    static size_t currentRss();
+    static size_t peakRss();
+
+    cv::UMatData *allocate(int dims, const int *sizes, int type, void *data, size_t *step, int flags, cv::UMatUsageFlags usageFlags) const override;
+    bool allocate(cv::UMatData *data, int accessflags, cv::UMatUsageFlags usageFlags) const override;
+    void deallocate(cv::UMatData *data) const override;
+
+private:
+    void *take(size_t size) const;
+    void give(void *buffer, size_t size) const;
+    void trim(size_t needed) const;
+
+    mutable std::mutex mutex;
+    mutable std::unordered_map<size_t, std::vector<void *>> free_buffers;
+    mutable Stats counters;
+};
+
+// Pool shared by the capture and model threads
+extern FramePool framePool;
@@ -0,0 +1,337 @@
+#include "FrameProtocol.h"
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+
+static void put32(std::vector<uint8_t> &out, uint32_t v)
+{
+    for (int i = 0; i < 4; i++)
+        out.push_back((uint8_t)(v >> (8 * i)));
+}
+
+static void put64(std::vector<uint8_t> &out, uint64_t v)
+{
+    for (int i = 0; i < 8; i++)
+        out.push_back((uint8_t)(v >> (8 * i)));
+}
+
+static void putRect(std::vector<uint8_t> &out, const cv::Rect &r)
+{
+    put32(out, (uint32_t)r.x);
+    put32(out, (uint32_t)r.y);
+    put32(out, (uint32_t)r.width);
+    put32(out, (uint32_t)r.height);
+}
+
+static void putPixels(std::vector<uint8_t> &out, const cv::Mat &pixels)
+{
+    size_t row = pixels.cols * pixels.elemSize();
+    for (int y = 0; y < pixels.rows; y++)
+        out.insert(out.end(), pixels.ptr<uint8_t>(y), pixels.ptr<uint8_t>(y) + row);
+}
+
+// Reads fields from a payload, every read fails once one ran past the end
+class PayloadReader
+{
+public:
+    explicit PayloadReader(const std::vector<uint8_t> &payload) : p(payload.data()), end(payload.data() + payload.size()) {}
+
+    bool ok() const { return good; }
+
+    // Bytes not read yet
+    size_t left() const { return end - p; }
+
+    uint32_t u32()
+    {
+        if (!need(4))
+            return 0;
+        uint32_t v = 0;
+        for (int i = 0; i < 4; i++)
+            v |= (uint32_t)*p++ << (8 * i);
+        return v;
+    }
+
+    int32_t i32() { return (int32_t)u32(); }
+
+    uint8_t u8() { return need(1) ? *p++ : 0; }
+
+    cv::Rect rect()
+    {
+        cv::Rect r;
+        r.x = i32();
+        r.y = i32();
+        r.width = i32();
+        r.height = i32();
+        return r;
+    }
+
+    // 8 bit pixels of size with channels, copied out of the payload. The size
+    // comes from the peer, the product is taken in 64 bits so it cannot wrap.
+    bool pixels(cv::Size size, int channels, cv::Mat &out)
+    {
+        if (size.width <= 0 || size.height <= 0 || (uint64_t)size.width * size.height * channels > left())
+        {
+            good = false;
+            return false;
+        }
+        out.create(size, CV_8UC(channels));
+        size_t row = (size_t)size.width * channels;
+        for (int y = 0; y < size.height; y++, p += row)
+            std::memcpy(out.ptr<uint8_t>(y), p, row);
+        return true;
+    }
+
+private:
+    bool need(size_t bytes)
+    {
+        if (!good || (size_t)(end - p) < bytes)
+            good = false;
+        return good;
+    }
+
+    const uint8_t *p, *end;
+    bool good = true;
+};
+
+// Smallest encoding of one face of a job and of one patch of a result, a
+// count that would need more than the payload holds is refused before
+// anything is allocated for it
+static const size_t JOB_FACE_BYTES = 16 + 4 + 1;
+static const size_t RESULT_PATCH_BYTES = 16 + 4 + 4;
+
+void encodeJob(const FrameJob &job, std::vector<uint8_t> &out)
+{
+    out.reserve(out.size() + 20 + job.faces.size() * 21 + job.pixels.total() * 3);
+    putRect(out, job.crop);
+    put32(out, (uint32_t)job.faces.size());
+    for (size_t i = 0; i < job.faces.size(); i++)
+    {
+        putRect(out, job.faces[i]);
+        put32(out, (uint32_t)job.tracks[i]);
+        out.push_back(job.refresh[i]);
+    }
+    putPixels(out, job.pixels);
+}
+
+bool decodeJob(const std::vector<uint8_t> &payload, FrameJob &job)
+{
+    PayloadReader in(payload);
+    job.crop = in.rect();
+    uint32_t count = in.u32();
+    if (!in.ok() || count > in.left() / JOB_FACE_BYTES)
+        return false;
+
+    job.faces.resize(count);
+    job.tracks.resize(count);
+    job.refresh.resize(count);
+    for (uint32_t i = 0; i < count; i++)
+    {
+        job.faces[i] = in.rect();
+        job.tracks[i] = in.i32();
+        job.refresh[i] = in.u8();
+    }
+    return in.pixels(job.crop.size(), 3, job.pixels) && in.ok();
+}
+
+void encodeResult(const FrameResult &result, std::vector<uint8_t> &out)
+{
+    put32(out, result.status);
+    put32(out, (uint32_t)(result.seconds * 1e6));
+    put32(out, (uint32_t)result.patches.size());
+    for (const FacePatch &patch : result.patches)
+    {
+        putRect(out, patch.rect);
+        put32(out, (uint32_t)patch.track);
+        put32(out, (uint32_t)patch.source_track);
+        putPixels(out, patch.pixels);
+        putPixels(out, patch.mask);
+    }
+}
+
+bool decodeResult(const std::vector<uint8_t> &payload, FrameResult &result)
+{
+    PayloadReader in(payload);
+    result.status = in.u32();
+    result.seconds = in.u32() * 1e-6;
+    uint32_t count = in.u32();
+    if (!in.ok() || count > in.left() / RESULT_PATCH_BYTES)
+        return false;
+
+    result.patches.resize(count);
+    for (FacePatch &patch : result.patches)
+    {
+        patch.rect = in.rect();
+        patch.track = in.i32();
+        patch.source_track = in.i32();
+        if (!in.pixels(patch.rect.size(), 3, patch.pixels) || !in.pixels(patch.rect.size(), 1, patch.mask))
+            return false;
+    }
+    return in.ok();
+}
+
+static bool sendAll(int socket, const void *data, size_t size)
+{
+    const char *p = static_cast<const char *>(data);
+    while (size > 0)
+    {
+        ssize_t sent = ::send(socket, p, size, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR)
+            continue;
+        if (sent <= 0)
+            return false;
+        p += sent;
+        size -= sent;
+    }
+    return true;
+}
+
+static bool receiveAll(int socket, void *data, size_t size)
+{
+    char *p = static_cast<char *>(data);
+    while (size > 0)
+    {
+        ssize_t got = ::recv(socket, p, size, 0);
+        if (got < 0 && errno == EINTR)
+            continue;
+        if (got <= 0)
+            return false;
+        p += got;
+        size -= got;
+    }
+    return true;
+}
+
+bool sendMessage(int socket, FrameMessageType type, uint64_t seq, uint32_t camera, const std::vector<uint8_t> &payload)
+{
+    std::vector<uint8_t> header;
+    header.reserve(FRAME_HEADER_SIZE);
+    put32(header, FRAME_PROTOCOL_MAGIC);
+    put32(header, FRAME_PROTOCOL_VERSION | ((uint32_t)type << 16));
+    put64(header, seq);
+    put32(header, camera);
+    put32(header, (uint32_t)payload.size());
+    return sendAll(socket, header.data(), header.size()) && sendAll(socket, payload.data(), payload.size());
+}
+
+bool receiveMessage(int socket, FrameMessageType &type, uint64_t &seq, uint32_t &camera, std::vector<uint8_t> &payload)
+{
+    std::vector<uint8_t> header(FRAME_HEADER_SIZE);
+    if (!receiveAll(socket, header.data(), header.size()))
+        return false;
+
+    PayloadReader in(header);
+    uint32_t magic = in.u32();
+    uint32_t versionAndType = in.u32();
+    uint32_t seqLow = in.u32(), seqHigh = in.u32();
+    camera = in.u32();
+    uint32_t size = in.u32();
+    if (magic != FRAME_PROTOCOL_MAGIC || (versionAndType & 0xffff) != FRAME_PROTOCOL_VERSION || size > FRAME_PAYLOAD_LIMIT)
+    {
+        std::cerr << "Frame protocol: bad header, dropping the connection" << std::endl;
+        return false;
+    }
+    type = (FrameMessageType)(versionAndType >> 16);
+    seq = seqLow | ((uint64_t)seqHigh << 32);
+
+    payload.resize(size);
+    return receiveAll(socket, payload.data(), size);
+}
+
+// Splits unix:/path or tcp:host:port
+static bool parseEndpoint(const std::string &endpoint, bool &local, std::string &host, std::string &port)
+{
+    if (endpoint.compare(0, 5, "unix:") == 0)
+    {
+        local = true;
+        host = endpoint.substr(5);
+        return !host.empty() && host.size() < sizeof(sockaddr_un().sun_path);
+    }
+
+    std::string rest = endpoint.compare(0, 4, "tcp:") == 0 ? endpoint.substr(4) : endpoint;
+    size_t colon = rest.rfind(':');
+    if (colon == std::string::npos)
+        return false;
+    local = false;
+    host = rest.substr(0, colon);
+    port = rest.substr(colon + 1);
+    return !port.empty();
+}
+
+static int openEndpoint(const std::string &endpoint, bool listening)
+{
+    bool local;
+    std::string host, port;
+    if (!parseEndpoint(endpoint, local, host, port))
+    {
+        std::cerr << "Bad endpoint " << endpoint << ", use unix:/path or tcp:host:port" << std::endl;
+        return -1;
+    }
+
+    int s = -1;
+    if (local)
+    {
+        sockaddr_un addr;
+        std::memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        std::strncpy(addr.sun_path, host.c_str(), sizeof(addr.sun_path) - 1);
+
+        s = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if (s >= 0 && listening)
+            ::unlink(host.c_str());
+        if (s >= 0 && (listening ? ::bind(s, (sockaddr *)&addr, sizeof(addr)) == 0 && ::listen(s, 8) == 0
+                                 : ::connect(s, (sockaddr *)&addr, sizeof(addr)) == 0))
+            return s;
+    }
+    else
+    {
+        addrinfo hints, *found = nullptr;
+        std::memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_flags = listening ? AI_PASSIVE : 0;
+        if (::getaddrinfo(host.empty() ? nullptr : host.c_str(), port.c_str(), &hints, &found) == 0)
+        {
+            for (addrinfo *a = found; a; a = a->ai_next)
+            {
+                s = ::socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+                if (s < 0)
+                    continue;
+                int on = 1;
+                ::setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+                // Jobs and results are written in one go, waiting for more only adds latency
+                ::setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+                if (listening ? ::bind(s, a->ai_addr, a->ai_addrlen) == 0 && ::listen(s, 8) == 0
+                              : ::connect(s, a->ai_addr, a->ai_addrlen) == 0)
+                    break;
+                ::close(s);
+                s = -1;
+            }
+            ::freeaddrinfo(found);
+        }
+        if (s >= 0)
+            return s;
+    }
+
+    std::cerr << "Unable to " << (listening ? "listen on " : "connect to ") << endpoint << ": " << std::strerror(errno) << std::endl;
+    if (s >= 0)
+        ::close(s);
+    return -1;
+}
+
+int connectEndpoint(const std::string &endpoint)
+{
+    return openEndpoint(endpoint, false);
+}
+
+int listenEndpoint(const std::string &endpoint)
+{
+    return openEndpoint(endpoint, true);
+}
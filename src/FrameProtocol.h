@@ -0,0 +1,80 @@
+#pragma once
+
+#include <opencv2/core.hpp>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "FaceWarp.h"
+
+// Binary framing between the capture host and face_worker processes over Unix
+// or TCP stream sockets. Every message is a fixed 24 byte header followed by
+// its payload, all fields little endian:
+//
+//   uint32 magic "FSWP", uint16 version, uint16 type,
+//   uint64 sequence, uint32 camera, uint32 payload size
+//
+// A job carries the pixels around the faces of one frame, never the whole
+// frame unless the faces cover it:
+//
+//   int32 x, y, width, height of the crop in the frame, uint32 face count,
+//   per face int32 x, y, width, height (frame coordinates), int32 track,
+//   uint8 refresh, then the crop as BGR rows without padding
+//
+// A result carries the patches of the refreshed faces:
+//
+//   uint32 status (0 ok), uint32 processing microseconds, uint32 patch count,
+//   per patch int32 x, y, width, height (frame coordinates), int32 track,
+//   int32 source track, then its BGR rows without padding and the rows of
+//   its hull mask, one byte per pixel
+//
+// Endpoints are written unix:/path/to/socket or tcp:host:port.
+
+static const uint32_t FRAME_PROTOCOL_MAGIC = 0x50575346;   // "FSWP"
+static const uint16_t FRAME_PROTOCOL_VERSION = 2;
+static const size_t FRAME_HEADER_SIZE = 24;
+
+// Frames larger than this are refused, a corrupt header must not allocate gigabytes
+static const uint32_t FRAME_PAYLOAD_LIMIT = 64 << 20;
+
+enum FrameMessageType : uint16_t
+{
+    FRAME_JOB = 1,
+    FRAME_RESULT = 2
+};
+
+// The faces of a frame to swap, face k shows face k - 1
+struct FrameJob
+{
+    uint64_t seq = 0;
+    uint32_t camera = 0;
+    cv::Rect crop;              // where pixels are in the frame
+    cv::Mat pixels;             // BGR
+    std::vector<cv::Rect> faces;
+    std::vector<int> tracks;
+    std::vector<uint8_t> refresh;   // 1 for the faces that want a patch
+};
+
+struct FrameResult
+{
+    uint64_t seq = 0;
+    uint32_t camera = 0;
+    uint32_t status = 0;
+    double seconds = 0;         // processing time on the worker
+    std::vector<FacePatch> patches;
+};
+
+// Message bodies, encode appends to out
+void encodeJob(const FrameJob &job, std::vector<uint8_t> &out);
+bool decodeJob(const std::vector<uint8_t> &payload, FrameJob &job);
+void encodeResult(const FrameResult &result, std::vector<uint8_t> &out);
+bool decodeResult(const std::vector<uint8_t> &payload, FrameResult &result);
+
+// Whole messages on a blocking socket, false when the peer is gone or sent garbage
+bool sendMessage(int socket, FrameMessageType type, uint64_t seq, uint32_t camera, const std::vector<uint8_t> &payload);
+bool receiveMessage(int socket, FrameMessageType &type, uint64_t &seq, uint32_t &camera, std::vector<uint8_t> &payload);
+
+// Sockets for an endpoint, -1 with the reason on stderr when it fails
+int connectEndpoint(const std::string &endpoint);
+int listenEndpoint(const std::string &endpoint);
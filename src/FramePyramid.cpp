@@ -0,0 +1,82 @@
+#include "FramePyramid.h"
+#include "FramePool.h"
+
+#include <opencv2/imgproc.hpp>
+
+#include <cmath>
+
+FramePyramid::FramePyramid(const cv::Mat &frame) : full(frame.size())
+{
+    bgr_levels[0] = frame;
+}
+
+FramePyramid::FramePyramid(std::shared_ptr<const JpegFrame> jpeg) : jpeg(std::move(jpeg)), full(this->jpeg->size())
+{
+}
+
+const cv::Mat &FramePyramid::bgr(int level)
+{
+    CV_Assert(level >= 0 && level < MAX_LEVELS);
+
+    if (bgr_levels[level].empty())
+    {
+        if (level == 0 && jpeg)
+        {
+            framePool.attach(bgr_levels[0]);
+            jpeg->decodeBgr(bgr_levels[0]);
+            return bgr_levels[0];
+        }
+        const cv::Mat &larger = bgr(level - 1);
+        framePool.attach(bgr_levels[level]);
+        cv::pyrDown(larger, bgr_levels[level]);
+    }
+    return bgr_levels[level];
+}
+
+const cv::Mat &FramePyramid::gray(int level)
+{
+    CV_Assert(level >= 0 && level < MAX_LEVELS);
+
+    if (gray_levels[level].empty())
+    {
+        framePool.attach(gray_levels[level]);
+
+        // Shrinking one channel is cheaper than shrinking three, so gray levels
+        // come from the gray level above unless the BGR level is already there.
+        // A compressed frame has them decoded at their own scale instead.
+        gray_offsets[level] = 0;
+        if (!bgr_levels[level].empty())
+            cv::cvtColor(bgr_levels[level], gray_levels[level], cv::COLOR_BGR2GRAY);
+        else if (jpeg && level <= JpegFrame::MAX_SCALED_LEVEL)
+        {
+            jpeg->decodeGray(level, gray_levels[level]);
+            gray_offsets[level] = ((1 << level) - 1) / 2.0;
+        }
+        else if (level == 0)
+            cv::cvtColor(bgr(0), gray_levels[0], cv::COLOR_BGR2GRAY);
+        else
+        {
+            cv::pyrDown(gray(level - 1), gray_levels[level]);
+            gray_offsets[level] = gray_offsets[level - 1];
+        }
+    }
+    return gray_levels[level];
+}
+
+const cv::Mat &FramePyramid::thumbnail(cv::Size size)
+{
+    if (thumb.size() != size)
+    {
+        int level = 0;
+        while (level + 1 < MAX_LEVELS && (full.width >> (level + 1)) >= size.width && (full.height >> (level + 1)) >= size.height)
+            level++;
+        cv::resize(gray(level), thumb, size, 0, 0, cv::INTER_AREA);
+    }
+    return thumb;
+}
+
+int FramePyramid::levelFor(double downsample)
+{
+    int level = (int)std::lround(std::log2(downsample > 1 ? downsample : 1));
+    return level < MAX_LEVELS ? level : MAX_LEVELS - 1;
+}
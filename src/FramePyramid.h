@@ -0,0 +1,54 @@
+#pragma once
+
+#include <opencv2/core.hpp>
+
+#include <memory>
+
+#include "JpegFrame.h"
+
+// Lazily built image pyramid of one captured frame, shared read-only by every
+// consumer of the frame: detector, landmark predictor, motion gate and colour
+// statistics. Level n is the frame scaled down by 2^n; each level is computed
+// at most once, in BGR and in grayscale, and only when someone asks for it.
+//
+// A pyramid over a compressed frame decodes level 0 only when it is asked
+// for, and its gray levels down to 1/8 straight from the JPEG at that scale.
+//
+// A pyramid belongs to one frame in flight and is not thread-safe.
+class FramePyramid
+{
+public:
+    static const int MAX_LEVELS = 6;
+
+    // frame is level 0 and is used without a copy
+    explicit FramePyramid(const cv::Mat &frame);
+    explicit FramePyramid(std::shared_ptr<const JpegFrame> jpeg);
+
+    // Size of level 0, known without decoding it
+    cv::Size size() const { return full; }
+
+    const cv::Mat &bgr(int level);
+    const cv::Mat &gray(int level);
+
+    // Gray image of exactly size, scaled from the smallest level that is still larger
+    const cv::Mat &thumbnail(cv::Size size);
+
+    // Level whose scale is closest to 1 / downsample
+    static int levelFor(double downsample);
+
+    // Factor between level and the full frame
+    static double scale(int level) { return double(1 << level); }
+
+    // Full resolution coordinate of the centre of pixel 0 of a gray level that
+    // was built. Shrinking with pyrDown keeps pixel p of level n centred on p * 2^n,
+    // decoding at 1/s averages s pixels, which puts it on p * s + (s - 1) / 2.
+    double grayOffset(int level) const { return gray_offsets[level]; }
+
+private:
+    std::shared_ptr<const JpegFrame> jpeg;
+    cv::Size full;
+    cv::Mat bgr_levels[MAX_LEVELS];
+    cv::Mat gray_levels[MAX_LEVELS];
+    double gray_offsets[MAX_LEVELS] = {};
+    cv::Mat thumb;
+};
@@ -0,0 +1,178 @@
+#include "FrameScheduler.h"
+
+#include <algorithm>
+
+using std::chrono::duration;
+using std::chrono::duration_cast;
+
+// Part of the worker capacity handed out, the rest is left for capture, rendering and sinks
+static const double LOAD_LIMIT = 0.9;
+
+FrameScheduler::FrameScheduler(const std::vector<Camera *> &cameras, unsigned int workers, unsigned int frames_in_flight) :
+    cameras(cameras), framesInFlight(std::max(1u, frames_in_flight))
+{
+    unsigned int cores = std::thread::hardware_concurrency();
+    workerCapacity = std::max(1u, (cores && cores < workers) ? cores : workers);
+}
+
+void FrameScheduler::frameCaptured(Camera &camera)
+{
+    {
+        std::unique_lock<std::mutex> l(mutex);
+        Camera::clock::time_point now = Camera::clock::now();
+        if (camera.lastCaptured != Camera::clock::time_point())
+        {
+            double interval = duration<double>(now - camera.lastCaptured).count();
+            camera.captureInterval = camera.captureInterval > 0 ? 0.9 * camera.captureInterval + 0.1 * interval : interval;
+        }
+        camera.lastCaptured = now;
+    }
+    frameReady.notify_one();
+}
+
+Camera *FrameScheduler::pickReady(Camera::clock::time_point now, Camera::clock::time_point &wakeup)
+{
+    Camera *best = nullptr;
+    wakeup = Camera::clock::time_point::max();
+
+    for (Camera *camera : cameras)
+    {
+        if (camera->inFlight >= framesInFlight)
+            continue;
+
+        unsigned long seq;
+        {
+            std::unique_lock<std::mutex> l(camera->mutex);
+            seq = camera->frameSeq;
+        }
+        if (seq == camera->scheduledSeq)
+            continue;
+
+        if (now < camera->nextDue)
+        {
+            wakeup = std::min(wakeup, camera->nextDue);
+            continue;
+        }
+
+        // Least recently served camera first
+        if (!best || camera->lastScheduled < best->lastScheduled)
+            best = camera;
+    }
+
+    return best;
+}
+
+bool FrameScheduler::next(Camera *&camera, cv::Mat &frame, std::shared_ptr<const JpegFrame> &jpeg, unsigned long &seq, Camera::clock::time_point &captureTime)
+{
+    std::unique_lock<std::mutex> l(mutex);
+
+    while (!stopping)
+    {
+        Camera::clock::time_point now = Camera::clock::now(), wakeup;
+        Camera *ready = pickReady(now, wakeup);
+
+        if (ready)
+        {
+            {
+                std::unique_lock<std::mutex> cl(ready->mutex);
+                frame = ready->frameBGR;
+                jpeg = ready->frameJpeg;
+                seq = ready->frameSeq;
+                captureTime = ready->frameTime;
+            }
+
+            // Frames replaced before a worker got to them
+            if (seq > ready->scheduledSeq + 1)
+                ready->skipped += seq - ready->scheduledSeq - 1;
+
+            ready->scheduledSeq = seq;
+            ready->inFlight++;
+            if (ready->reorder)
+                ready->reorder->scheduled(seq);
+            ready->lastScheduled = now;
+            ready->nextDue = now;
+            if (ready->targetFps > 0)
+                ready->nextDue += duration_cast<Camera::clock::duration>(duration<double>(1.0 / ready->targetFps));
+
+            camera = ready;
+            return true;
+        }
+
+        if (wakeup == Camera::clock::time_point::max())
+            frameReady.wait(l);
+        else
+            frameReady.wait_until(l, wakeup);
+    }
+
+    return false;
+}
+
+void FrameScheduler::finished(Camera &camera, double seconds)
+{
+    {
+        std::unique_lock<std::mutex> l(mutex);
+        camera.inFlight--;
+        camera.cost = camera.cost > 0 ? 0.9 * camera.cost + 0.1 * seconds : seconds;
+        rebalance();
+    }
+    frameReady.notify_all();
+}
+
+void FrameScheduler::stop()
+{
+    {
+        std::unique_lock<std::mutex> l(mutex);
+        stopping = true;
+    }
+    frameReady.notify_all();
+}
+
+void FrameScheduler::rebalance()
+{
+    // CPU seconds per second every camera would need at its capture rate
+    std::vector<double> demand(cameras.size(), 0);
+    double total = 0;
+    for (size_t i = 0; i < cameras.size(); i++)
+    {
+        if (cameras[i]->captureInterval > 0)
+            demand[i] = cameras[i]->cost / cameras[i]->captureInterval;
+        total += demand[i];
+    }
+
+    double budget = LOAD_LIMIT * workerCapacity;
+    if (total <= budget)
+    {
+        for (Camera *camera : cameras)
+            camera->targetFps = 0;
+        return;
+    }
+
+    // Water filling: cameras that need less than an equal share keep their
+    // rate, what they leave over is split between the others.
+    std::vector<double> share(cameras.size(), -1);
+    size_t open = cameras.size();
+    bool changed = true;
+    while (changed && open > 0)
+    {
+        changed = false;
+        double fair = budget / open;
+        for (size_t i = 0; i < cameras.size(); i++)
+        {
+            if (share[i] < 0 && demand[i] <= fair)
+            {
+                share[i] = demand[i];
+                budget -= demand[i];
+                open--;
+                changed = true;
+            }
+        }
+    }
+
+    for (size_t i = 0; i < cameras.size(); i++)
+    {
+        if (share[i] >= 0 || cameras[i]->cost <= 0)
+            cameras[i]->targetFps = 0;
+        else
+            cameras[i]->targetFps = (budget / open) / cameras[i]->cost;
+    }
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+
+#include "Camera.h"
+
+// Hands the latest frame of every camera to a shared pool of model workers.
+// A camera has at most frames_in_flight frames in flight, each with its own
+// worker, and newer frames replace older ones that were not picked up yet.
+// With more than one in flight the camera's ReorderBuffer puts them back in
+// order. Ready cameras are served in the order
+// they were last served, so every camera gets its turn. When the measured
+// processing cost of all cameras exceeds what the workers can do, each
+// camera gets a fair share of the workers and a lower processing rate to
+// match, instead of one camera starving the others.
+class FrameScheduler
+{
+public:
+    FrameScheduler(const std::vector<Camera *> &cameras, unsigned int workers, unsigned int frames_in_flight = 1);
+
+    // Called by a capture thread after it stored a new frame in the camera
+    void frameCaptured(Camera &camera);
+
+    // Blocks until a frame is due; returns false once stop() was called.
+    // Cameras capturing MJPEG hand out jpeg and leave frame empty.
+    bool next(Camera *&camera, cv::Mat &frame, std::shared_ptr<const JpegFrame> &jpeg, unsigned long &seq, Camera::clock::time_point &captureTime);
+
+    // Called by the worker when it is done with the frame from next()
+    void finished(Camera &camera, double seconds);
+
+    // Wakes up and releases all waiting workers
+    void stop();
+
+    // CPU seconds per second the workers can spend
+    double capacity() const { return workerCapacity; }
+
+private:
+    Camera *pickReady(Camera::clock::time_point now, Camera::clock::time_point &wakeup);
+    void rebalance();
+
+    std::vector<Camera *> cameras;
+    double workerCapacity;
+    unsigned int framesInFlight;
+
+    std::mutex mutex;
+    std::condition_variable frameReady;
+    bool stopping = false;
+};
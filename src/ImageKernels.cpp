@@ -0,0 +1,68 @@
+#include "ImageKernels.h"
+
+#if defined(__arm__)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+
+// From slowest to fastest, auto takes the last one the CPU supports
+static const ImageKernels *(*const VARIANTS[])() = { genericKernels, sse42Kernels, avx2Kernels, neonKernels };
+
+static const ImageKernels *&selected()
+{
+    static const ImageKernels *current = genericKernels();
+    return current;
+}
+
+static bool cpuSupports(const std::string &name)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (name == "sse42")
+        return __builtin_cpu_supports("sse4.2");
+    if (name == "avx2")
+        return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#elif defined(__arm__)
+    if (name == "neon")
+        return (getauxval(AT_HWCAP) & HWCAP_NEON) != 0;
+#elif defined(__aarch64__)
+    if (name == "neon")
+        return true;
+#endif
+    return name == "generic";
+}
+
+const ImageKernels &kernels()
+{
+    return *selected();
+}
+
+bool selectKernels(const std::string &name)
+{
+    const ImageKernels *best = nullptr;
+    for (auto variant : VARIANTS)
+    {
+        const ImageKernels *k = variant();
+        if (!k || !cpuSupports(k->name))
+            continue;
+        if (name == "auto" || name == k->name)
+            best = k;
+    }
+
+    if (!best)
+        return false;
+    selected() = best;
+    return true;
+}
+
+std::vector<std::string> availableKernels()
+{
+    std::vector<std::string> names;
+    for (auto variant : VARIANTS)
+    {
+        const ImageKernels *k = variant();
+        if (k && cpuSupports(k->name))
+            names.push_back(k->name);
+    }
+    return names;
+}
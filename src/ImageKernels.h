@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Hot per-pixel loops of the pipeline. The same source (ImageKernels.inl) is
+// compiled once per instruction set in ImageKernels_<variant>.cpp and the
+// best variant the CPU supports is picked once at startup, so one binary runs
+// on every board and still uses NEON or AVX2 where they exist.
+// Row length of the triangleAffine arrays. A fixed length lets the compiler
+// see that the rows do not overlap, 68 landmarks give at most 131 triangles.
+const size_t TRIANGLE_STRIDE = 192;
+
+struct ImageKernels
+{
+    const char *name;
+
+    // dst = (dst * (255 - mask) + src * mask) >> 8 on 3 channel pixels with a non-zero mask, one mask byte per pixel
+    void (*blendMasked8u)(uint8_t *dst, const uint8_t *src, const uint8_t *mask, size_t pixels);
+
+    // dst = dst * (1 - mask) + src * mask, one mask value per float
+    void (*blendMasked32f)(float *dst, const float *src, const float *mask, size_t values);
+
+    // Counts the 3 channel pixels with a non-zero mask into hist[channel][value]
+    void (*histogramMasked3)(const uint8_t *pixels, const uint8_t *mask, size_t count, uint32_t hist[3][256]);
+
+    // Maps the 3 channel pixels with a non-zero mask through lut
+    void (*lutMasked3)(uint8_t *pixels, const uint8_t *mask, size_t count, const uint8_t lut[3][256]);
+
+    // BGR to RGBA with an opaque alpha channel
+    void (*bgrToRgba)(const uint8_t *bgr, uint8_t *rgba, size_t pixels);
+
+    // Bounding boxes and box to box affine transforms of up to TRIANGLE_STRIDE triangle pairs, structure
+    // of arrays: src and dst hold the rows x0 y0 x1 y1 x2 y2, boxes gets the rows x y width height of
+    // the source and then of the destination (cv::boundingRect rounding), affine gets the rows
+    // a00 a01 a02 a10 a11 a12. Every row is TRIANGLE_STRIDE values long. Degenerate triangles get zeros.
+    void (*triangleAffine)(const float *src, const float *dst, size_t count, int *boxes, float *affine);
+};
+
+// The selected variant, generic until selectKernels picked another one
+const ImageKernels &kernels();
+
+// Selects the named variant, "auto" takes the best one the CPU supports.
+// False when the name is unknown or the CPU cannot run it.
+bool selectKernels(const std::string &name = "auto");
+
+// Variants built in and supported by this CPU, from slowest to fastest
+std::vector<std::string> availableKernels();
+
+// Variant tables, nullptr when the variant is not built for this architecture
+const ImageKernels *genericKernels();
+const ImageKernels *sse42Kernels();
+const ImageKernels *avx2Kernels();
+const ImageKernels *neonKernels();
@@ -0,0 +1,166 @@
+// Kernel bodies shared by every ImageKernels variant. Each ImageKernels_<variant>.cpp
+// sets the instruction set and KERNELS_NAME and includes this file once; the
+// loops are kept simple and branch free so the compiler vectorizes them for
+// that instruction set.
+
+// The kernels never look at floating point exceptions. Without this GCC keeps
+// compares and float to int conversions scalar in case they trap.
+#pragma GCC optimize("no-trapping-math")
+
+// Products are not fused into FMA even where the variant has it, so every
+// variant rounds the same way and the outputs stay bit-identical
+#pragma GCC optimize("fp-contract=off")
+
+namespace
+{
+
+void blendMasked8u(uint8_t *__restrict dst, const uint8_t *__restrict src, const uint8_t *__restrict mask, size_t pixels)
+{
+    for (size_t i = 0; i < pixels; i++)
+    {
+        unsigned int m = mask[i];
+        for (int c = 0; c < 3; c++)
+        {
+            unsigned int d = dst[3 * i + c];
+            unsigned int blended = (d * (255 - m) + src[3 * i + c] * m) >> 8; // divide by 256
+            dst[3 * i + c] = (uint8_t)(m ? blended : d);
+        }
+    }
+}
+
+void blendMasked32f(float *__restrict dst, const float *__restrict src, const float *__restrict mask, size_t values)
+{
+    for (size_t i = 0; i < values; i++)
+        dst[i] = dst[i] * (1.0f - mask[i]) + src[i] * mask[i];
+}
+
+void histogramMasked3(const uint8_t *__restrict pixels, const uint8_t *__restrict mask, size_t count, uint32_t hist[3][256])
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        if (mask[i] != 0)
+        {
+            hist[0][pixels[3 * i]]++;
+            hist[1][pixels[3 * i + 1]]++;
+            hist[2][pixels[3 * i + 2]]++;
+        }
+    }
+}
+
+void lutMasked3(uint8_t *__restrict pixels, const uint8_t *__restrict mask, size_t count, const uint8_t lut[3][256])
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        if (mask[i] != 0)
+        {
+            pixels[3 * i] = lut[0][pixels[3 * i]];
+            pixels[3 * i + 1] = lut[1][pixels[3 * i + 1]];
+            pixels[3 * i + 2] = lut[2][pixels[3 * i + 2]];
+        }
+    }
+}
+
+void bgrToRgba(const uint8_t *__restrict bgr, uint8_t *__restrict rgba, size_t pixels)
+{
+    for (size_t i = 0; i < pixels; i++)
+    {
+        rgba[4 * i] = bgr[3 * i + 2];
+        rgba[4 * i + 1] = bgr[3 * i + 1];
+        rgba[4 * i + 2] = bgr[3 * i];
+        rgba[4 * i + 3] = 255;
+    }
+}
+
+// By value, std::min returns a reference and that keeps the loop below from vectorizing
+inline float min3(float a, float b, float c)
+{
+    float m = a < b ? a : b;
+    return m < c ? m : c;
+}
+
+inline float max3(float a, float b, float c)
+{
+    float m = a > b ? a : b;
+    return m > c ? m : c;
+}
+
+// floor for pixel coordinates. floorf needs SSE4.1 or ARMv8 to vectorize, a
+// truncation that steps down for negative fractions vectorizes everywhere.
+inline float floorPixel(float v)
+{
+    float t = (float)(int)v;
+    return t > v ? t - 1.0f : t;
+}
+
+void triangleAffine(const float *__restrict src, const float *__restrict dst, size_t count, int *__restrict boxes, float *__restrict affine)
+{
+    const size_t stride = TRIANGLE_STRIDE;
+    if (count > stride)
+        count = stride;
+
+    const float *sx0 = src, *sy0 = src + stride, *sx1 = src + 2 * stride, *sy1 = src + 3 * stride, *sx2 = src + 4 * stride, *sy2 = src + 5 * stride;
+    const float *dx0 = dst, *dy0 = dst + stride, *dx1 = dst + 2 * stride, *dy1 = dst + 3 * stride, *dx2 = dst + 4 * stride, *dy2 = dst + 5 * stride;
+    int *bx1 = boxes, *by1 = boxes + stride, *bw1 = boxes + 2 * stride, *bh1 = boxes + 3 * stride;
+    int *bx2 = boxes + 4 * stride, *by2 = boxes + 5 * stride, *bw2 = boxes + 6 * stride, *bh2 = boxes + 7 * stride;
+    float *a00 = affine, *a01 = affine + stride, *a02 = affine + 2 * stride;
+    float *a10 = affine + 3 * stride, *a11 = affine + 4 * stride, *a12 = affine + 5 * stride;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        // Boxes like cv::boundingRect on float points, floor of the extremes plus one
+        float sxmin = floorPixel(min3(sx0[i], sx1[i], sx2[i]));
+        float symin = floorPixel(min3(sy0[i], sy1[i], sy2[i]));
+        float sxmax = floorPixel(max3(sx0[i], sx1[i], sx2[i]));
+        float symax = floorPixel(max3(sy0[i], sy1[i], sy2[i]));
+        float dxmin = floorPixel(min3(dx0[i], dx1[i], dx2[i]));
+        float dymin = floorPixel(min3(dy0[i], dy1[i], dy2[i]));
+        float dxmax = floorPixel(max3(dx0[i], dx1[i], dx2[i]));
+        float dymax = floorPixel(max3(dy0[i], dy1[i], dy2[i]));
+
+        bx1[i] = (int)sxmin;
+        by1[i] = (int)symin;
+        bw1[i] = (int)(sxmax - sxmin) + 1;
+        bh1[i] = (int)(symax - symin) + 1;
+        bx2[i] = (int)dxmin;
+        by2[i] = (int)dymin;
+        bw2[i] = (int)(dxmax - dxmin) + 1;
+        bh2[i] = (int)(dymax - dymin) + 1;
+
+        // Linear part maps the source edges onto the destination edges, A = V * inverse(U)
+        float ux1 = sx1[i] - sx0[i], uy1 = sy1[i] - sy0[i];
+        float ux2 = sx2[i] - sx0[i], uy2 = sy2[i] - sy0[i];
+        float vx1 = dx1[i] - dx0[i], vy1 = dy1[i] - dy0[i];
+        float vx2 = dx2[i] - dx0[i], vy2 = dy2[i] - dy0[i];
+        float det = ux1 * uy2 - ux2 * uy1;
+        float valid = det != 0.0f ? 1.0f : 0.0f;
+        float inv = valid / (det + (1.0f - valid));
+
+        float m00 = (vx1 * uy2 - vx2 * uy1) * inv;
+        float m01 = (vx2 * ux1 - vx1 * ux2) * inv;
+        float m10 = (vy1 * uy2 - vy2 * uy1) * inv;
+        float m11 = (vy2 * ux1 - vy1 * ux2) * inv;
+
+        // Translation takes the first source vertex, relative to its box, to the first destination vertex
+        float ox = sx0[i] - sxmin, oy = sy0[i] - symin;
+
+        a00[i] = m00;
+        a01[i] = m01;
+        a02[i] = (dx0[i] - dxmin - (m00 * ox + m01 * oy)) * valid;
+        a10[i] = m10;
+        a11[i] = m11;
+        a12[i] = (dy0[i] - dymin - (m10 * ox + m11 * oy)) * valid;
+    }
+}
+
+const ImageKernels table =
+{
+    KERNELS_NAME,
+    blendMasked8u,
+    blendMasked32f,
+    histogramMasked3,
+    lutMasked3,
+    bgrToRgba,
+    triangleAffine
+};
+
+}
@@ -0,0 +1,27 @@
+// AVX2 variant. The instruction set is set by the pragma, so this file needs
+// no flags of its own and the rest of the program stays on the baseline.
+#include "ImageKernels.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#pragma GCC push_options
+#pragma GCC target("avx2,fma")
+
+#define KERNELS_NAME "avx2"
+#include "ImageKernels.inl"
+
+#pragma GCC pop_options
+
+const ImageKernels *avx2Kernels()
+{
+    return &table;
+}
+
+#else
+
+const ImageKernels *avx2Kernels()
+{
+    return nullptr;
+}
+
+#endif
@@ -0,0 +1,10 @@
+// Baseline variant, built with the flags of the configuration and runs everywhere
+#include "ImageKernels.h"
+
+#define KERNELS_NAME "generic"
+#include "ImageKernels.inl"
+
+const ImageKernels *genericKernels()
+{
+    return &table;
+}
@@ -0,0 +1,30 @@
+// NEON variant. armhf builds only assume VFP, NEON is enabled for this file by
+// the pragma (GCC 7 and later); older toolchains need -mfpu=neon on this file.
+// On AArch64 Advanced SIMD is always there.
+#include "ImageKernels.h"
+
+#if defined(__arm__) || defined(__aarch64__)
+
+#pragma GCC push_options
+#if defined(__arm__) && !defined(__ARM_NEON) && !defined(__ARM_NEON__) && __GNUC__ >= 7
+#pragma GCC target("fpu=neon")
+#endif
+
+#define KERNELS_NAME "neon"
+#include "ImageKernels.inl"
+
+#pragma GCC pop_options
+
+const ImageKernels *neonKernels()
+{
+    return &table;
+}
+
+#else
+
+const ImageKernels *neonKernels()
+{
+    return nullptr;
+}
+
+#endif
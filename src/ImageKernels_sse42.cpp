@@ -0,0 +1,27 @@
+// SSE4.2 variant. The instruction set is set by the pragma, so this file needs
+// no flags of its own and the rest of the program stays on the baseline.
+#include "ImageKernels.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#pragma GCC push_options
+#pragma GCC target("sse4.2")
+
+#define KERNELS_NAME "sse42"
+#include "ImageKernels.inl"
+
+#pragma GCC pop_options
+
+const ImageKernels *sse42Kernels()
+{
+    return &table;
+}
+
+#else
+
+const ImageKernels *sse42Kernels()
+{
+    return nullptr;
+}
+
+#endif
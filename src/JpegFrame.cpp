@@ -0,0 +1,119 @@
+#include "JpegFrame.h"
+
+#include <turbojpeg.h>
+
+#include <chrono>
+#include <string>
+
+std::mutex JpegFrame::stats_mutex;
+JpegFrame::Stats JpegFrame::counters;
+
+// TurboJPEG handles must not be shared between threads
+namespace
+{
+    struct Decompressor
+    {
+        tjhandle handle = tjInitDecompress();
+        ~Decompressor() { tjDestroy(handle); }
+    };
+
+    tjhandle decompressor()
+    {
+        static thread_local Decompressor d;
+        return d.handle;
+    }
+
+    // Decoded but not yet mirrored pixels, kept per thread for the next frame
+    thread_local cv::Mat mirror_scratch[2];
+
+    // Warnings about corrupt data still leave a usable image, USB cameras produce them all the time
+    bool failed(tjhandle handle, int status)
+    {
+        if (status == 0)
+            return false;
+#ifdef TJFLAG_STOPONWARNING
+        return tjGetErrorCode(handle) == TJERR_FATAL;
+#else
+        (void)handle;
+        return true;
+#endif
+    }
+
+    // The message of the last error on handle, the global one is shared by every thread
+    std::string errorText(tjhandle handle)
+    {
+#ifdef TJFLAG_STOPONWARNING
+        return tjGetErrorStr2(handle);
+#else
+        (void)handle;
+        return tjGetErrorStr();
+#endif
+    }
+}
+
+JpegFrame::JpegFrame(std::vector<uint8_t> &&data, bool mirror) : data(std::move(data)), mirror(mirror)
+{
+    int width, height, subsampling, colorspace;
+    if (tjDecompressHeader3(decompressor(), this->data.data(), this->data.size(), &width, &height, &subsampling, &colorspace) == 0)
+        full = cv::Size(width, height);
+}
+
+cv::Size JpegFrame::size(int level) const
+{
+    tjscalingfactor factor = {1, 1 << level};
+    return cv::Size(TJSCALED(full.width, factor), TJSCALED(full.height, factor));
+}
+
+void JpegFrame::decodeBgr(cv::Mat &out) const
+{
+    decode(0, TJPF_BGR, 3, out);
+}
+
+void JpegFrame::decodeGray(int level, cv::Mat &out) const
+{
+    CV_Assert(level >= 0 && level <= MAX_SCALED_LEVEL);
+    decode(level, TJPF_GRAY, 1, out);
+}
+
+void JpegFrame::decode(int level, int format, int channels, cv::Mat &out) const
+{
+    if (full.area() == 0)
+        CV_Error(cv::Error::StsBadArg, "not a JPEG frame");
+
+    auto start = std::chrono::steady_clock::now();
+    cv::Size scaled = size(level);
+    out.create(scaled, CV_8UC(channels));
+    cv::Mat &target = mirror ? mirror_scratch[channels == 1 ? 0 : 1] : out;
+    target.create(scaled, CV_8UC(channels));
+
+    // Gray images only feed the detector and the gate, the fast IDCT is good enough for them
+    int flags = channels == 1 ? TJFLAG_FASTDCT : 0;
+    tjhandle handle = decompressor();
+    bool bad = failed(handle, tjDecompress2(handle, data.data(), data.size(), target.data,
+                                            scaled.width, (int)target.step, scaled.height, format, flags));
+    if (!bad && mirror)
+        cv::flip(target, out, 1);
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    {
+        std::unique_lock<std::mutex> l(stats_mutex);
+        if (bad)
+            counters.failed++;
+        else
+        {
+            Stats::Decodes &d = (channels == 1 ? counters.gray : counters.bgr)[level];
+            d.frames++;
+            d.seconds += seconds;
+        }
+    }
+    if (bad)
+        CV_Error(cv::Error::StsError, "JPEG decoding failed: " + errorText(handle));
+}
+
+JpegFrame::Stats JpegFrame::stats()
+{
+    std::unique_lock<std::mutex> l(stats_mutex);
+    Stats s = counters;
+    counters = Stats();
+    return s;
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <opencv2/core.hpp>
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <vector>
+
+// One compressed MJPEG frame as the camera sent it, decoded only at the
+// resolutions somebody asks for. libjpeg-turbo's scaled IDCT produces 1/2,
+// 1/4 and 1/8 images straight from the DCT coefficients, so the detector's
+// gray pyramid levels cost a fraction of a full decode, and full resolution
+// is only decoded for frames that are swapped and shown. Frames from a
+// mirrored camera come out mirrored at every scale.
+//
+// Decoding is thread-safe, each thread keeps its own decompressor.
+class JpegFrame
+{
+public:
+    // Smallest scale the IDCT produces, as a pyramid level
+    static const int MAX_SCALED_LEVEL = 3;
+
+    struct Stats
+    {
+        struct Decodes
+        {
+            unsigned long frames = 0;
+            double seconds = 0;
+        };
+        // Since the last call, keyed by pyramid level
+        std::map<int, Decodes> bgr, gray;
+        unsigned long failed = 0;
+    };
+
+    // Reads the header, size() is empty when data is not a JPEG
+    JpegFrame(std::vector<uint8_t> &&data, bool mirror);
+
+    cv::Size size() const { return full; }
+    size_t bytes() const { return data.size(); }
+
+    // Size of level as FramePyramid would make it, rounded up like pyrDown
+    cv::Size size(int level) const;
+
+    // BGR at full resolution and gray at 1 / 2^level, throw a cv::Exception when the data is corrupt
+    void decodeBgr(cv::Mat &out) const;
+    void decodeGray(int level, cv::Mat &out) const;
+
+    static Stats stats();
+
+private:
+    void decode(int level, int format, int channels, cv::Mat &out) const;
+
+    std::vector<uint8_t> data;
+    bool mirror;
+    cv::Size full;
+
+    static std::mutex stats_mutex;
+    static Stats counters;
+};
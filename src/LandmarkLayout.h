@@ -0,0 +1,90 @@
+#pragma once
+
+#include <opencv2/core.hpp>
+
+#include <dlib/image_processing.h>
+
+#include <cmath>
+
+// Compile-time descriptions of the landmark models FaceSwapper can work with.
+// A layout says how many parts its model predicts and derives from them the
+// 9 point hull (jaw from left to right, then the forehead from right to left)
+// and the 3 keypoints (chin, outer corners of the left and right eye) of the
+// affine transform.
+
+inline cv::Point2i landmarkPart(const dlib::full_object_detection &shape, unsigned long part)
+{
+    const dlib::point &p = shape.part(part);
+    return cv::Point2i((int)p.x(), (int)p.y());
+}
+
+// dlib's 68 point model (shape_predictor_68_face_landmarks.dat)
+struct Landmarks68
+{
+    static const unsigned long PARTS = 68;
+
+    static void hull(const dlib::full_object_detection &shape, cv::Point2i hull[9])
+    {
+        const unsigned long jaw[7] = { 0, 3, 5, 8, 11, 13, 16 };
+        for (int i = 0; i < 7; i++)
+            hull[i] = landmarkPart(shape, jaw[i]);
+
+        // The forehead is above the brows by the length of the nose
+        cv::Point2i nose_length = landmarkPart(shape, 27) - landmarkPart(shape, 30);
+        hull[7] = landmarkPart(shape, 26) + nose_length;
+        hull[8] = landmarkPart(shape, 17) + nose_length;
+    }
+
+    static void keypoints(const dlib::full_object_detection &shape, const cv::Point2i hull[9], cv::Point2f keypoints[3])
+    {
+        keypoints[0] = hull[3];
+        keypoints[1] = landmarkPart(shape, 36);
+        keypoints[2] = landmarkPart(shape, 45);
+    }
+};
+
+// dlib's 5 point model (shape_predictor_5_face_landmarks.dat): outer and
+// inner corner of the right eye, outer and inner corner of the left eye and
+// the bottom of the nose, which are parts 45, 42, 36, 39 and 33 of the 68
+// point model. It is about ten times smaller and faster; the jaw and forehead
+// are placed where they are on an average face, so the hull follows the eyes
+// and the nose but not the real jaw line.
+struct Landmarks5
+{
+    static const unsigned long PARTS = 5;
+
+    static void hull(const dlib::full_object_detection &shape, cv::Point2i hull[9])
+    {
+        // Hull of the average 68 point face, in units of the distance between
+        // the outer eye corners, from the middle between them. y grows towards
+        // the chin, the nose bottom sits at NOSE_Y.
+        static const float AVERAGE_HULL[9][2] = {
+            { -0.86f, 0.05f }, { -0.79f, 0.52f }, { -0.62f, 0.84f }, { 0.0f, 1.09f }, { 0.62f, 0.84f },
+            { 0.79f, 0.52f }, { 0.86f, 0.05f }, { 0.57f, -0.62f }, { -0.57f, -0.62f }
+        };
+        static const float NOSE_Y = 0.48f;
+
+        cv::Point2f left = landmarkPart(shape, 2), right = landmarkPart(shape, 0), nose = landmarkPart(shape, 4);
+        cv::Point2f centre = (left + right) * 0.5f;
+        cv::Point2f across = right - left;
+        cv::Point2f down(-across.y, across.x);
+
+        // The nose gives the vertical scale, so a face tilted up or down is not stretched
+        float eyes = std::sqrt(across.dot(across));
+        float drop = eyes > 0 ? (nose - centre).dot(down) / eyes : 0;
+        float vertical = drop > 0 ? drop / (NOSE_Y * eyes) : 1;
+
+        for (int i = 0; i < 9; i++)
+        {
+            cv::Point2f p = centre + AVERAGE_HULL[i][0] * across + AVERAGE_HULL[i][1] * vertical * down;
+            hull[i] = cv::Point2i(cvRound(p.x), cvRound(p.y));
+        }
+    }
+
+    static void keypoints(const dlib::full_object_detection &shape, const cv::Point2i hull[9], cv::Point2f keypoints[3])
+    {
+        keypoints[0] = hull[3];
+        keypoints[1] = landmarkPart(shape, 2);
+        keypoints[2] = landmarkPart(shape, 0);
+    }
+};
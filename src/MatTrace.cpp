@@ -0,0 +1,190 @@
+#include "MatTrace.h"
+
+#include <chrono>
+
+MatTrace matTrace;
+
+// Stage of the calling thread, work outside any stage is counted as "other"
+static thread_local const char *stage_name = "other";
+
+static std::chrono::steady_clock::time_point trace_start;
+
+MatTrace::Stage::Stage(const char *name) : previous(stage_name)
+{
+    stage_name = name;
+}
+
+MatTrace::Stage::~Stage()
+{
+    stage_name = previous;
+}
+
+void MatTrace::Stage::set(const char *name)
+{
+    stage_name = name;
+}
+
+bool MatTrace::enable(const std::string &trace_path)
+{
+    std::unique_lock<std::mutex> l(mutex);
+    if (!trace_path.empty())
+    {
+        trace.open(trace_path.c_str(), std::ios::out | std::ios::trunc);
+        if (!trace)
+            return false;
+        // The viewers accept an array that is never closed, so a killed process still leaves a usable file
+        trace << "[\n";
+    }
+    trace_start = std::chrono::steady_clock::now();
+    cv::Mat::setDefaultAllocator(this);
+    on.store(true);
+    return true;
+}
+
+MatTrace::Counters &MatTrace::current()
+{
+    // Per frame counters are kept next to the totals so the trace sees only the last frame
+    return frame_stages[stage_name];
+}
+
+void MatTrace::allocated(size_t bytes)
+{
+    if (!enabled())
+        return;
+    std::unique_lock<std::mutex> l(mutex);
+    Counters &c = current();
+    c.allocations++;
+    c.allocated += bytes;
+}
+
+void MatTrace::copied(size_t bytes)
+{
+    if (!enabled())
+        return;
+    std::unique_lock<std::mutex> l(mutex);
+    current().copied += bytes;
+}
+
+void MatTrace::converted(size_t bytes)
+{
+    if (!enabled())
+        return;
+    std::unique_lock<std::mutex> l(mutex);
+    current().converted += bytes;
+}
+
+void MatTrace::writeCounter(const char *name, size_t Counters::*field, double timestamp)
+{
+    trace << (first_event ? "" : ",\n") << "{\"name\": \"" << name << "\", \"ph\": \"C\", \"pid\": 1, \"ts\": " << (unsigned long)timestamp << ", \"args\": {";
+    first_event = false;
+
+    bool first = true;
+    for (const auto &stage : frame_stages)
+    {
+        trace << (first ? "" : ", ") << "\"" << stage.first << "\": " << stage.second.*field;
+        first = false;
+    }
+    trace << "}}";
+}
+
+void MatTrace::frameDone()
+{
+    if (!enabled())
+        return;
+
+    std::unique_lock<std::mutex> l(mutex);
+    frames++;
+
+    if (trace.is_open())
+    {
+        double timestamp = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - trace_start).count();
+        writeCounter("allocated bytes", &Counters::allocated, timestamp);
+        writeCounter("copied bytes", &Counters::copied, timestamp);
+        writeCounter("converted bytes", &Counters::converted, timestamp);
+        trace.flush();
+    }
+
+    for (const auto &stage : frame_stages)
+    {
+        Counters &total = stages[stage.first];
+        total.allocations += stage.second.allocations;
+        total.allocated += stage.second.allocated;
+        total.copied += stage.second.copied;
+        total.converted += stage.second.converted;
+    }
+    frame_stages.clear();
+}
+
+void MatTrace::report(std::ostream &out)
+{
+    if (!enabled())
+        return;
+
+    std::unique_lock<std::mutex> l(mutex);
+    double n = frames ? frames : 1;
+    out << "Mat traffic per frame over " << frames << " frames:";
+    for (const auto &stage : stages)
+    {
+        const Counters &c = stage.second;
+        out << " | " << stage.first << " " << c.allocations / n << " allocations " << c.allocated / n / 1048576.0 << " MB"
+            << ", copied " << c.copied / n / 1048576.0 << " MB, converted " << c.converted / n / 1048576.0 << " MB";
+    }
+    out << std::endl;
+
+    stages.clear();
+    frames = 0;
+}
+
+cv::UMatData *MatTrace::allocate(int dims, const int *sizes, int type, void *data, size_t *step, int flags, cv::UMatUsageFlags usageFlags) const
+{
+    // Buffers come from OpenCV's standard allocator, which also frees them
+    cv::UMatData *u = cv::Mat::getStdAllocator()->allocate(dims, sizes, type, data, step, flags, usageFlags);
+    if (u && !data)
+        const_cast<MatTrace *>(this)->allocated(u->size);
+    return u;
+}
+
+bool MatTrace::allocate(cv::UMatData *data, int accessflags, cv::UMatUsageFlags usageFlags) const
+{
+    return cv::Mat::getStdAllocator()->allocate(data, accessflags, usageFlags);
+}
+
+void MatTrace::deallocate(cv::UMatData *data) const
+{
+    cv::Mat::getStdAllocator()->deallocate(data);
+}
+
+// Bytes a conversion of src to rtype writes
+static size_t convertedBytes(const cv::Mat &src, int rtype)
+{
+    int type = rtype < 0 ? src.type() : CV_MAKETYPE(CV_MAT_DEPTH(rtype), src.channels());
+    return src.total() * CV_ELEM_SIZE(type);
+}
+
+// Sizes are taken first, src may be converted in place
+void tracedCopy(const cv::Mat &src, cv::OutputArray dst)
+{
+    size_t bytes = src.total() * src.elemSize();
+    src.copyTo(dst);
+    matTrace.copied(bytes);
+}
+
+void tracedCopy(const cv::Mat &src, cv::OutputArray dst, cv::InputArray mask)
+{
+    size_t bytes = src.total() * src.elemSize();
+    src.copyTo(dst, mask);
+    matTrace.copied(bytes);
+}
+
+void tracedConvert(const cv::Mat &src, cv::OutputArray dst, int rtype, double alpha, double beta)
+{
+    size_t bytes = convertedBytes(src, rtype);
+    src.convertTo(dst, rtype, alpha, beta);
+    matTrace.converted(bytes);
+}
+
+cv::Mat tracedClone(const cv::Mat &src)
+{
+    matTrace.copied(src.total() * src.elemSize());
+    return src.clone();
+}
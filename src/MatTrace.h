@@ -0,0 +1,79 @@
+#pragma once
+
+#include <opencv2/core.hpp>
+
+#include <atomic>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <string>
+
+// Opt-in accounting of cv::Mat traffic. Once enabled it counts, per pipeline
+// stage, the image buffers allocated (through OpenCV's default allocator and
+// the frame pool) and the bytes written by the traced copy and conversion
+// helpers below. Stages are named per thread with MatTrace::Stage. The
+// summary gives per frame averages, the optional trace file gets one counter
+// event per stage and frame in the Chrome trace event format (chrome://tracing,
+// Perfetto), so copy elimination work can be checked stage by stage.
+class MatTrace : public cv::MatAllocator
+{
+public:
+    struct Counters
+    {
+        unsigned long allocations = 0;
+        size_t allocated = 0, copied = 0, converted = 0;
+    };
+
+    // Names the stage of the calling thread while it lives, the previous name comes back after it
+    class Stage
+    {
+    public:
+        explicit Stage(const char *name);
+        ~Stage();
+
+        // Moves on to the next stage within the same scope
+        void set(const char *name);
+
+    private:
+        const char *previous;
+    };
+
+    // Installs the counting allocator as OpenCV's default. With a trace_path
+    // the per frame counters are also written there as a trace.
+    bool enable(const std::string &trace_path = "");
+    bool enabled() const { return on.load(std::memory_order_relaxed); }
+
+    void allocated(size_t bytes);
+    void copied(size_t bytes);
+    void converted(size_t bytes);
+
+    // Ends a frame, the counters since the previous one go to the trace
+    void frameDone();
+
+    // Per frame averages of every stage since the last report
+    void report(std::ostream &out);
+
+    cv::UMatData *allocate(int dims, const int *sizes, int type, void *data, size_t *step, int flags, cv::UMatUsageFlags usageFlags) const override;
+    bool allocate(cv::UMatData *data, int accessflags, cv::UMatUsageFlags usageFlags) const override;
+    void deallocate(cv::UMatData *data) const override;
+
+private:
+    Counters &current();
+    void writeCounter(const char *name, size_t Counters::*field, double timestamp);
+
+    std::atomic_bool on{false};
+    std::mutex mutex;
+    std::map<std::string, Counters> stages, frame_stages;
+    unsigned long frames = 0;
+    std::ofstream trace;
+    bool first_event = true;
+};
+
+extern MatTrace matTrace;
+
+// Copies and conversions that count the bytes they write when tracing is on
+void tracedCopy(const cv::Mat &src, cv::OutputArray dst);
+void tracedCopy(const cv::Mat &src, cv::OutputArray dst, cv::InputArray mask);
+void tracedConvert(const cv::Mat &src, cv::OutputArray dst, int rtype, double alpha = 1, double beta = 0);
+cv::Mat tracedClone(const cv::Mat &src);
@@ -0,0 +1,124 @@
+#include "MjpegCapture.h"
+
+#include <linux/videodev2.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+
+// Buffers the driver fills while a frame is being handed on
+static const unsigned int BUFFER_COUNT = 4;
+
+static int xioctl(int fd, unsigned long request, void *arg)
+{
+    int r;
+    do
+        r = ioctl(fd, request, arg);
+    while (r < 0 && errno == EINTR);
+    return r;
+}
+
+MjpegCapture::~MjpegCapture()
+{
+    if (fd < 0)
+        return;
+    v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    xioctl(fd, VIDIOC_STREAMOFF, &type);
+    for (const Buffer &b : buffers)
+        munmap(b.start, b.length);
+    ::close(fd);
+}
+
+bool MjpegCapture::open(int devnum, cv::Size size, double fps)
+{
+    std::string path = "/dev/video" + std::to_string(devnum);
+    fd = ::open(path.c_str(), O_RDWR);
+    if (fd < 0)
+    {
+        std::cerr << "Unable to open " << path << ": " << std::strerror(errno) << std::endl;
+        return false;
+    }
+
+    v4l2_format format;
+    std::memset(&format, 0, sizeof(format));
+    format.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    format.fmt.pix.width = size.width;
+    format.fmt.pix.height = size.height;
+    format.fmt.pix.pixelformat = V4L2_PIX_FMT_MJPEG;
+    format.fmt.pix.field = V4L2_FIELD_ANY;
+    if (xioctl(fd, VIDIOC_S_FMT, &format) < 0 || format.fmt.pix.pixelformat != V4L2_PIX_FMT_MJPEG)
+    {
+        std::cerr << path << " does not deliver MJPEG" << std::endl;
+        return false;
+    }
+    frame_size = cv::Size(format.fmt.pix.width, format.fmt.pix.height);
+
+    // Not every driver lets the rate be set, it is only reported then
+    v4l2_streamparm parm;
+    std::memset(&parm, 0, sizeof(parm));
+    parm.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    parm.parm.capture.timeperframe.numerator = 1;
+    parm.parm.capture.timeperframe.denominator = (unsigned int)fps;
+    xioctl(fd, VIDIOC_S_PARM, &parm);
+    if (xioctl(fd, VIDIOC_G_PARM, &parm) == 0 && parm.parm.capture.timeperframe.numerator)
+        frame_rate = (double)parm.parm.capture.timeperframe.denominator / parm.parm.capture.timeperframe.numerator;
+
+    v4l2_requestbuffers request;
+    std::memset(&request, 0, sizeof(request));
+    request.count = BUFFER_COUNT;
+    request.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    request.memory = V4L2_MEMORY_MMAP;
+    if (xioctl(fd, VIDIOC_REQBUFS, &request) < 0 || request.count == 0)
+    {
+        std::cerr << path << " has no memory mapped buffers: " << std::strerror(errno) << std::endl;
+        return false;
+    }
+
+    for (unsigned int i = 0; i < request.count; i++)
+    {
+        v4l2_buffer buffer;
+        std::memset(&buffer, 0, sizeof(buffer));
+        buffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        buffer.memory = V4L2_MEMORY_MMAP;
+        buffer.index = i;
+        if (xioctl(fd, VIDIOC_QUERYBUF, &buffer) < 0)
+            return false;
+
+        void *start = mmap(nullptr, buffer.length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, buffer.m.offset);
+        if (start == MAP_FAILED)
+        {
+            std::cerr << "Unable to map the buffers of " << path << ": " << std::strerror(errno) << std::endl;
+            return false;
+        }
+        buffers.push_back(Buffer{start, buffer.length});
+
+        if (xioctl(fd, VIDIOC_QBUF, &buffer) < 0)
+            return false;
+    }
+
+    v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    if (xioctl(fd, VIDIOC_STREAMON, &type) < 0)
+    {
+        std::cerr << "Unable to start streaming from " << path << ": " << std::strerror(errno) << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool MjpegCapture::read(std::vector<uint8_t> &jpeg)
+{
+    v4l2_buffer buffer;
+    std::memset(&buffer, 0, sizeof(buffer));
+    buffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    buffer.memory = V4L2_MEMORY_MMAP;
+    if (fd < 0 || xioctl(fd, VIDIOC_DQBUF, &buffer) < 0)
+        return false;
+
+    const uint8_t *start = static_cast<const uint8_t *>(buffers[buffer.index].start);
+    jpeg.assign(start, start + buffer.bytesused);
+    return xioctl(fd, VIDIOC_QBUF, &buffer) == 0;
+}
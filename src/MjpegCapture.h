@@ -0,0 +1,44 @@
+#pragma once
+
+#include <opencv2/core.hpp>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Reads the compressed frames of a V4L2 camera in MJPEG, which most USB
+// cameras need for high frame rates at 1080p, without decoding them. The
+// frames are copied out of the driver's memory mapped buffers, the buffers
+// go straight back to the driver.
+class MjpegCapture
+{
+public:
+    MjpegCapture() {}
+    ~MjpegCapture();
+
+    MjpegCapture(const MjpegCapture &) = delete;
+    MjpegCapture &operator=(const MjpegCapture &) = delete;
+
+    // Opens /dev/video<devnum> and starts streaming, the driver may pick a
+    // different size and rate. False with the reason on stderr when the
+    // camera cannot deliver MJPEG.
+    bool open(int devnum, cv::Size size, double fps);
+
+    // Blocks for the next frame, false when the camera went away
+    bool read(std::vector<uint8_t> &jpeg);
+
+    cv::Size size() const { return frame_size; }
+    double fps() const { return frame_rate; }
+
+private:
+    struct Buffer
+    {
+        void *start;
+        size_t length;
+    };
+
+    int fd = -1;
+    std::vector<Buffer> buffers;
+    cv::Size frame_size;
+    double frame_rate = 0;
+};
@@ -0,0 +1,224 @@
+#include "MjpegServer.h"
+#include "ThreadConfig.h"
+
+#include <opencv2/imgcodecs.hpp>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+// A client that takes longer than this for one frame is dropped
+static const int SEND_TIMEOUT_SECONDS = 5;
+
+// How often the acceptor looks whether the server is being stopped
+static const int ACCEPT_POLL_MS = 250;
+
+static bool sendAll(int socket, const void *data, size_t size)
+{
+    const char *p = static_cast<const char *>(data);
+    while (size > 0)
+    {
+        ssize_t sent = ::send(socket, p, size, MSG_NOSIGNAL);
+        if (sent <= 0)
+            return false;
+        p += sent;
+        size -= sent;
+    }
+    return true;
+}
+
+MjpegServer::MjpegServer(const std::string &address, int port, int quality, size_t queue_size, DropPolicy policy) :
+    OutputSink("mjpeg", queue_size, policy), address(address), port(port), quality(quality),
+    serving(false), clients_connected(0)
+{
+    encode_params = { cv::IMWRITE_JPEG_QUALITY, quality };
+}
+
+MjpegServer::~MjpegServer()
+{
+    stop();
+}
+
+void MjpegServer::push(const cv::Mat &frame)
+{
+    // Nobody watching, do not even queue the frame
+    if (clients_connected.load() == 0)
+        return;
+    OutputSink::push(frame);
+}
+
+void MjpegServer::open()
+{
+    listen_socket = ::socket(AF_INET, SOCK_STREAM, 0);
+    if (listen_socket < 0)
+    {
+        std::cerr << "Sink " << name() << " : unable to create socket: " << std::strerror(errno) << std::endl;
+        return;
+    }
+
+    int on = 1;
+    ::setsockopt(listen_socket, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+    sockaddr_in addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (!address.empty() && ::inet_pton(AF_INET, address.c_str(), &addr.sin_addr) != 1)
+    {
+        std::cerr << "Sink " << name() << " : bad address " << address << std::endl;
+        ::close(listen_socket);
+        listen_socket = -1;
+        return;
+    }
+
+    if (::bind(listen_socket, (sockaddr *)&addr, sizeof(addr)) != 0 || ::listen(listen_socket, 8) != 0)
+    {
+        std::cerr << "Sink " << name() << " : unable to listen on port " << port << ": " << std::strerror(errno) << std::endl;
+        ::close(listen_socket);
+        listen_socket = -1;
+        return;
+    }
+
+    std::cerr << "Sink " << name() << " : serving on http://" << (address.empty() ? "0.0.0.0" : address) << ":" << port << "/" << std::endl;
+
+    serving = true;
+    acceptor = std::thread(&MjpegServer::acceptClients, this);
+}
+
+void MjpegServer::write(const cv::Mat &frame)
+{
+    std::shared_ptr<std::vector<unsigned char>> encoded = std::make_shared<std::vector<unsigned char>>();
+    if (!cv::imencode(".jpg", frame, *encoded, encode_params))
+        throw std::runtime_error("JPEG encoding failed");
+
+    {
+        std::unique_lock<std::mutex> l(frame_mutex);
+        jpeg = encoded;
+        jpeg_seq++;
+    }
+    frame_ready.notify_all();
+}
+
+void MjpegServer::close()
+{
+    {
+        std::unique_lock<std::mutex> l(frame_mutex);
+        serving = false;
+    }
+    frame_ready.notify_all();
+
+    if (acceptor.joinable())
+        acceptor.join();
+
+    // Wakes up senders stuck in send or recv
+    {
+        std::unique_lock<std::mutex> l(clients_mutex);
+        for (auto &client : clients)
+            ::shutdown(client->socket, SHUT_RDWR);
+    }
+    reapClients(true);
+
+    if (listen_socket >= 0)
+        ::close(listen_socket);
+    listen_socket = -1;
+}
+
+void MjpegServer::acceptClients()
+{
+    threadConfig.apply("sink", "mjpeg-accept");
+
+    while (serving)
+    {
+        reapClients(false);
+
+        pollfd p = { listen_socket, POLLIN, 0 };
+        if (::poll(&p, 1, ACCEPT_POLL_MS) <= 0)
+            continue;
+
+        int socket = ::accept(listen_socket, nullptr, nullptr);
+        if (socket < 0)
+            continue;
+
+        timeval timeout = { SEND_TIMEOUT_SECONDS, 0 };
+        ::setsockopt(socket, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        ::setsockopt(socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+        std::unique_ptr<Client> client(new Client());
+        client->socket = socket;
+        client->done = false;
+        clients_connected++;
+
+        std::unique_lock<std::mutex> l(clients_mutex);
+        client->sender = std::thread(&MjpegServer::sendFrames, this, client.get());
+        clients.push_back(std::move(client));
+    }
+}
+
+void MjpegServer::sendFrames(Client *client)
+{
+    threadConfig.apply("sink", "mjpeg-client");
+
+    // Whatever was asked for, every path gets the stream
+    char request[2048];
+    ssize_t received = ::recv(client->socket, request, sizeof(request), 0);
+
+    static const char header[] =
+        "HTTP/1.0 200 OK\r\n"
+        "Cache-Control: no-cache, no-store\r\n"
+        "Pragma: no-cache\r\n"
+        "Connection: close\r\n"
+        "Content-Type: multipart/x-mixed-replace; boundary=frame\r\n"
+        "\r\n";
+
+    if (received > 0 && sendAll(client->socket, header, sizeof(header) - 1))
+    {
+        unsigned long last_seq = 0;
+        while (true)
+        {
+            std::shared_ptr<const std::vector<unsigned char>> frame;
+            {
+                std::unique_lock<std::mutex> l(frame_mutex);
+                frame_ready.wait(l, [&] { return jpeg_seq != last_seq || !serving; });
+                if (!serving)
+                    break;
+                // Always the newest frame, whatever was encoded in between is skipped
+                frame = jpeg;
+                last_seq = jpeg_seq;
+            }
+
+            std::string part = "--frame\r\nContent-Type: image/jpeg\r\nContent-Length: " + std::to_string(frame->size()) + "\r\n\r\n";
+            if (!sendAll(client->socket, part.data(), part.size()) ||
+                !sendAll(client->socket, frame->data(), frame->size()) ||
+                !sendAll(client->socket, "\r\n", 2))
+                break;
+        }
+    }
+
+    clients_connected--;
+    client->done = true;
+}
+
+void MjpegServer::reapClients(bool all)
+{
+    std::unique_lock<std::mutex> l(clients_mutex);
+    for (auto it = clients.begin(); it != clients.end(); )
+    {
+        if (all || (*it)->done)
+        {
+            (*it)->sender.join();
+            ::close((*it)->socket);
+            it = clients.erase(it);
+        }
+        else
+            ++it;
+    }
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include "OutputSink.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Serves the output as multipart/x-mixed-replace MJPEG over HTTP, for a
+// browser or curl on another machine:
+//
+//   curl -s http://127.0.0.1:8080/ | head -c 100000 > preview.mjpeg
+//
+// Every frame is encoded once on the writer thread and the same buffer goes
+// to all clients. Each client has a sender thread that always picks up the
+// newest encoded frame, so a slow client skips frames instead of queueing
+// them. Without clients nothing is queued or encoded at all.
+class MjpegServer : public OutputSink
+{
+public:
+    // address may be empty to listen on all interfaces
+    MjpegServer(const std::string &address, int port, int quality, size_t queue_size, DropPolicy policy);
+    ~MjpegServer();
+
+    void push(const cv::Mat &frame) override;
+
+    size_t clientCount() const { return clients_connected.load(); }
+
+protected:
+    void open() override;
+    void write(const cv::Mat &frame) override;
+    void close() override;
+
+private:
+    struct Client
+    {
+        int socket;
+        std::thread sender;
+        std::atomic_bool done;
+    };
+
+    void acceptClients();
+    void sendFrames(Client *client);
+    void reapClients(bool all);
+
+    std::string address;
+    int port;
+    int quality;
+
+    int listen_socket = -1;
+    std::thread acceptor;
+    std::atomic_bool serving;
+    std::atomic_size_t clients_connected;
+
+    std::mutex clients_mutex;
+    std::vector<std::unique_ptr<Client>> clients;
+
+    // Latest encoded frame, shared by every sender
+    std::mutex frame_mutex;
+    std::condition_variable frame_ready;
+    std::shared_ptr<const std::vector<unsigned char>> jpeg;
+    unsigned long jpeg_seq = 0;
+
+    std::vector<int> encode_params;
+};
@@ -0,0 +1,489 @@
+#include "OutputSink.h"
+#include "MjpegServer.h"
+#include "ThreadConfig.h"
+
+#include <opencv2/imgproc.hpp>
+#include <opencv2/imgcodecs.hpp>
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+OutputSink::OutputSink(const std::string &name, size_t queue_size, DropPolicy policy) :
+    sink_name(name), capacity(queue_size ? queue_size : 1), policy(policy), pushed(0), written(0), dropped(0)
+{
+}
+
+OutputSink::~OutputSink()
+{
+    // Derived sinks stop the writer in their own destructor, before their members go away
+}
+
+// Numbers in [min, max] with nothing after them, "queue=abc" or "fps=30x" are rejected
+static bool parseNumber(const std::string &text, double min, double max, double &value)
+{
+    char *end = nullptr;
+    errno = 0;
+    value = std::strtod(text.c_str(), &end);
+    return !text.empty() && end && *end == 0 && errno == 0 && value >= min && value <= max;
+}
+
+static bool parseInteger(const std::string &text, long min, long max, long &value)
+{
+    char *end = nullptr;
+    errno = 0;
+    value = std::strtol(text.c_str(), &end, 10);
+    return !text.empty() && end && *end == 0 && errno == 0 && value >= min && value <= max;
+}
+
+// File patterns go to snprintf with the frame index, so they must hold
+// exactly one integer conversion like %d or %06d and nothing else but %%
+static bool validFilePattern(const std::string &pattern)
+{
+    int conversions = 0;
+    for (size_t i = 0; i < pattern.size(); i++)
+    {
+        if (pattern[i] != '%')
+            continue;
+        if (++i < pattern.size() && pattern[i] == '%')
+            continue;
+        while (i < pattern.size() && (pattern[i] == '0' || pattern[i] == '-' || pattern[i] == '+' || pattern[i] == ' '))
+            i++;
+        while (i < pattern.size() && std::isdigit((unsigned char)pattern[i]))
+            i++;
+        if (i >= pattern.size() || (pattern[i] != 'd' && pattern[i] != 'i'))
+            return false;
+        conversions++;
+    }
+    return conversions == 1;
+}
+
+std::unique_ptr<OutputSink> OutputSink::create(const std::string &spec, double capture_fps)
+{
+    std::vector<std::string> fields;
+    std::stringstream ss(spec);
+    std::string field;
+    while (std::getline(ss, field, ','))
+        fields.push_back(field);
+
+    if (fields.empty())
+        return nullptr;
+
+    std::string type = fields[0];
+    std::string target;
+    size_t colon = type.find(':');
+    if (colon != std::string::npos)
+    {
+        target = type.substr(colon + 1);
+        type = type.substr(0, colon);
+    }
+
+    // Files keep whole runs of frames, live streams rather stay current
+    bool still = (type == "png" || type == "jpg");
+    bool record = (type == "record");
+    bool mjpeg = (type == "mjpeg");
+    bool shm = (type == "shm");
+    size_t queue_size = still ? 32 : (record ? 16 : ((mjpeg || shm) ? 1 : 4));
+    DropPolicy policy = (still || record) ? DROP_NEWEST : DROP_OLDEST;
+    RecordSink::Codec codec = RecordSink::MJPG;
+    double fps = capture_fps > 0 ? capture_fps : 30;
+    int quality = 80;
+    unsigned int slots = 4;
+
+    for (size_t i = 1; i < fields.size(); i++)
+    {
+        long number;
+        double real;
+        bool valid = true;
+        if (fields[i].compare(0, 6, "queue=") == 0)
+        {
+            valid = parseInteger(fields[i].substr(6), 1, 4096, number);
+            queue_size = number;
+        }
+        else if (fields[i] == "drop=oldest")
+            policy = DROP_OLDEST;
+        else if (fields[i] == "drop=newest")
+            policy = DROP_NEWEST;
+        else if (fields[i] == "drop=block")
+            policy = BLOCK;
+        else if (record && fields[i] == "codec=mjpg")
+            codec = RecordSink::MJPG;
+        else if (record && fields[i] == "codec=ffv1")
+            codec = RecordSink::FFV1;
+        else if ((record || type == "y4m") && fields[i].compare(0, 4, "fps=") == 0)
+        {
+            valid = parseNumber(fields[i].substr(4), 0.1, 1000, real);
+            fps = real;
+        }
+        else if (mjpeg && fields[i].compare(0, 8, "quality=") == 0)
+        {
+            valid = parseInteger(fields[i].substr(8), 1, 100, number);
+            quality = number;
+        }
+        else if (shm && fields[i].compare(0, 6, "slots=") == 0)
+        {
+            valid = parseInteger(fields[i].substr(6), 1, 1024, number);
+            slots = number;
+        }
+        else
+        {
+            std::cerr << "Unknown sink option " << fields[i] << " in " << spec << std::endl;
+            return nullptr;
+        }
+        if (!valid)
+        {
+            std::cerr << "Invalid value in sink option " << fields[i] << " of " << spec << std::endl;
+            return nullptr;
+        }
+    }
+
+    if (still && target.find('%') != std::string::npos && !validFilePattern(target))
+    {
+        std::cerr << "Sink " << spec << " needs exactly one integer conversion like %06d in its file pattern" << std::endl;
+        return nullptr;
+    }
+
+    std::unique_ptr<OutputSink> sink;
+    if (type == "null")
+        sink.reset(new NullSink(queue_size, policy));
+    else if (type == "raw-bgr")
+        sink.reset(new PipeSink(target.empty() ? "-" : target, PipeSink::RAW_BGR, queue_size, policy));
+    else if (type == "raw-rgba")
+        sink.reset(new PipeSink(target.empty() ? "-" : target, PipeSink::RAW_RGBA, queue_size, policy));
+    else if (type == "y4m")
+        sink.reset(new PipeSink(target.empty() ? "-" : target, PipeSink::Y4M, queue_size, policy, fps));
+    else if (still)
+        sink.reset(new FileSink(target.empty() ? "." : target, type, queue_size, policy));
+    else if (record)
+    {
+        if (target.empty())
+        {
+            std::cerr << "Sink " << spec << " needs a file to record to" << std::endl;
+            return nullptr;
+        }
+        sink.reset(new RecordSink(target, codec, fps, queue_size, policy));
+    }
+    else if (mjpeg)
+    {
+        // Only the last colon separates the port, the address is optional
+        std::string address;
+        long port = 8080;
+        size_t port_colon = target.rfind(':');
+        if (port_colon != std::string::npos)
+            address = target.substr(0, port_colon);
+        if (!target.empty() && !parseInteger(target.substr(port_colon == std::string::npos ? 0 : port_colon + 1), 1, 65535, port))
+        {
+            std::cerr << "Sink " << spec << " needs a port between 1 and 65535" << std::endl;
+            return nullptr;
+        }
+        sink.reset(new MjpegServer(address, port, quality, queue_size, policy));
+    }
+    else if (shm)
+        sink.reset(new ShmSink(target.empty() ? "/faceswap" : target, slots, queue_size, policy));
+    else
+    {
+        std::cerr << "Unknown sink type " << type << std::endl;
+        return nullptr;
+    }
+
+    sink->start();
+    return sink;
+}
+
+void OutputSink::push(const cv::Mat &frame)
+{
+    pushed++;
+
+    std::unique_lock<std::mutex> l(queue_mutex);
+    if (!running)
+    {
+        dropped++;
+        return;
+    }
+
+    if (queue.size() >= capacity)
+    {
+        switch (policy)
+        {
+        case DROP_OLDEST:
+            queue.pop_front();
+            dropped++;
+            break;
+        case DROP_NEWEST:
+            dropped++;
+            return;
+        case BLOCK:
+            queue_drained.wait(l, [this] { return queue.size() < capacity || !running; });
+            if (!running)
+            {
+                dropped++;
+                return;
+            }
+            break;
+        }
+    }
+
+    queue.push_back(frame);
+    high_watermark = std::max(high_watermark, queue.size());
+    queue_filled.notify_one();
+}
+
+void OutputSink::start()
+{
+    std::unique_lock<std::mutex> l(queue_mutex);
+    if (running)
+        return;
+    running = true;
+    writer = std::thread(&OutputSink::run, this);
+}
+
+void OutputSink::stop()
+{
+    {
+        std::unique_lock<std::mutex> l(queue_mutex);
+        running = false;
+    }
+    queue_filled.notify_all();
+    queue_drained.notify_all();
+
+    if (writer.joinable())
+        writer.join();
+}
+
+size_t OutputSink::queueDepth()
+{
+    std::unique_lock<std::mutex> l(queue_mutex);
+    return queue.size();
+}
+
+size_t OutputSink::queueHighWatermark()
+{
+    std::unique_lock<std::mutex> l(queue_mutex);
+    return high_watermark;
+}
+
+void OutputSink::run()
+{
+    threadConfig.apply("sink", "sink-" + sink_name);
+
+    open();
+
+    while (true)
+    {
+        cv::Mat frame;
+        {
+            std::unique_lock<std::mutex> l(queue_mutex);
+            queue_filled.wait(l, [this] { return !queue.empty() || !running; });
+            if (queue.empty())
+                break;
+            frame = queue.front();
+            queue.pop_front();
+        }
+        queue_drained.notify_one();
+
+        try
+        {
+            write(frame);
+            written++;
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << "Sink " << sink_name << " : " << e.what() << std::endl;
+            dropped++;
+        }
+    }
+
+    close();
+}
+
+PipeSink::PipeSink(const std::string &path, Format format, size_t queue_size, DropPolicy policy, double fps) :
+    OutputSink(format == Y4M ? "y4m" : (format == RAW_RGBA ? "raw-rgba" : "raw-bgr"), queue_size, policy),
+    path(path), format(format), fps(fps > 0 ? fps : 30)
+{
+}
+
+PipeSink::~PipeSink()
+{
+    stop();
+}
+
+void PipeSink::open()
+{
+    // Opening a FIFO blocks until a reader shows up, this happens on the writer thread
+    if (path == "-")
+        stream = stdout;
+    else
+        stream = std::fopen(path.c_str(), "wb");
+
+    if (!stream)
+        std::cerr << "Sink " << name() << " : unable to open " << path << std::endl;
+
+    header_written = false;
+}
+
+void PipeSink::write(const cv::Mat &frame)
+{
+    if (!stream)
+    {
+        // The reader of a FIFO went away, try again for the next frame
+        if (path == "-")
+            throw std::runtime_error("stdout is closed");
+        open();
+        if (!stream)
+            throw std::runtime_error("unable to open " + path);
+    }
+
+    const cv::Mat *out = &frame;
+    switch (format)
+    {
+    case RAW_BGR:
+        break;
+    case RAW_RGBA:
+        cv::cvtColor(frame, converted, cv::COLOR_BGR2RGBA);
+        out = &converted;
+        break;
+    case Y4M:
+        if (!header_written)
+        {
+            // The rate as a fraction in thousandths, 29.97 goes out as 2997:100
+            long rate = std::lround(fps * 1000), scale = 1000, a = rate, b = scale;
+            while (b)
+            {
+                long t = a % b;
+                a = b;
+                b = t;
+            }
+            std::fprintf(stream, "YUV4MPEG2 W%d H%d F%ld:%ld Ip A1:1 C420jpeg\n", frame.cols & ~1, frame.rows & ~1, rate / a, scale / a);
+            header_written = true;
+        }
+        // I420 needs even dimensions
+        cv::cvtColor(frame(cv::Rect(0, 0, frame.cols & ~1, frame.rows & ~1)), converted, cv::COLOR_BGR2YUV_I420);
+        std::fputs("FRAME\n", stream);
+        out = &converted;
+        break;
+    }
+
+    bool ok = true;
+    if (out->isContinuous())
+        ok = std::fwrite(out->data, out->elemSize() * out->cols, out->rows, stream) == (size_t)out->rows;
+    else
+        for (int i = 0; i < out->rows && ok; i++)
+            ok = std::fwrite(out->ptr(i), out->elemSize() * out->cols, 1, stream) == 1;
+
+    if (!ok || std::fflush(stream) != 0)
+    {
+        close();
+        throw std::runtime_error("write to " + path + " failed");
+    }
+}
+
+void PipeSink::close()
+{
+    if (stream && stream != stdout)
+        std::fclose(stream);
+    stream = nullptr;
+}
+
+FileSink::FileSink(const std::string &pattern, const std::string &extension, size_t queue_size, DropPolicy policy) :
+    OutputSink(extension, queue_size, policy), pattern(pattern)
+{
+    if (this->pattern.find('%') == std::string::npos)
+        this->pattern += "/frame_%06d." + extension;
+}
+
+FileSink::~FileSink()
+{
+    stop();
+}
+
+void FileSink::write(const cv::Mat &frame)
+{
+    char filename[1024];
+    std::snprintf(filename, sizeof(filename), pattern.c_str(), (int)index++);
+
+    if (!cv::imwrite(filename, frame))
+        throw std::runtime_error(std::string("unable to write ") + filename);
+}
+
+NullSink::NullSink(size_t queue_size, DropPolicy policy) :
+    OutputSink("null", queue_size, policy)
+{
+}
+
+NullSink::~NullSink()
+{
+    stop();
+}
+
+void NullSink::write(const cv::Mat &frame)
+{
+    // Nothing to do, the base class counts the frame
+}
+
+RecordSink::RecordSink(const std::string &path, Codec codec, double fps, size_t queue_size, DropPolicy policy) :
+    OutputSink("record", queue_size, policy), path(path), codec(codec), fps(fps > 0 ? fps : 30)
+{
+}
+
+RecordSink::~RecordSink()
+{
+    stop();
+}
+
+void RecordSink::write(const cv::Mat &frame)
+{
+    // The writer is opened with the size of the first frame, later frames have to match it
+    if (!video.isOpened())
+    {
+        int fourcc = codec == FFV1 ? cv::VideoWriter::fourcc('F', 'F', 'V', '1') : cv::VideoWriter::fourcc('M', 'J', 'P', 'G');
+        frame_size = frame.size();
+        if (!video.open(path, fourcc, fps, frame_size, true))
+            throw std::runtime_error("unable to record to " + path);
+    }
+
+    if (frame.size() != frame_size)
+        throw std::runtime_error("frame size changed while recording to " + path);
+
+    video.write(frame);
+}
+
+void RecordSink::close()
+{
+    video.release();
+}
+
+ShmSink::ShmSink(const std::string &shm_name, unsigned int slots, size_t queue_size, DropPolicy policy) :
+    OutputSink("shm", queue_size, policy), shm_name(shm_name), slots(slots)
+{
+}
+
+ShmSink::~ShmSink()
+{
+    stop();
+}
+
+void ShmSink::write(const cv::Mat &frame)
+{
+    CV_Assert(frame.type() == CV_8UC3);
+
+    if (!ring.capacity())
+    {
+        if (!ring.create(shm_name, slots, (uint32_t)(frame.cols * frame.rows * frame.elemSize())))
+            throw std::runtime_error("unable to create shared memory " + shm_name);
+        std::cerr << "Sink " << name() << " : publishing frames to " << shm_name << std::endl;
+    }
+
+    if (!ring.publish(frame.data, frame.cols, frame.rows, (uint32_t)frame.step, SHM_BGR24))
+        throw std::runtime_error("frame does not fit the shared memory slots");
+}
+
+void ShmSink::close()
+{
+    ring.destroy();
+}
@@ -0,0 +1,190 @@
+#pragma once
+
+#include <opencv2/core.hpp>
+#include <opencv2/videoio.hpp>
+
+#include "ShmFrameRing.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// Destination for processed frames that does not need a display.
+// Every sink owns a bounded queue and a writer thread, so a slow consumer
+// only ever loses its own frames and never stalls the pipeline.
+class OutputSink
+{
+public:
+    // What happens to a pushed frame when the queue is full
+    enum DropPolicy
+    {
+        DROP_OLDEST,    // discard the oldest queued frame, keeps latency low
+        DROP_NEWEST,    // discard the pushed frame, keeps the queued run contiguous
+        BLOCK           // wait for room, throttles the producer to the sink
+    };
+
+    OutputSink(const std::string &name, size_t queue_size, DropPolicy policy);
+    virtual ~OutputSink();
+
+    // Creates a sink from a command line spec: type[:target][,queue=N][,drop=oldest|newest|block]
+    // Types: null, raw-bgr, raw-rgba, y4m (target is a path, FIFO or - for stdout, takes [,fps=N]),
+    // png, jpg (target is a file pattern or directory),
+    // record (target is a video file, takes [,codec=mjpg|ffv1][,fps=N]),
+    // mjpeg (target is [address:]port of an HTTP preview server, takes [,quality=N]),
+    // shm (target is a POSIX shared memory name like /faceswap, takes [,slots=N])
+    // fps is the rate the frames are captured at, y4m and record write it unless the spec gives fps=N
+    static std::unique_ptr<OutputSink> create(const std::string &spec, double fps = 30);
+
+    // Queues a BGR frame by reference, the caller must not write to it afterwards
+    virtual void push(const cv::Mat &frame);
+
+    // Starts the writer thread
+    void start();
+
+    // Writes out what is queued and joins the writer thread
+    void stop();
+
+    const std::string &name() const { return sink_name; }
+    unsigned long framesPushed() const { return pushed.load(); }
+    unsigned long framesWritten() const { return written.load(); }
+    unsigned long framesDropped() const { return dropped.load(); }
+    size_t queueDepth();
+
+    // Deepest the queue has been since the sink started
+    size_t queueHighWatermark();
+
+    // True when frames go to the process stdout, so log output has to go elsewhere
+    virtual bool usesStdout() const { return false; }
+
+protected:
+    // Called on the writer thread for every dequeued frame
+    virtual void write(const cv::Mat &frame) = 0;
+
+    // Called on the writer thread before the first and after the last frame
+    virtual void open() {}
+    virtual void close() {}
+
+private:
+    void run();
+
+    std::string sink_name;
+    size_t capacity;
+    DropPolicy policy;
+
+    std::deque<cv::Mat> queue;
+    size_t high_watermark = 0;
+    std::mutex queue_mutex;
+    std::condition_variable queue_filled, queue_drained;
+    bool running = false;
+    std::thread writer;
+
+    std::atomic_ulong pushed, written, dropped;
+};
+
+// Streams frames as raw BGR, raw RGBA or YUV4MPEG2 (I420) to stdout, a file or a FIFO
+class PipeSink : public OutputSink
+{
+public:
+    enum Format
+    {
+        RAW_BGR,
+        RAW_RGBA,
+        Y4M
+    };
+
+    PipeSink(const std::string &path, Format format, size_t queue_size, DropPolicy policy, double fps = 30);
+    ~PipeSink();
+
+    bool usesStdout() const override { return path == "-"; }
+
+protected:
+    void open() override;
+    void write(const cv::Mat &frame) override;
+    void close() override;
+
+private:
+    std::string path;
+    Format format;
+    double fps;
+    FILE *stream = nullptr;
+    bool header_written = false;
+    cv::Mat converted;
+};
+
+// Writes numbered still images; the encoder runs on the writer thread
+class FileSink : public OutputSink
+{
+public:
+    // pattern is a printf pattern like out/frame_%06d.png, or a directory
+    FileSink(const std::string &pattern, const std::string &extension, size_t queue_size, DropPolicy policy);
+    ~FileSink();
+
+protected:
+    void write(const cv::Mat &frame) override;
+
+private:
+    std::string pattern;
+    unsigned long index = 0;
+};
+
+// Only counts frames, used to measure pipeline throughput without any output cost
+class NullSink : public OutputSink
+{
+public:
+    NullSink(size_t queue_size, DropPolicy policy);
+    ~NullSink();
+
+protected:
+    void write(const cv::Mat &frame) override;
+};
+
+// Records the output to a video file with cv::VideoWriter. The encoder runs
+// on the low priority writer thread, so recording never slows down the frames
+// going to the display or to the other sinks.
+class RecordSink : public OutputSink
+{
+public:
+    enum Codec
+    {
+        MJPG,
+        FFV1
+    };
+
+    RecordSink(const std::string &path, Codec codec, double fps, size_t queue_size, DropPolicy policy);
+    ~RecordSink();
+
+protected:
+    void write(const cv::Mat &frame) override;
+    void close() override;
+
+private:
+    std::string path;
+    Codec codec;
+    double fps;
+    cv::VideoWriter video;
+    cv::Size frame_size;
+};
+
+// Publishes frames into a shared memory ring for other processes on the box,
+// see ShmFrameRing.h for the layout and the reader side. The ring is created
+// with the size of the first frame.
+class ShmSink : public OutputSink
+{
+public:
+    ShmSink(const std::string &shm_name, unsigned int slots, size_t queue_size, DropPolicy policy);
+    ~ShmSink();
+
+protected:
+    void write(const cv::Mat &frame) override;
+    void close() override;
+
+private:
+    std::string shm_name;
+    unsigned int slots;
+    ShmFrameWriter ring;
+};
@@ -0,0 +1,94 @@
+#include "PresenceGate.h"
+
+#include <opencv2/imgproc.hpp>
+
+// Thumbnail size and what counts as motion in it
+static const cv::Size THUMBNAIL_SIZE(32, 24);
+static const int PIXEL_THRESHOLD = 25;
+static const double CHANGED_FRACTION = 0.02;
+
+PresenceGate::PresenceGate(double idle_after_seconds, double motion_hz) :
+    idle_after(idle_after_seconds),
+    motion_interval(std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(motion_hz > 0 ? 1.0 / motion_hz : 0.25)))
+{
+    state_since = last_face = clock::now();
+}
+
+bool PresenceGate::needsModel(FramePyramid &frame)
+{
+    // Several frames of a camera can be in flight, the whole decision and the
+    // reference thumbnail are one critical section
+    std::unique_lock<std::mutex> l(mutex);
+    clock::time_point now = clock::now();
+
+    if (current == ACTIVE)
+    {
+        if (idle_after <= 0 || std::chrono::duration<double>(now - last_face).count() < idle_after)
+            return true;
+
+        // Nobody around for a while, remember what the empty scene looks like
+        enter(IDLE, now);
+        motion(frame);
+        last_check = now;
+        return false;
+    }
+
+    if (now - last_check < motion_interval)
+        return false;
+    last_check = now;
+
+    if (!motion(frame))
+        return false;
+
+    enter(ACTIVE, now);
+    last_face = now;
+    return true;
+}
+
+void PresenceGate::facesFound(size_t faces)
+{
+    if (faces == 0)
+        return;
+    std::unique_lock<std::mutex> l(mutex);
+    last_face = clock::now();
+}
+
+PresenceGate::State PresenceGate::state()
+{
+    std::unique_lock<std::mutex> l(mutex);
+    return current;
+}
+
+double PresenceGate::secondsIn(State state)
+{
+    std::unique_lock<std::mutex> l(mutex);
+    double seconds = spent[state];
+    if (state == current)
+        seconds += std::chrono::duration<double>(clock::now() - state_since).count();
+    return seconds;
+}
+
+void PresenceGate::enter(State state, clock::time_point now)
+{
+    spent[current] += std::chrono::duration<double>(now - state_since).count();
+    current = state;
+    state_since = now;
+}
+
+bool PresenceGate::motion(FramePyramid &frame)
+{
+    // Scaled from one of the smallest pyramid levels, this costs next to nothing
+    const cv::Mat &thumbnail = frame.thumbnail(THUMBNAIL_SIZE);
+
+    bool moved = false;
+    if (!reference.empty())
+    {
+        cv::absdiff(thumbnail, reference, difference);
+        int changed = cv::countNonZero(difference > PIXEL_THRESHOLD);
+        moved = changed > CHANGED_FRACTION * thumbnail.total();
+    }
+
+    // Compare against the last check so slow lighting changes do not count
+    thumbnail.copyTo(reference);
+    return moved;
+}
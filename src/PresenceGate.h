@@ -0,0 +1,52 @@
+#pragma once
+
+#include <chrono>
+#include <mutex>
+
+#include "FramePyramid.h"
+
+// Decides per camera whether frames need the full face model. After no face
+// was seen for a while the camera goes idle: frames are passed straight to
+// the outputs and only a tiny grayscale thumbnail is compared a few times a
+// second. The frame in which motion shows up gets the full model again.
+// A gate can be used from several threads at once.
+class PresenceGate
+{
+public:
+    enum State
+    {
+        ACTIVE,
+        IDLE
+    };
+
+    typedef std::chrono::steady_clock clock;
+
+    // idle_after == 0 keeps the camera active all the time
+    PresenceGate(double idle_after_seconds, double motion_hz);
+
+    // True when the frame has to go through the full model
+    bool needsModel(FramePyramid &frame);
+
+    // Reports how many faces the full model found in the last frame
+    void facesFound(size_t faces);
+
+    State state();
+
+    // Seconds spent in state so far
+    double secondsIn(State state);
+
+private:
+    // Both with mutex held
+    void enter(State state, clock::time_point now);
+    bool motion(FramePyramid &frame);
+
+    double idle_after;
+    clock::duration motion_interval;
+
+    std::mutex mutex;
+    State current = ACTIVE;
+    clock::time_point state_since, last_face, last_check;
+    double spent[2] = { 0, 0 };
+
+    cv::Mat reference, difference;
+};
@@ -0,0 +1,289 @@
+#include "RemoteWorkerPool.h"
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <iostream>
+
+using std::chrono::duration;
+
+// Pause before a lost worker is connected again
+static const double RETRY_SECONDS = 1.0;
+
+// Jobs in a row a worker may let time out before it is taken for hung
+static const unsigned int MAX_LATE = 3;
+
+RemoteWorkerPool::RemoteWorkerPool(const std::vector<std::string> &endpoints, double timeout_seconds) :
+    timeout(timeout_seconds > 0 ? timeout_seconds : 1.0), interval_start(clock::now())
+{
+    for (const std::string &endpoint : endpoints)
+    {
+        workers.emplace_back(new Worker());
+        workers.back()->endpoint = endpoint;
+    }
+    for (auto &w : workers)
+        connect(*w);
+    reconnector = std::thread(&RemoteWorkerPool::reconnect, this);
+}
+
+RemoteWorkerPool::~RemoteWorkerPool()
+{
+    {
+        std::unique_lock<std::mutex> l(mutex);
+        stopping = true;
+        for (auto &w : workers)
+            lose(*w);
+    }
+    reconnector.join();
+    for (auto &w : workers)
+    {
+        if (w->reader.joinable())
+            w->reader.join();
+        if (w->socket >= 0)
+            ::close(w->socket);
+    }
+}
+
+void RemoteWorkerPool::connect(Worker &w)
+{
+    // The reader of the previous connection ends once its socket is shut down
+    if (w.reader.joinable())
+        w.reader.join();
+    int old;
+    {
+        std::unique_lock<std::mutex> l(mutex);
+        old = w.socket;
+        w.socket = -1;
+    }
+    if (old >= 0)
+        ::close(old);
+
+    int s = connectEndpoint(w.endpoint);
+
+    std::unique_lock<std::mutex> l(mutex);
+    if (s < 0 || stopping)
+    {
+        if (s >= 0)
+            ::close(s);
+        w.retry = clock::now() + std::chrono::duration_cast<clock::duration>(duration<double>(RETRY_SECONDS));
+        return;
+    }
+    std::cerr << "Remote worker " << w.endpoint << " connected" << std::endl;
+    w.socket = s;
+    w.connected = true;
+    w.late = 0;
+    w.reader = std::thread(&RemoteWorkerPool::readResults, this, &w, s);
+}
+
+void RemoteWorkerPool::lose(Worker &w)
+{
+    // Called with the mutex held. Waiting jobs are sent again by their callers.
+    if (w.connected && !stopping)
+        std::cerr << "Remote worker " << w.endpoint << " lost, " << w.in_flight.size() << " jobs go to the others" << std::endl;
+    if (w.socket >= 0)
+        ::shutdown(w.socket, SHUT_RDWR);
+    w.connected = false;
+    w.retry = clock::now() + std::chrono::duration_cast<clock::duration>(duration<double>(RETRY_SECONDS));
+    for (auto &pending : w.in_flight)
+        pending.second->lost = true;
+    w.in_flight.clear();
+    answered.notify_all();
+    disconnected.notify_all();
+}
+
+void RemoteWorkerPool::reconnect()
+{
+    // Connecting can take as long as the TCP handshake times out, jobs keep
+    // going to the other workers meanwhile
+    std::unique_lock<std::mutex> l(mutex);
+    while (!stopping)
+    {
+        for (auto &w : workers)
+        {
+            if (!w->connected && !stopping && clock::now() >= w->retry)
+            {
+                l.unlock();
+                connect(*w);
+                l.lock();
+            }
+        }
+
+        // Workers can be lost while the mutex was let go for connecting, the
+        // wait is worked out without letting it go again
+        clock::time_point next = clock::time_point::max();
+        for (auto &w : workers)
+            if (!w->connected)
+                next = std::min(next, w->retry);
+        if (stopping)
+            break;
+        if (next == clock::time_point::max())
+            disconnected.wait(l);
+        else
+            disconnected.wait_until(l, next);
+    }
+}
+
+void RemoteWorkerPool::readResults(Worker *w, int socket)
+{
+    FrameMessageType type;
+    uint64_t seq;
+    uint32_t camera;
+    std::vector<uint8_t> payload;
+
+    while (receiveMessage(socket, type, seq, camera, payload))
+    {
+        if (type != FRAME_RESULT)
+            break;
+
+        std::unique_lock<std::mutex> l(mutex);
+        auto it = w->in_flight.find(seq);
+        // Answers to jobs that timed out are not waited for any more
+        if (it == w->in_flight.end())
+            continue;
+        Pending *pending = it->second;
+        w->in_flight.erase(it);
+        if (!decodeResult(payload, *pending->result))
+        {
+            pending->lost = true;
+            break;
+        }
+        pending->result->seq = seq;
+        pending->result->camera = camera;
+        pending->done = true;
+        w->jobs++;
+        w->late = 0;
+        answered.notify_all();
+    }
+
+    std::unique_lock<std::mutex> l(mutex);
+    if (w->socket == socket)
+        lose(*w);
+}
+
+RemoteWorkerPool::Worker *RemoteWorkerPool::pick(const std::vector<Worker *> &tried)
+{
+    Worker *best = nullptr;
+    for (auto &w : workers)
+        if (w->connected && std::find(tried.begin(), tried.end(), w.get()) == tried.end() &&
+            (!best || w->in_flight.size() < best->in_flight.size()))
+            best = w.get();
+    return best;
+}
+
+bool RemoteWorkerPool::process(const FrameJob &job, FrameResult &result, const std::function<bool(const FrameResult &)> &accept)
+{
+    std::vector<uint8_t> payload;
+    encodeJob(job, payload);
+
+    // A worker that was given the job once does not get it again
+    std::vector<Worker *> tried;
+    std::unique_lock<std::mutex> l(mutex);
+    for (size_t attempt = 0; attempt <= workers.size() && !stopping; attempt++)
+    {
+        Worker *w = pick(tried);
+        if (!w)
+            break;
+
+        uint64_t seq = next_seq++;
+        Pending pending;
+        pending.result = &result;
+        w->in_flight[seq] = &pending;
+        int socket = w->socket;
+        clock::time_point sent = clock::now();
+
+        l.unlock();
+        bool ok;
+        {
+            std::unique_lock<std::mutex> sl(w->send_mutex);
+            ok = sendMessage(socket, FRAME_JOB, seq, job.camera, payload);
+        }
+        l.lock();
+
+        if (ok)
+        {
+            clock::time_point deadline = sent + std::chrono::duration_cast<clock::duration>(duration<double>(timeout));
+            answered.wait_until(l, deadline, [&] { return pending.done || pending.lost || stopping; });
+        }
+
+        bool accepted = true;
+        if (pending.done && result.status == 0 && accept)
+        {
+            l.unlock();
+            accepted = accept(result);
+            l.lock();
+        }
+        tried.push_back(w);
+        if (!accepted)
+        {
+            std::cerr << "Remote worker " << w->endpoint << " sent a result that does not fit job " << seq << ", trying another worker" << std::endl;
+            rejected++;
+            resubmitted++;
+            result = FrameResult();
+            continue;
+        }
+
+        if (pending.done)
+        {
+            double roundTrip = duration<double>(clock::now() - sent).count();
+            jobs++;
+            interval_jobs++;
+            round_trip_sum += roundTrip;
+            processing_sum += result.seconds;
+            return result.status == 0;
+        }
+
+        // Too slow: only this job goes to another worker, its answer is ignored
+        // when it comes. A worker that answers nothing any more is given up.
+        w->in_flight.erase(seq);
+        if (ok && !pending.lost && !stopping && w->socket == socket)
+        {
+            timed_out++;
+            if (++w->late >= MAX_LATE)
+            {
+                std::cerr << "Remote worker " << w->endpoint << " let " << w->late << " jobs in a row time out" << std::endl;
+                lose(*w);
+            }
+        }
+        // Not sent or lost: the connection is gone for every job on it
+        else if (!pending.lost && w->socket == socket)
+            lose(*w);
+        resubmitted++;
+    }
+
+    failed++;
+    return false;
+}
+
+RemoteWorkerPool::Stats RemoteWorkerPool::stats()
+{
+    std::unique_lock<std::mutex> l(mutex);
+    Stats s;
+    s.workers = workers.size();
+    for (auto &w : workers)
+    {
+        if (w->connected)
+            s.connected++;
+        s.per_worker.push_back(w->jobs);
+    }
+    s.jobs = jobs;
+    s.resubmitted = resubmitted;
+    s.failed = failed;
+    s.rejected = rejected;
+    s.timed_out = timed_out;
+
+    clock::time_point now = clock::now();
+    double elapsed = duration<double>(now - interval_start).count();
+    if (interval_jobs)
+    {
+        s.round_trip = round_trip_sum / interval_jobs;
+        s.processing = processing_sum / interval_jobs;
+    }
+    if (elapsed > 0 && s.connected)
+        s.efficiency = processing_sum / (elapsed * s.connected);
+
+    interval_jobs = 0;
+    round_trip_sum = processing_sum = 0;
+    interval_start = now;
+    return s;
+}
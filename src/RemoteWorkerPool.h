@@ -0,0 +1,91 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "FrameProtocol.h"
+
+// Hands face swap jobs to face_worker processes over their sockets and waits
+// for the results. A worker connection carries several jobs at once and a
+// job goes to the connected worker with the fewest in flight. A job that is
+// not answered within the timeout goes to another worker, the connection is
+// kept unless the worker has let several jobs in a row time out. When a
+// worker disconnects or sends garbage, its jobs are sent again to the other
+// workers. A result the caller does not accept is thrown away and the job
+// goes to another worker. Lost workers are reconnected by a background
+// thread at most once per second. process() is called from any number of
+// threads.
+class RemoteWorkerPool
+{
+public:
+    struct Stats
+    {
+        unsigned int workers = 0, connected = 0;
+        unsigned long jobs = 0, resubmitted = 0, failed = 0, rejected = 0, timed_out = 0;
+        // Means over the jobs since the last call, in seconds
+        double round_trip = 0, processing = 0;
+        // Share of the time the connected workers spent processing since the
+        // last call: 1 is perfect scaling over the workers, as long as the
+        // capture host keeps enough frames in flight
+        double efficiency = 0;
+        std::vector<unsigned long> per_worker;
+    };
+
+    RemoteWorkerPool(const std::vector<std::string> &endpoints, double timeout_seconds);
+    ~RemoteWorkerPool();
+
+    // Runs job on one of the workers, false when none of them could. With
+    // accept, only a result it returns true for counts as an answer.
+    bool process(const FrameJob &job, FrameResult &result, const std::function<bool(const FrameResult &)> &accept = nullptr);
+
+    Stats stats();
+
+private:
+    typedef std::chrono::steady_clock clock;
+
+    struct Pending
+    {
+        FrameResult *result;
+        bool done = false, lost = false;
+    };
+
+    struct Worker
+    {
+        std::string endpoint;
+        int socket = -1;
+        bool connected = false;
+        clock::time_point retry;
+        unsigned int late = 0;          // jobs timed out since the last answer
+        std::thread reader;
+        std::mutex send_mutex;
+        std::map<uint64_t, Pending *> in_flight;
+        unsigned long jobs = 0;
+    };
+
+    void connect(Worker &w);
+    void readResults(Worker *w, int socket);
+    void lose(Worker &w);
+    void reconnect();
+    Worker *pick(const std::vector<Worker *> &tried);
+
+    double timeout;
+
+    std::mutex mutex;
+    std::condition_variable answered, disconnected;
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::thread reconnector;
+    uint64_t next_seq = 1;
+    bool stopping = false;
+
+    unsigned long jobs = 0, resubmitted = 0, failed = 0, rejected = 0, timed_out = 0;
+    unsigned long interval_jobs = 0;
+    double round_trip_sum = 0, processing_sum = 0;
+    clock::time_point interval_start;
+};
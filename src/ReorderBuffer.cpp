@@ -0,0 +1,82 @@
+#include "ReorderBuffer.h"
+
+#include <algorithm>
+
+ReorderBuffer::ReorderBuffer(double max_wait_seconds) :
+    max_wait(std::max(0.0, max_wait_seconds))
+{
+}
+
+void ReorderBuffer::scheduled(unsigned long seq)
+{
+    std::unique_lock<std::mutex> l(mutex);
+    pending.insert(seq);
+}
+
+void ReorderBuffer::finished(Frame &&frame, const std::function<void(const Frame &)> &publish)
+{
+    std::unique_lock<std::mutex> l(mutex);
+    pending.erase(frame.seq);
+
+    // A later frame was published while this one was still being processed
+    if (frame.seq < next_seq)
+    {
+        late++;
+        release(publish);
+        return;
+    }
+
+    auto earlier = pending.lower_bound(next_seq);
+    if (earlier != pending.end() && *earlier < frame.seq)
+        held++;
+    Waiting &w = waiting[frame.seq];
+    w.frame = std::move(frame);
+    w.since = clock::now();
+    release(publish);
+}
+
+void ReorderBuffer::abandoned(unsigned long seq, const std::function<void(const Frame &)> &publish)
+{
+    std::unique_lock<std::mutex> l(mutex);
+    pending.erase(seq);
+    release(publish);
+}
+
+void ReorderBuffer::release(const std::function<void(const Frame &)> &publish)
+{
+    clock::time_point now = clock::now();
+    while (!waiting.empty())
+    {
+        auto oldest = waiting.begin();
+        double waited = std::chrono::duration<double>(now - oldest->second.since).count();
+
+        // Frames still in progress before the oldest finished one hold it back
+        // until it waited too long, frames that are late already do not
+        auto earlier = pending.lower_bound(next_seq);
+        if (earlier != pending.end() && *earlier < oldest->first && waited < max_wait)
+            break;
+
+        // Taken out first, a publish that throws must not come back with the next release
+        Frame frame = std::move(oldest->second.frame);
+        next_seq = oldest->first + 1;
+        waiting.erase(oldest);
+        wait_sum += waited;
+        wait_max = std::max(wait_max, waited);
+        wait_count++;
+        publish(frame);
+    }
+}
+
+ReorderBuffer::Stats ReorderBuffer::stats()
+{
+    std::unique_lock<std::mutex> l(mutex);
+    Stats s;
+    s.held = held;
+    s.late = late;
+    s.wait_mean = wait_count ? wait_sum / wait_count : 0;
+    s.wait_max = wait_max;
+
+    wait_sum = wait_max = 0;
+    wait_count = 0;
+    return s;
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <opencv2/core.hpp>
+
+#include <chrono>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <set>
+#include <vector>
+
+#include "FaceWarp.h"
+
+// Puts the frames of one camera back in capture order when several workers
+// process them at once. A finished frame is published as soon as no earlier
+// frame is still being processed. When an earlier frame keeps it waiting for
+// longer than max_wait, it is published anyway. The late frame is dropped
+// when it finishes, so the output never goes back in time. The wait is
+// checked whenever a frame of the camera finishes.
+class ReorderBuffer
+{
+public:
+    typedef std::chrono::steady_clock clock;
+
+    struct Frame
+    {
+        unsigned long seq = 0;
+        cv::Mat frame;
+        std::vector<FacePatch> patches;
+        clock::time_point captureTime;
+    };
+
+    struct Stats
+    {
+        unsigned long held = 0, late = 0;
+        // Seconds the frames published since the last call waited for earlier ones
+        double wait_mean = 0, wait_max = 0;
+    };
+
+    explicit ReorderBuffer(double max_wait_seconds);
+
+    // A worker took frame seq. Frames have to be scheduled in capture order.
+    void scheduled(unsigned long seq);
+
+    // Hands in a finished frame and publishes, in capture order and under the
+    // buffer's lock, every frame that is due now
+    void finished(Frame &&frame, const std::function<void(const Frame &)> &publish);
+
+    // The frame seq will not be finished, the ones after it stop waiting for it
+    void abandoned(unsigned long seq, const std::function<void(const Frame &)> &publish);
+
+    Stats stats();
+
+private:
+    struct Waiting
+    {
+        Frame frame;
+        clock::time_point since;
+    };
+
+    void release(const std::function<void(const Frame &)> &publish);
+
+    double max_wait;
+
+    std::mutex mutex;
+    std::set<unsigned long> pending;
+    std::map<unsigned long, Waiting> waiting;
+    unsigned long next_seq = 0;         // frames before it were published or dropped
+
+    unsigned long held = 0, late = 0;
+    double wait_sum = 0, wait_max = 0;
+    unsigned long wait_count = 0;
+};
@@ -0,0 +1,233 @@
+#include "ShmFrameRing.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <ctime>
+#include <new>
+
+static_assert(sizeof(ShmRingHeader) <= SHM_RING_HEADER_SIZE, "ring header does not fit its padding");
+static_assert(sizeof(ShmSlotHeader) <= SHM_SLOT_HEADER_SIZE, "slot header does not fit its padding");
+
+static int64_t monotonicNanos()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+ShmFrameWriter::ShmFrameWriter()
+{
+}
+
+ShmFrameWriter::~ShmFrameWriter()
+{
+    destroy();
+}
+
+bool ShmFrameWriter::create(const std::string &name, uint32_t slot_count, uint32_t slot_capacity)
+{
+    destroy();
+
+    if (slot_count < 2)
+        slot_count = 2;
+
+    // Readers still holding an old object keep it, new readers find the new one
+    shm_unlink(name.c_str());
+    int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+    if (fd < 0)
+        return false;
+
+    uint32_t slot_stride = (uint32_t)((SHM_SLOT_HEADER_SIZE + slot_capacity + 63) & ~(size_t)63);
+    size_t size = SHM_RING_HEADER_SIZE + (size_t)slot_count * slot_stride;
+    if (ftruncate(fd, size) != 0)
+    {
+        ::close(fd);
+        shm_unlink(name.c_str());
+        return false;
+    }
+
+    void *p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED)
+    {
+        shm_unlink(name.c_str());
+        return false;
+    }
+
+    // The object starts out zeroed, so every slot lock is even and no frame is published
+    this->name = name;
+    base = static_cast<unsigned char *>(p);
+    mapped = size;
+    header = new (base) ShmRingHeader();
+    header->slot_count = slot_count;
+    header->slot_capacity = slot_capacity;
+    header->slot_stride = slot_stride;
+    header->latest_slot.store(0, std::memory_order_relaxed);
+    header->frames_published.store(0, std::memory_order_relaxed);
+    for (uint32_t i = 0; i < slot_count; i++)
+        new (base + SHM_RING_HEADER_SIZE + (size_t)i * slot_stride) ShmSlotHeader();
+    header->version = SHM_RING_VERSION;
+
+    // The magic goes in last, readers that see it also see the fields above
+    header->magic.store(SHM_RING_MAGIC, std::memory_order_release);
+    sequence = 0;
+    return true;
+}
+
+bool ShmFrameWriter::publish(const unsigned char *data, uint32_t width, uint32_t height, uint32_t stride, ShmPixelFormat format)
+{
+    if (!header)
+        return false;
+
+    uint32_t bytes_per_pixel = format == SHM_RGBA32 ? 4 : (format == SHM_BGR24 ? 3 : 1);
+    uint32_t row = width * bytes_per_pixel;
+    if ((size_t)row * height > header->slot_capacity)
+        return false;
+
+    // The slot after the latest one is the one readers are least likely to be using
+    uint32_t slot = (uint32_t)(sequence % header->slot_count);
+    ShmSlotHeader *s = reinterpret_cast<ShmSlotHeader *>(base + SHM_RING_HEADER_SIZE + (size_t)slot * header->slot_stride);
+    unsigned char *pixels = reinterpret_cast<unsigned char *>(s) + SHM_SLOT_HEADER_SIZE;
+
+    uint32_t lock = s->lock.load(std::memory_order_relaxed);
+    s->lock.store(lock + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    s->format = format;
+    s->sequence = ++sequence;
+    s->timestamp_ns = monotonicNanos();
+    s->width = width;
+    s->height = height;
+    s->stride = row;
+    s->size = row * height;
+    if (stride == row)
+        std::memcpy(pixels, data, (size_t)row * height);
+    else
+        for (uint32_t y = 0; y < height; y++)
+            std::memcpy(pixels + (size_t)y * row, data + (size_t)y * stride, row);
+
+    s->lock.store(lock + 2, std::memory_order_release);
+    header->latest_slot.store(slot, std::memory_order_release);
+    header->frames_published.fetch_add(1, std::memory_order_release);
+    return true;
+}
+
+void ShmFrameWriter::destroy()
+{
+    if (base)
+    {
+        munmap(base, mapped);
+        shm_unlink(name.c_str());
+    }
+    base = nullptr;
+    header = nullptr;
+    mapped = 0;
+}
+
+ShmFrameReader::ShmFrameReader()
+{
+}
+
+ShmFrameReader::~ShmFrameReader()
+{
+    close();
+}
+
+bool ShmFrameReader::open(const std::string &name)
+{
+    close();
+
+    int fd = shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < SHM_RING_HEADER_SIZE)
+    {
+        ::close(fd);
+        return false;
+    }
+
+    void *p = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED)
+        return false;
+
+    base = static_cast<const unsigned char *>(p);
+    mapped = st.st_size;
+    header = reinterpret_cast<const ShmRingHeader *>(base);
+
+    // The rest of the header is only trusted once the magic is there, the
+    // producer may still be inside create()
+    bool ok = header->magic.load(std::memory_order_acquire) == SHM_RING_MAGIC;
+    ok = ok && header->version == SHM_RING_VERSION && header->slot_count > 0 &&
+         SHM_RING_HEADER_SIZE + (size_t)header->slot_count * header->slot_stride <= mapped;
+    if (!ok)
+        close();
+    return ok;
+}
+
+void ShmFrameReader::close()
+{
+    if (base)
+        munmap(const_cast<unsigned char *>(base), mapped);
+    base = nullptr;
+    header = nullptr;
+    mapped = 0;
+}
+
+bool ShmFrameReader::latest(ShmFrame &frame)
+{
+    if (!header || header->frames_published.load(std::memory_order_acquire) == 0)
+        return false;
+
+    uint32_t slot = header->latest_slot.load(std::memory_order_acquire);
+    const ShmSlotHeader *s = slotAt(slot);
+
+    uint32_t lock = s->lock.load(std::memory_order_acquire);
+    if (lock & 1)
+        return false;
+
+    ShmFrame f;
+    f.sequence = s->sequence;
+    f.timestamp_ns = s->timestamp_ns;
+    f.width = s->width;
+    f.height = s->height;
+    f.stride = s->stride;
+    f.format = s->format;
+    f.size = s->size;
+    f.data = reinterpret_cast<const unsigned char *>(s) + SHM_SLOT_HEADER_SIZE;
+    f.slot = slot;
+    f.lock = lock;
+
+    // The fields are only good when the producer did not start over on the slot meanwhile
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (s->lock.load(std::memory_order_relaxed) != lock || f.size > header->slot_capacity)
+        return false;
+
+    frame = f;
+    return true;
+}
+
+bool ShmFrameReader::valid(const ShmFrame &frame) const
+{
+    if (!header || frame.slot >= header->slot_count)
+        return false;
+
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return slotAt(frame.slot)->lock.load(std::memory_order_relaxed) == frame.lock;
+}
+
+uint32_t ShmFrameReader::framesPublished() const
+{
+    return header ? header->frames_published.load(std::memory_order_acquire) : 0;
+}
+
+const ShmSlotHeader *ShmFrameReader::slotAt(uint32_t slot) const
+{
+    return reinterpret_cast<const ShmSlotHeader *>(base + SHM_RING_HEADER_SIZE + (size_t)slot * header->slot_stride);
+}
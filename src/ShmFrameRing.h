@@ -0,0 +1,122 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Processed frames shared with other processes through a named POSIX shared
+// memory object (shm_open, link with -lrt on older glibc). The object holds a
+// ring of slots; the producer writes every frame into the next slot and never
+// waits for readers. Each slot is guarded by a sequence lock: the producer
+// makes its counter odd while it writes and even again when the frame is
+// complete. Readers use the pixels in place and check afterwards that the
+// counter did not move, so any number of readers map the frames without
+// copies or locks.
+//
+// Only fixed size fields are used and the header carries a version, the
+// layout is shared by every process on the box. This header does not depend
+// on OpenCV so that other programs can use the reader as it is.
+
+enum ShmPixelFormat : uint32_t
+{
+    SHM_BGR24 = 1,
+    SHM_RGBA32 = 2,
+    SHM_GRAY8 = 3
+};
+
+struct ShmRingHeader
+{
+    std::atomic<uint32_t> magic;            // SHM_RING_MAGIC, stored last once the header is complete
+    uint32_t version;                       // SHM_RING_VERSION
+    uint32_t slot_count;
+    uint32_t slot_capacity;                 // bytes of pixel data a slot holds
+    uint32_t slot_stride;                   // bytes from one slot to the next, slot header included
+    uint32_t reserved;
+    std::atomic<uint32_t> latest_slot;      // slot of the newest complete frame
+    std::atomic<uint32_t> frames_published; // 0 until the first frame is in
+};
+
+struct ShmSlotHeader
+{
+    std::atomic<uint32_t> lock;             // odd while the producer writes the slot
+    uint32_t format;                        // ShmPixelFormat
+    uint64_t sequence;                      // frame number, starting at 1
+    int64_t timestamp_ns;                   // CLOCK_MONOTONIC when the frame was published
+    uint32_t width, height;
+    uint32_t stride;                        // bytes per row
+    uint32_t size;                          // bytes of pixel data, stride * height
+};
+
+static const uint32_t SHM_RING_MAGIC = 0x474e5246;   // "FRNG"
+static const uint32_t SHM_RING_VERSION = 1;
+
+// Headers are padded to a cache line so the pixel data is aligned
+static const size_t SHM_RING_HEADER_SIZE = 64;
+static const size_t SHM_SLOT_HEADER_SIZE = 64;
+
+// One frame as seen by a reader, points into the shared memory
+struct ShmFrame
+{
+    uint64_t sequence = 0;
+    int64_t timestamp_ns = 0;
+    uint32_t width = 0, height = 0, stride = 0, format = 0, size = 0;
+    const unsigned char *data = nullptr;
+
+    uint32_t slot = 0;
+    uint32_t lock = 0;
+};
+
+// Creates the shared memory object and publishes frames into it
+class ShmFrameWriter
+{
+public:
+    ShmFrameWriter();
+    ~ShmFrameWriter();
+
+    // name is a POSIX shm name like /faceswap, an existing object is replaced
+    bool create(const std::string &name, uint32_t slot_count, uint32_t slot_capacity);
+
+    // Copies one frame into the next slot, false when it does not fit a slot
+    bool publish(const unsigned char *data, uint32_t width, uint32_t height, uint32_t stride, ShmPixelFormat format);
+
+    // Unmaps and removes the object, readers keep what they mapped
+    void destroy();
+
+    uint32_t capacity() const { return header ? header->slot_capacity : 0; }
+
+private:
+    std::string name;
+    unsigned char *base = nullptr;
+    size_t mapped = 0;
+    ShmRingHeader *header = nullptr;
+    uint64_t sequence = 0;
+};
+
+// Maps an existing ring read only
+class ShmFrameReader
+{
+public:
+    ShmFrameReader();
+    ~ShmFrameReader();
+
+    bool open(const std::string &name);
+    void close();
+
+    // Newest complete frame, false when there is none yet or it was being replaced
+    bool latest(ShmFrame &frame);
+
+    // True while the pixels of frame have not been overwritten. Call it after
+    // using frame.data; a false result means the data read may be torn.
+    bool valid(const ShmFrame &frame) const;
+
+    // Frames published since the ring was created
+    uint32_t framesPublished() const;
+
+private:
+    const ShmSlotHeader *slotAt(uint32_t slot) const;
+
+    const unsigned char *base = nullptr;
+    size_t mapped = 0;
+    const ShmRingHeader *header = nullptr;
+};
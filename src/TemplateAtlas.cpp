@@ -0,0 +1,345 @@
+#include "TemplateAtlas.h"
+
+#include <opencv2/imgproc.hpp>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+#include "FaceWarp.h"
+
+static const char ATLAS_MAGIC[4] = {'F', 'S', 'T', 'A'};
+static const uint32_t ATLAS_VERSION = 2;
+static const size_t ATLAS_HEADER_SIZE = 16;
+
+// Data blocks start on a cache line
+static const size_t ATLAS_ALIGNMENT = 64;
+
+size_t TemplateAtlas::Template::bytes() const
+{
+    size_t total = image.total() * image.elemSize() + hull_mask.total();
+    total += points.size() * sizeof(cv::Point2f) + hull.size() * sizeof(int32_t);
+    total += triangles.size() * (sizeof(cv::Vec3i) + sizeof(cv::Rect));
+    for (const cv::Mat &mask : triangle_masks)
+        total += mask.total();
+    return total;
+}
+
+TemplateAtlas::~TemplateAtlas()
+{
+    if (base)
+        munmap(const_cast<unsigned char *>(base), length);
+}
+
+bool TemplateAtlas::prepare(const std::string &name, const cv::Mat &image, const std::vector<cv::Point2f> &landmarks, Template &t)
+{
+    if (image.empty() || image.type() != CV_8UC3 || landmarks.size() != 68)
+        return false;
+
+    t = Template();
+    t.name = name;
+    t.image = image;
+    t.points = landmarks;
+
+    // The forehead above the eyebrows, as face_dlib adds it to the camera's face
+    std::vector<cv::Point2f> &p = t.points;
+    p.push_back(cv::Point2f((p[5].x + p[18].x) / 2, p[18].y - 0.25 * (p[5].y - p[18].y)));
+    p.push_back(cv::Point2f((p[8].x + p[27].x) / 2, p[27].y - 0.25 * (p[8].y - p[27].y)));
+    p.push_back(cv::Point2f((p[11].x + p[25].x) / 2, p[25].y - 0.25 * (p[11].y - p[25].y)));
+
+    std::vector<cv::Point2f> hull;
+    cv::convexHull(t.points, t.hull, false, false);
+    for (int index : t.hull)
+        hull.push_back(t.points[index]);
+
+    cv::Rect imageRect(0, 0, image.cols, image.rows);
+    std::vector<std::vector<int>> dt;
+    calculateDelaunayTriangles(imageRect, hull, dt);
+
+    // The same masks warpTriangle fills for every frame
+    for (const std::vector<int> &tri : dt)
+    {
+        cv::Point2f corners[3] = {hull[tri[0]], hull[tri[1]], hull[tri[2]]};
+        // Rounded out, a box can reach one pixel past the image
+        cv::Rect r = cv::boundingRect(std::vector<cv::Point2f>(corners, corners + 3)) & imageRect;
+        if (r.area() == 0)
+            return false;
+        cv::Point local[3];
+        for (int j = 0; j < 3; j++)
+            local[j] = cv::Point(corners[j].x - r.x, corners[j].y - r.y);
+
+        cv::Mat mask(r.size(), CV_8UC1, cv::Scalar(0));
+        cv::fillConvexPoly(mask, local, 3, cv::Scalar(255), 16, 0);
+
+        t.triangles.push_back(cv::Vec3i(tri[0], tri[1], tri[2]));
+        t.triangle_rects.push_back(r);
+        t.triangle_masks.push_back(mask);
+    }
+
+    std::vector<cv::Point> hull8U;
+    for (const cv::Point2f &h : hull)
+        hull8U.push_back(cv::Point(h.x, h.y));
+    t.hull_rect = cv::boundingRect(hull8U) & imageRect;
+    if (t.hull_rect.area() == 0)
+        return false;
+    for (cv::Point &h : hull8U)
+        h -= t.hull_rect.tl();
+    t.hull_mask = cv::Mat(t.hull_rect.size(), CV_8UC1, cv::Scalar(0));
+    cv::fillConvexPoly(t.hull_mask, hull8U.data(), hull8U.size(), cv::Scalar(255));
+    return true;
+}
+
+// Pads out to the next block and returns where the block starts
+static uint64_t startBlock(std::ofstream &out)
+{
+    static const char zeros[ATLAS_ALIGNMENT] = {};
+    uint64_t position = out.tellp();
+    size_t padding = (ATLAS_ALIGNMENT - position % ATLAS_ALIGNMENT) % ATLAS_ALIGNMENT;
+    out.write(zeros, padding);
+    return position + padding;
+}
+
+static void writeRows(std::ofstream &out, const cv::Mat &m)
+{
+    for (int y = 0; y < m.rows; y++)
+        out.write(m.ptr<char>(y), m.cols * m.elemSize());
+}
+
+bool TemplateAtlas::write(const std::string &path, const std::vector<Template> &templates)
+{
+    std::ofstream out(path.c_str(), std::ios::binary | std::ios::trunc);
+    if (!out)
+    {
+        std::cerr << "Unable to write the atlas " << path << std::endl;
+        return false;
+    }
+
+    uint32_t header[3] = {ATLAS_VERSION, (uint32_t)templates.size(), 0};
+    out.write(ATLAS_MAGIC, 4);
+    out.write(reinterpret_cast<const char *>(header), sizeof(header));
+
+    // The table goes in once the offsets are known
+    std::vector<Entry> table(templates.size());
+    out.write(reinterpret_cast<const char *>(table.data()), table.size() * sizeof(Entry));
+
+    for (size_t i = 0; i < templates.size(); i++)
+    {
+        const Template &t = templates[i];
+        Entry &e = table[i];
+        std::memset(&e, 0, sizeof(e));
+        std::strncpy(e.name, t.name.c_str(), sizeof(e.name) - 1);
+        e.width = t.image.cols;
+        e.height = t.image.rows;
+        e.point_count = t.points.size();
+        e.hull_count = t.hull.size();
+        e.triangle_count = t.triangles.size();
+        e.hull_rect[0] = t.hull_rect.x;
+        e.hull_rect[1] = t.hull_rect.y;
+        e.hull_rect[2] = t.hull_rect.width;
+        e.hull_rect[3] = t.hull_rect.height;
+
+        e.pixels = startBlock(out);
+        writeRows(out, t.image);
+        e.points = startBlock(out);
+        out.write(reinterpret_cast<const char *>(t.points.data()), t.points.size() * sizeof(cv::Point2f));
+        e.hull = startBlock(out);
+        for (int index : t.hull)
+        {
+            int32_t v = index;
+            out.write(reinterpret_cast<const char *>(&v), sizeof(v));
+        }
+        e.triangles = startBlock(out);
+        for (const cv::Vec3i &tri : t.triangles)
+        {
+            int32_t v[3] = {tri[0], tri[1], tri[2]};
+            out.write(reinterpret_cast<const char *>(v), sizeof(v));
+        }
+        e.triangle_rects = startBlock(out);
+        for (const cv::Rect &r : t.triangle_rects)
+        {
+            int32_t v[4] = {r.x, r.y, r.width, r.height};
+            out.write(reinterpret_cast<const char *>(v), sizeof(v));
+        }
+        e.triangle_masks = startBlock(out);
+        for (const cv::Mat &mask : t.triangle_masks)
+            writeRows(out, mask);
+        e.hull_mask = startBlock(out);
+        writeRows(out, t.hull_mask);
+        e.end = out.tellp();
+    }
+
+    out.seekp(ATLAS_HEADER_SIZE);
+    out.write(reinterpret_cast<const char *>(table.data()), table.size() * sizeof(Entry));
+    out.close();
+    if (!out)
+    {
+        std::cerr << "Writing the atlas " << path << " failed" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool TemplateAtlas::valid(const Entry &e) const
+{
+    auto fits = [&e](uint64_t offset, uint64_t bytes) { return offset <= e.end && bytes <= e.end - offset; };
+    // A non-empty box inside the image, without the int arithmetic of cv::Rect
+    auto inside = [&e](const int32_t *box)
+    {
+        return box[0] >= 0 && box[1] >= 0 && box[2] > 0 && box[3] > 0 &&
+               (int64_t)box[0] + box[2] <= e.width && (int64_t)box[1] + box[3] <= e.height;
+    };
+
+    if (e.end > length || e.width <= 0 || e.height <= 0 || e.point_count != TEMPLATE_POINTS || e.name[sizeof(e.name) - 1] != 0)
+        return false;
+    if (!inside(e.hull_rect))
+        return false;
+    // Counts come from the file, the sizes are worked out in 64 bits so that
+    // they cannot wrap around on 32 bit machines
+    if (!fits(e.pixels, (uint64_t)e.width * e.height * 3) || !fits(e.points, (uint64_t)e.point_count * sizeof(cv::Point2f)) ||
+        !fits(e.hull, (uint64_t)e.hull_count * sizeof(int32_t)) || !fits(e.triangles, (uint64_t)e.triangle_count * 3 * sizeof(int32_t)) ||
+        !fits(e.triangle_rects, (uint64_t)e.triangle_count * 4 * sizeof(int32_t)) ||
+        !fits(e.hull_mask, (uint64_t)e.hull_rect[2] * e.hull_rect[3]))
+        return false;
+
+    // Indices and triangle boxes are small, they are checked here so get() and
+    // the warp can trust them
+    const int32_t *hull = reinterpret_cast<const int32_t *>(base + e.hull);
+    for (uint32_t i = 0; i < e.hull_count; i++)
+        if (hull[i] < 0 || hull[i] >= (int32_t)e.point_count)
+            return false;
+    const int32_t *triangles = reinterpret_cast<const int32_t *>(base + e.triangles);
+    for (uint64_t i = 0; i < (uint64_t)e.triangle_count * 3; i++)
+        if (triangles[i] < 0 || triangles[i] >= (int32_t)e.hull_count)
+            return false;
+    const int32_t *rects = reinterpret_cast<const int32_t *>(base + e.triangle_rects);
+    uint64_t masks = 0;
+    for (uint32_t i = 0; i < e.triangle_count; i++, rects += 4)
+    {
+        if (!inside(rects))
+            return false;
+        masks += (uint64_t)rects[2] * rects[3];
+    }
+    return fits(e.triangle_masks, masks);
+}
+
+bool TemplateAtlas::open(const std::string &path)
+{
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        std::cerr << "Unable to open the atlas " << path << ": " << std::strerror(errno) << std::endl;
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < ATLAS_HEADER_SIZE)
+    {
+        std::cerr << path << " is not a template atlas" << std::endl;
+        ::close(fd);
+        return false;
+    }
+    void *p = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED)
+    {
+        std::cerr << "Unable to map the atlas " << path << ": " << std::strerror(errno) << std::endl;
+        return false;
+    }
+    base = static_cast<const unsigned char *>(p);
+    length = st.st_size;
+
+    uint32_t header[3];
+    std::memcpy(header, base + 4, sizeof(header));
+    bool ok = std::memcmp(base, ATLAS_MAGIC, 4) == 0 && header[0] == ATLAS_VERSION &&
+              header[1] <= (length - ATLAS_HEADER_SIZE) / sizeof(Entry);
+    if (ok)
+    {
+        entries.resize(header[1]);
+        std::memcpy(entries.data(), base + ATLAS_HEADER_SIZE, entries.size() * sizeof(Entry));
+        for (const Entry &e : entries)
+            ok = ok && valid(e);
+    }
+    if (!ok)
+    {
+        std::cerr << path << " is not a template atlas of version " << ATLAS_VERSION << " or it is damaged" << std::endl;
+        munmap(p, length);
+        base = nullptr;
+        length = 0;
+        entries.clear();
+        return false;
+    }
+    opened.clear();
+    opened.resize(entries.size());
+    return true;
+}
+
+const TemplateAtlas::Template &TemplateAtlas::get(size_t i)
+{
+    CV_Assert(i < entries.size());
+    if (opened[i])
+        return *opened[i];
+
+    // Only the headers are made here, the pixels are read when they are used.
+    // The mapping is read only, so are the Mats.
+    const Entry &e = entries[i];
+    unsigned char *data = const_cast<unsigned char *>(base);
+    std::unique_ptr<Template> t(new Template());
+    t->name = e.name;
+    t->image = cv::Mat(e.height, e.width, CV_8UC3, data + e.pixels);
+
+    const cv::Point2f *points = reinterpret_cast<const cv::Point2f *>(base + e.points);
+    t->points.assign(points, points + e.point_count);
+    const int32_t *hull = reinterpret_cast<const int32_t *>(base + e.hull);
+    t->hull.assign(hull, hull + e.hull_count);
+
+    const int32_t *triangles = reinterpret_cast<const int32_t *>(base + e.triangles);
+    const int32_t *rects = reinterpret_cast<const int32_t *>(base + e.triangle_rects);
+    unsigned char *mask = data + e.triangle_masks;
+    for (uint32_t k = 0; k < e.triangle_count; k++, triangles += 3, rects += 4)
+    {
+        cv::Rect r(rects[0], rects[1], rects[2], rects[3]);
+        t->triangles.push_back(cv::Vec3i(triangles[0], triangles[1], triangles[2]));
+        t->triangle_rects.push_back(r);
+        t->triangle_masks.push_back(cv::Mat(r.size(), CV_8UC1, mask));
+        mask += r.area();
+    }
+
+    t->hull_rect = cv::Rect(e.hull_rect[0], e.hull_rect[1], e.hull_rect[2], e.hull_rect[3]);
+    t->hull_mask = cv::Mat(t->hull_rect.size(), CV_8UC1, data + e.hull_mask);
+
+    opened[i] = std::move(t);
+    return *opened[i];
+}
+
+void TemplateAtlas::prefetch(size_t i) const
+{
+    if (i >= entries.size())
+        return;
+    long page = sysconf(_SC_PAGESIZE);
+    uint64_t start = entries[i].pixels & ~(uint64_t)(page - 1);
+    madvise(const_cast<unsigned char *>(base) + start, entries[i].end - start, MADV_WILLNEED);
+}
+
+TemplateAtlas::Stats TemplateAtlas::stats() const
+{
+    Stats s;
+    s.templates = entries.size();
+    s.mapped = length;
+    for (const auto &t : opened)
+        if (t)
+            s.opened++;
+
+    // Pages of the mapping that are in memory right now
+    long page = sysconf(_SC_PAGESIZE);
+    std::vector<unsigned char> in_core((length + page - 1) / page);
+    if (base && mincore(const_cast<unsigned char *>(base), length, in_core.data()) == 0)
+        for (unsigned char c : in_core)
+            if (c & 1)
+                s.resident += page;
+    return s;
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <opencv2/core.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Template faces of face_dlib packed into one file that is memory mapped,
+// with everything about a template that does not depend on the camera frame
+// worked out when the atlas is built: landmarks with the forehead points,
+// convex hull, Delaunay triangles over the hull, the bounding box and
+// anti-aliased mask of each triangle and the hull mask.
+//
+// Opening an atlas only reads the table of contents. A template's pixels
+// and masks are Mats over the mapping, paged in by the kernel when they are
+// first touched, so switching templates is an index change. prefetch() asks
+// for the pages of the template that comes next ahead of time.
+//
+// The file is written in the byte order of the machine that builds it:
+//
+//   header: char magic[4] "FSTA", uint32 version, uint32 count, uint32 reserved
+//   count entries of TemplateAtlas::Entry
+//   the data blocks of every template, each aligned to 64 bytes
+//
+// An atlas is not thread-safe.
+class TemplateAtlas
+{
+public:
+    // Landmarks of the template and the three forehead points derived from them
+    static const int TEMPLATE_POINTS = 71;
+
+    struct Template
+    {
+        std::string name;
+        cv::Mat image;                          // BGR
+        std::vector<cv::Point2f> points;        // TEMPLATE_POINTS
+        std::vector<int> hull;                  // indices into points
+        std::vector<cv::Vec3i> triangles;       // indices into hull
+        std::vector<cv::Rect> triangle_rects;   // bounding box of each triangle in image
+        std::vector<cv::Mat> triangle_masks;    // CV_8UC1 over triangle_rects, anti-aliased
+        cv::Rect hull_rect;
+        cv::Mat hull_mask;                      // CV_8UC1 over hull_rect
+
+        // Bytes of the template in the atlas
+        size_t bytes() const;
+    };
+
+    struct Stats
+    {
+        unsigned int templates = 0, opened = 0;
+        size_t mapped = 0, resident = 0;        // bytes of the file mapped and in memory
+    };
+
+    TemplateAtlas() {}
+    ~TemplateAtlas();
+
+    TemplateAtlas(const TemplateAtlas &) = delete;
+    TemplateAtlas &operator=(const TemplateAtlas &) = delete;
+
+    // Works out the geometry of a template from its image and its 68 landmarks
+    static bool prepare(const std::string &name, const cv::Mat &image, const std::vector<cv::Point2f> &landmarks, Template &t);
+
+    // Writes templates into an atlas file
+    static bool write(const std::string &path, const std::vector<Template> &templates);
+
+    // Maps an atlas file, false with the reason on stderr when it is not one
+    bool open(const std::string &path);
+
+    size_t size() const { return entries.size(); }
+
+    // Template i, its Mats point into the mapping and stay valid as long as the atlas
+    const Template &get(size_t i);
+
+    // Has the kernel read template i in the background
+    void prefetch(size_t i) const;
+
+    Stats stats() const;
+
+    struct Entry
+    {
+        char name[48];
+        int32_t width, height;
+        uint32_t point_count, hull_count, triangle_count, reserved;
+        int32_t hull_rect[4];
+        // Offsets from the start of the file
+        uint64_t pixels, points, hull, triangles, triangle_rects, triangle_masks, hull_mask;
+        uint64_t end;
+    };
+
+private:
+    bool valid(const Entry &e) const;
+
+    const unsigned char *base = nullptr;
+    size_t length = 0;
+    std::vector<Entry> entries;
+    std::vector<std::unique_ptr<Template>> opened;
+};
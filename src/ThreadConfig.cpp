@@ -0,0 +1,165 @@
+#include "ThreadConfig.h"
+
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+ThreadConfig threadConfig;
+
+ThreadConfig::ThreadConfig()
+{
+    // Only lowered by default, a negative nice needs CAP_SYS_NICE and is left to --thread
+    settings["main"].nice = 0;
+    settings["capture"].nice = 0;
+    settings["audio"].nice = 0;
+    settings["model"].nice = 5;
+    settings["render"].nice = 5;
+    settings["sink"].nice = 10;
+}
+
+bool ThreadConfig::parse(const std::string &spec)
+{
+    size_t colon = spec.find(':');
+    if (colon == std::string::npos)
+    {
+        std::cerr << "Thread settings " << spec << " need a role, e.g. capture:cpu=0,policy=fifo,prio=50" << std::endl;
+        return false;
+    }
+
+    std::string role = spec.substr(0, colon);
+    if (!settings.count(role))
+    {
+        std::cerr << "Unknown thread role " << role << ", use main, capture, model, render, audio or sink" << std::endl;
+        return false;
+    }
+
+    ThreadSettings &s = settings[role];
+    std::stringstream ss(spec.substr(colon + 1));
+    std::string field;
+    while (std::getline(ss, field, ','))
+    {
+        size_t eq = field.find('=');
+        std::string key = field.substr(0, eq);
+        std::string value = eq == std::string::npos ? "" : field.substr(eq + 1);
+
+        if (key == "cpu")
+            s.cpu = atoi(value.c_str());
+        else if (key == "policy" && value == "fifo")
+            s.policy = SCHED_FIFO;
+        else if (key == "policy" && value == "other")
+            s.policy = SCHED_OTHER;
+        else if (key == "prio")
+            s.priority = atoi(value.c_str());
+        else if (key == "nice")
+            s.nice = atoi(value.c_str());
+        else
+        {
+            std::cerr << "Unknown thread setting " << field << std::endl;
+            return false;
+        }
+    }
+
+    if (s.policy == SCHED_FIFO && s.priority <= 0)
+        s.priority = 1;
+
+    return true;
+}
+
+void ThreadConfig::apply(const std::string &role, const std::string &name)
+{
+    const ThreadSettings &s = settings[role];
+    pid_t tid = syscall(SYS_gettid);
+
+    // Shows up in top -H and /proc, the kernel limit is 15 characters
+    pthread_setname_np(pthread_self(), name.substr(0, 15).c_str());
+
+    if (s.cpu >= 0)
+    {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(s.cpu, &cpus);
+        int err = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+        if (err)
+            std::cerr << "Unable to pin " << name << " to CPU " << s.cpu << ": " << strerror(err) << std::endl;
+    }
+
+    sched_param param;
+    param.sched_priority = s.policy == SCHED_FIFO ? s.priority : 0;
+    int err = pthread_setschedparam(pthread_self(), s.policy, &param);
+    if (err)
+        std::cerr << "Unable to set the scheduling policy of " << name << ": " << strerror(err) << std::endl;
+
+    // Nice levels are per thread on Linux
+    if (s.policy == SCHED_OTHER && setpriority(PRIO_PROCESS, tid, s.nice) != 0)
+        std::cerr << "Unable to set nice " << s.nice << " for " << name << ": " << strerror(errno) << std::endl;
+}
+
+void ThreadConfig::report(std::ostream &out)
+{
+    std::unique_lock<std::mutex> l(mutex);
+
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double wall = now.tv_sec + now.tv_nsec / 1e9;
+    double interval = lastReport > 0 ? wall - lastReport : 0;
+    lastReport = wall;
+
+    static const double ticks = sysconf(_SC_CLK_TCK);
+
+    DIR *tasks = opendir("/proc/self/task");
+    if (!tasks)
+        return;
+
+    std::map<int, double> cpu;
+    out << "Threads:";
+    while (struct dirent *entry = readdir(tasks))
+    {
+        int tid = atoi(entry->d_name);
+        if (tid <= 0)
+            continue;
+
+        std::ifstream stat(std::string("/proc/self/task/") + entry->d_name + "/stat");
+        std::string line;
+        if (!std::getline(stat, line))
+            continue;
+
+        // tid (name) state ppid ... with utime and stime as the 12th and 13th field after the name
+        size_t open = line.find('('), close = line.rfind(')');
+        if (open == std::string::npos || close == std::string::npos)
+            continue;
+        std::string name = line.substr(open + 1, close - open - 1);
+        std::stringstream fields(line.substr(close + 2));
+        std::string field;
+        unsigned long utime = 0, stime = 0;
+        for (int i = 1; i <= 13 && fields >> field; i++)
+        {
+            if (i == 12)
+                utime = std::stoul(field);
+            else if (i == 13)
+                stime = std::stoul(field);
+        }
+
+        double seconds = (utime + stime) / ticks;
+        cpu[tid] = seconds;
+
+        out << " " << name << " " << std::fixed << std::setprecision(1) << seconds << " s";
+        if (interval > 0)
+            out << " (" << 100.0 * (seconds - lastCpu[tid]) / interval << " %)";
+        out << std::defaultfloat;
+    }
+    closedir(tasks);
+    out << std::endl;
+
+    lastCpu.swap(cpu);
+}
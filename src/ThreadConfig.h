@@ -0,0 +1,47 @@
+#pragma once
+
+#include <sched.h>
+
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <string>
+
+// CPU affinity and scheduling of one kind of pipeline thread
+struct ThreadSettings
+{
+    int cpu = -1;               // CPU to pin to, -1 leaves the affinity alone
+    int policy = SCHED_OTHER;   // SCHED_OTHER or SCHED_FIFO
+    int priority = 0;           // SCHED_FIFO priority, 1 to 99
+    int nice = 0;               // nice level under SCHED_OTHER
+};
+
+// Per role scheduling of the pipeline threads (main, capture, model, render,
+// audio, sink). By default capture and audio keep nice 0 while model, render
+// and sink are lowered, so model spikes do not starve them and no privilege
+// is needed. Raising a priority above that (negative nice, fifo) needs
+// CAP_SYS_NICE and is only tried when asked for.
+class ThreadConfig
+{
+public:
+    ThreadConfig();
+
+    // Parses role:key=value,... with keys cpu, policy (other|fifo), prio and nice
+    bool parse(const std::string &spec);
+
+    // Applies the settings of role to the calling thread and names it, threads
+    // it creates afterwards inherit both
+    void apply(const std::string &role, const std::string &name);
+
+    // Prints the CPU time used by every thread of the process since the previous call
+    void report(std::ostream &out);
+
+private:
+    std::map<std::string, ThreadSettings> settings;
+
+    std::mutex mutex;
+    std::map<int, double> lastCpu;      // seconds of CPU time per thread id
+    double lastReport = 0;
+};
+
+extern ThreadConfig threadConfig;
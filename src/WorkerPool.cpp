@@ -0,0 +1,123 @@
+#include "WorkerPool.h"
+
+namespace
+{
+    // Pool and index of the worker running on this thread, if any
+    thread_local const WorkerPool *current_pool = nullptr;
+    thread_local unsigned int current_index = 0;
+}
+
+WorkerPool::WorkerPool(unsigned int threads) :
+    next_worker(0), queued(0), pending(0), run_count(0), steal_count(0), fail_count(0)
+{
+    if (threads == 0)
+        threads = std::thread::hardware_concurrency();
+    if (threads == 0)
+        threads = 1;
+
+    for (unsigned int i = 0; i < threads; i++)
+        workers.emplace_back(new Worker);
+
+    for (unsigned int i = 0; i < threads; i++)
+        workers[i]->thread = std::thread(&WorkerPool::run, this, i);
+}
+
+WorkerPool::~WorkerPool()
+{
+    {
+        std::unique_lock<std::mutex> l(idle_mutex);
+        stopping = true;
+    }
+    work_available.notify_all();
+
+    for (auto &worker : workers)
+        worker->thread.join();
+}
+
+void WorkerPool::submit(Task task)
+{
+    unsigned int index = (current_pool == this) ? current_index : next_worker++ % workers.size();
+
+    pending++;
+    {
+        std::unique_lock<std::mutex> l(workers[index]->mutex);
+        workers[index]->tasks.push_back(std::move(task));
+    }
+    queued++;
+
+    std::unique_lock<std::mutex> l(idle_mutex);
+    work_available.notify_one();
+}
+
+void WorkerPool::wait()
+{
+    std::unique_lock<std::mutex> l(idle_mutex);
+    all_done.wait(l, [this] { return pending.load() == 0; });
+}
+
+bool WorkerPool::popLocal(unsigned int index, Task &task)
+{
+    Worker &worker = *workers[index];
+    std::unique_lock<std::mutex> l(worker.mutex);
+    if (worker.tasks.empty())
+        return false;
+
+    task = std::move(worker.tasks.back());
+    worker.tasks.pop_back();
+    queued--;
+    return true;
+}
+
+bool WorkerPool::steal(unsigned int index, Task &task)
+{
+    for (size_t i = 1; i < workers.size(); i++)
+    {
+        Worker &victim = *workers[(index + i) % workers.size()];
+        std::unique_lock<std::mutex> l(victim.mutex);
+        if (victim.tasks.empty())
+            continue;
+
+        // Take the oldest task, the owner keeps working on the recent ones
+        task = std::move(victim.tasks.front());
+        victim.tasks.pop_front();
+        queued--;
+        steal_count++;
+        return true;
+    }
+    return false;
+}
+
+void WorkerPool::run(unsigned int index)
+{
+    current_pool = this;
+    current_index = index;
+
+    while (true)
+    {
+        Task task;
+        if (popLocal(index, task) || steal(index, task))
+        {
+            try
+            {
+                task(index);
+            }
+            catch (...)
+            {
+                fail_count++;
+            }
+            run_count++;
+
+            if (--pending == 0)
+            {
+                std::unique_lock<std::mutex> l(idle_mutex);
+                all_done.notify_all();
+            }
+            continue;
+        }
+
+        std::unique_lock<std::mutex> l(idle_mutex);
+        work_available.wait(l, [this] { return queued.load() > 0 || stopping; });
+        if (stopping && queued.load() == 0)
+            break;
+    }
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of threads running queued tasks. Every worker has its own deque,
+// works from the back of it and steals from the front of the others when it
+// runs dry, so uneven task costs still keep all cores busy.
+class WorkerPool
+{
+public:
+    // The task gets the index of the worker running it, for per-worker state
+    typedef std::function<void(unsigned int worker)> Task;
+
+    // threads == 0 uses one thread per core
+    explicit WorkerPool(unsigned int threads = 0);
+    ~WorkerPool();
+
+    // Queues a task; tasks submitted from inside a worker go to its own deque
+    void submit(Task task);
+
+    // Blocks until every submitted task has finished
+    void wait();
+
+    unsigned int size() const { return (unsigned int)workers.size(); }
+    unsigned long tasksRun() const { return run_count.load(); }
+    unsigned long tasksStolen() const { return steal_count.load(); }
+    // Tasks that ended with an exception, which the pool swallows so the worker and wait() carry on
+    unsigned long tasksFailed() const { return fail_count.load(); }
+
+private:
+    struct Worker
+    {
+        std::deque<Task> tasks;
+        std::mutex mutex;
+        std::thread thread;
+    };
+
+    void run(unsigned int index);
+    bool popLocal(unsigned int index, Task &task);
+    bool steal(unsigned int index, Task &task);
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::atomic_uint next_worker;
+    std::atomic_long queued, pending;
+    std::atomic_ulong run_count, steal_count, fail_count;
+
+    std::mutex idle_mutex;
+    std::condition_variable work_available, all_done;
+    bool stopping = false;
+};
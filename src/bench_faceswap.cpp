@@ -0,0 +1,925 @@
+/*
+
+    Microbenchmarks for every step of FaceSwapper and for the warp and blend
+    helpers of sfml.cpp (FaceWarp.h), one benchmark per stage and face size.
+
+    The harness follows Google Benchmark: a benchmark is a function that runs
+    its stage in a while (state.keepRunning()) loop, is registered with
+    BENCHMARK(BM_stage, sizes...) and gets the face size as state.range().
+    The iteration count grows until a run takes --min-time seconds. Work that
+    only restores the inputs of a stage runs between pauseTiming() and
+    resumeTiming().
+
+    Inputs are synthetic and the same on every run and machine: an 800x600
+    frame (the size sfml processes) with two drawn faces of the given size
+    and 68 landmarks laid out like the dlib model's. getFacePoints needs the
+    real model and only runs with --landmarks=shape_predictor_68_face_landmarks.dat,
+    as do the landmark benchmarks that compare prediction at full resolution
+    with prediction on the shrunk pyramid level (FaceLandmarks.h). The latter
+    also report how far their landmarks land from the full resolution ones.
+    getFacePoints also runs with the 5 point model, to compare the layouts.
+
+    Drawn faces say little about how well the model does on a shrunk face,
+    so --images=<dir> adds predictLandmarksImages: the faces the HOG detector
+    finds in the photos of dir, predicted at each target width and compared
+    with the prediction at full resolution.
+
+    Results are written as JSON in the layout of Google Benchmark's
+    --benchmark_format=json, so runs on armhf and x86-64 can be compared with
+    the usual tools:
+
+        bench_faceswap --out=x86.json
+        bench_faceswap --filter=warpTriangle --min-time=2
+        bench_faceswap --kernels=generic --out=x86-generic.json
+        bench_faceswap --landmarks=shape_predictor_68_face_landmarks.dat --filter=predictLandmarks
+        bench_faceswap --landmarks=shape_predictor_68_face_landmarks.dat --images=faces --filter=Images
+
+*/
+
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/imgproc.hpp>
+
+#include <dlib/opencv.h>
+#include <dlib/image_processing.h>
+#include <dlib/image_processing/frontal_face_detector.h>
+
+#include <dirent.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <ctime>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "FaceLandmarks.h"
+#include "FaceMesh.h"
+#include "FaceSwapper.h"
+#include "FaceWarp.h"
+#include "FramePyramid.h"
+#include "ImageKernels.h"
+
+using namespace std;
+
+// ----------------------------------------------------------------------------------------
+// Harness
+
+static double threadCpuSeconds()
+{
+    timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+class BenchState
+{
+public:
+    typedef std::chrono::steady_clock clock;
+
+    BenchState(int arg, size_t iterations) :
+        arg(arg), remaining(iterations), iterations(iterations)
+    {
+    }
+
+    // True as long as the timed loop has to go on
+    bool keepRunning()
+    {
+        if (!started)
+        {
+            started = true;
+            resumeTiming();
+        }
+        if (remaining == 0)
+        {
+            pauseTiming();
+            return false;
+        }
+        remaining--;
+        return true;
+    }
+
+    void pauseTiming()
+    {
+        real += std::chrono::duration<double>(clock::now() - real_start).count();
+        cpu += threadCpuSeconds() - cpu_start;
+    }
+
+    void resumeTiming()
+    {
+        real_start = clock::now();
+        cpu_start = threadCpuSeconds();
+    }
+
+    int range() const { return arg; }
+
+    // Items handled per iteration, reported as items_per_second
+    void setItemsProcessed(size_t items) { items_processed = items; }
+
+    // Extra result of the benchmark, written next to the timings
+    void setCounter(const string &name, double value) { counters[name] = value; }
+
+    // Skips the benchmark, for inputs that are not available
+    void skip(const string &reason) { skipped = reason; remaining = 0; }
+
+    int arg;
+    size_t remaining, iterations;
+    bool started = false;
+    clock::time_point real_start;
+    double cpu_start = 0;
+    double real = 0, cpu = 0;
+    size_t items_processed = 0;
+    std::map<string, double> counters;
+    string skipped;
+};
+
+struct Benchmark
+{
+    string name;
+    std::function<void(BenchState &)> function;
+    std::vector<int> args;
+};
+
+static std::vector<Benchmark> &benchmarks()
+{
+    static std::vector<Benchmark> registry;
+    return registry;
+}
+
+static bool registerBenchmark(const string &name, std::function<void(BenchState &)> function, std::vector<int> args)
+{
+    benchmarks().push_back(Benchmark{ name, function, args });
+    return true;
+}
+
+// Benchmarks are named after their function without the BM_ prefix
+#define BENCHMARK(function, ...) static bool function##_registered = registerBenchmark(string(#function).substr(3), function, { __VA_ARGS__ })
+
+// Face sizes in pixels, from a face across the room to one filling a third of the frame
+#define FACE_SIZES 48, 96, 160, 240
+
+// ----------------------------------------------------------------------------------------
+// Synthetic inputs
+
+static const cv::Size FRAME_SIZE(800, 600);
+
+static bool haveLandmarkModel = false;
+static dlib::shape_predictor landmarkModel;
+
+// Landmark positions of the 68 point layout in a unit face box
+static std::vector<cv::Point2f> unitLandmarks()
+{
+    std::vector<cv::Point2f> p;
+    const double pi = 3.14159265358979;
+
+    for (int i = 0; i < 17; i++)                    // jaw, left to right under the chin
+    {
+        double a = pi - i * pi / 16;
+        p.push_back(cv::Point2f(0.5 + 0.48 * std::cos(a), 0.35 + 0.6 * std::sin(a)));
+    }
+    for (int i = 0; i < 5; i++)                     // left brow
+        p.push_back(cv::Point2f(0.15 + 0.065 * i, 0.25 - 0.03 * std::sin(i * pi / 4)));
+    for (int i = 0; i < 5; i++)                     // right brow
+        p.push_back(cv::Point2f(0.59 + 0.065 * i, 0.25 - 0.03 * std::sin(i * pi / 4)));
+    for (int i = 0; i < 4; i++)                     // nose bridge
+        p.push_back(cv::Point2f(0.5, 0.35 + 0.065 * i));
+    for (int i = 0; i < 5; i++)                     // lower nose
+        p.push_back(cv::Point2f(0.4 + 0.05 * i, 0.6 + 0.02 * std::sin(i * pi / 4)));
+    for (int e = 0; e < 2; e++)                     // eyes
+    {
+        double cx = e == 0 ? 0.3 : 0.7;
+        for (int i = 0; i < 6; i++)
+            p.push_back(cv::Point2f(cx - 0.07 * std::cos(i * pi / 3), 0.38 - 0.03 * std::sin(i * pi / 3)));
+    }
+    for (int i = 0; i < 12; i++)                    // outer lip
+        p.push_back(cv::Point2f(0.5 - 0.17 * std::cos(i * pi / 6), 0.78 - 0.07 * std::sin(i * pi / 6)));
+    for (int i = 0; i < 8; i++)                     // inner lip
+        p.push_back(cv::Point2f(0.5 - 0.1 * std::cos(i * pi / 4), 0.78 - 0.03 * std::sin(i * pi / 4)));
+
+    return p;
+}
+
+static std::vector<cv::Point2f> landmarksIn(const cv::Rect &face, cv::RNG &rng)
+{
+    std::vector<cv::Point2f> points;
+    for (const cv::Point2f &u : unitLandmarks())
+    {
+        // A little jitter so the two faces are not exact copies
+        float x = face.x + (u.x + (float)rng.uniform(-0.01, 0.01)) * face.width;
+        float y = face.y + (u.y + (float)rng.uniform(-0.01, 0.01)) * face.height;
+        points.push_back(cv::Point2f(x, y));
+    }
+    return points;
+}
+
+static void drawFace(cv::Mat &frame, const cv::Rect &face, const cv::Scalar &skin, cv::RNG &rng)
+{
+    cv::Point centre(face.x + face.width / 2, face.y + face.height * 45 / 100);
+    cv::ellipse(frame, centre, cv::Size(face.width / 2, face.height * 6 / 10), 0, 0, 360, skin, -1);
+
+    // Blotches give the colour histograms something to work with
+    for (int i = 0; i < 40; i++)
+    {
+        // One draw per statement, argument evaluation order differs between compilers
+        int x = rng.uniform(0, face.width);
+        int y = rng.uniform(0, face.height);
+        cv::Scalar shade = skin;
+        for (int c = 0; c < 3; c++)
+            shade[c] += rng.uniform(-30, 30);
+        cv::Point p(face.x + x, face.y + y);
+        cv::circle(frame, p, std::max(2, face.width / 16), shade, -1);
+    }
+    cv::circle(frame, cv::Point(face.x + face.width * 3 / 10, face.y + face.height * 38 / 100), std::max(2, face.width / 20), cv::Scalar(40, 30, 30), -1);
+    cv::circle(frame, cv::Point(face.x + face.width * 7 / 10, face.y + face.height * 38 / 100), std::max(2, face.width / 20), cv::Scalar(40, 30, 30), -1);
+    cv::ellipse(frame, cv::Point(face.x + face.width / 2, face.y + face.height * 78 / 100), cv::Size(face.width / 6, face.height / 16), 0, 0, 360, cv::Scalar(60, 60, 150), -1);
+}
+
+// Two faces of one size on a noisy background, with the FaceSwapper state of
+// a swap prepared up to every stage
+struct SwapScene
+{
+    cv::Mat frame;
+    cv::Rect ann, bob;
+    std::vector<cv::Point2f> ann_points, bob_points;
+    FaceSwapper swapper;
+};
+
+// Fills the points getFacePoints would extract, from the synthetic landmarks
+static void setFacePoints(FaceSwapper &swapper, const std::vector<cv::Point2f> &ann, const std::vector<cv::Point2f> &bob, cv::Point offset)
+{
+    auto pick = [&](const std::vector<cv::Point2f> &shape, cv::Point2i points[9], cv::Point2f keypoints[3])
+    {
+        auto getPoint = [&](int part_index) -> cv::Point2i
+        {
+            return cv::Point2i((int)shape[part_index].x, (int)shape[part_index].y) - offset;
+        };
+
+        const int jaw[7] = { 0, 3, 5, 8, 11, 13, 16 };
+        for (int i = 0; i < 7; i++)
+            points[i] = getPoint(jaw[i]);
+
+        cv::Point2i nose_length = getPoint(27) - getPoint(30);
+        points[7] = getPoint(26) + nose_length;
+        points[8] = getPoint(17) + nose_length;
+
+        keypoints[0] = points[3];
+        keypoints[1] = getPoint(36);
+        keypoints[2] = getPoint(45);
+    };
+
+    pick(ann, swapper.points_ann, swapper.affine_transform_keypoints_ann);
+    pick(bob, swapper.points_bob, swapper.affine_transform_keypoints_bob);
+    swapper.feather_amount.width = swapper.feather_amount.height = (int)cv::norm(swapper.points_ann[0] - swapper.points_ann[6]) / 8;
+}
+
+static SwapScene &scene(int face_size)
+{
+    static std::map<int, SwapScene> scenes;
+    auto it = scenes.find(face_size);
+    if (it != scenes.end())
+        return it->second;
+
+    SwapScene &s = scenes[face_size];
+    cv::RNG rng(1234 + face_size);
+
+    s.frame.create(FRAME_SIZE, CV_8UC3);
+    rng.fill(s.frame, cv::RNG::UNIFORM, cv::Scalar(60, 70, 80), cv::Scalar(120, 130, 140));
+    cv::GaussianBlur(s.frame, s.frame, cv::Size(7, 7), 0);
+
+    s.ann = cv::Rect(FRAME_SIZE.width / 4 - face_size / 2, FRAME_SIZE.height / 2 - face_size / 2, face_size, face_size);
+    s.bob = cv::Rect(FRAME_SIZE.width * 3 / 4 - face_size / 2, FRAME_SIZE.height / 2 - face_size / 2, face_size, face_size);
+    drawFace(s.frame, s.ann, cv::Scalar(120, 150, 200), rng);
+    drawFace(s.frame, s.bob, cv::Scalar(90, 120, 170), rng);
+    cv::GaussianBlur(s.frame, s.frame, cv::Size(3, 3), 0);
+
+    s.ann_points = landmarksIn(s.ann, rng);
+    s.bob_points = landmarksIn(s.bob, rng);
+
+    // The stages of FaceSwapper::swapFaces up to the colour correction
+    FaceSwapper &f = s.swapper;
+    f.small_frame = f.getMinFrame(s.frame, s.ann, s.bob);
+    f.frame_size = f.small_frame.size();
+    setFacePoints(f, s.ann_points, s.bob_points, s.ann.tl() - f.rect_ann.tl());
+    f.getTransformationMatrices();
+    f.mask_ann.create(f.frame_size, CV_8UC1);
+    f.mask_bob.create(f.frame_size, CV_8UC1);
+    f.getMasks();
+    f.getWarppedMasks();
+    f.refined_masks = f.getRefinedMasks();
+    f.extractFaces();
+    f.warpped_faces = f.getWarppedFaces();
+
+    return s;
+}
+
+// ----------------------------------------------------------------------------------------
+// FaceSwapper stages
+
+static void BM_getMinFrame(BenchState &state)
+{
+    SwapScene &s = scene(state.range());
+    while (state.keepRunning())
+        s.swapper.small_frame = s.swapper.getMinFrame(s.frame, s.ann, s.bob);
+}
+BENCHMARK(BM_getMinFrame, FACE_SIZES);
+
+static void BM_getFacePoints(BenchState &state)
+{
+    if (!haveLandmarkModel)
+    {
+        state.skip("needs --landmarks");
+        return;
+    }
+
+    // On a copy, the landmarks found on drawn faces must not change the other stages
+    SwapScene &s = scene(state.range());
+    FaceSwapper swapper;
+    swapper.pose_model = landmarkModel;
+    cv::Mat small_frame = swapper.getMinFrame(s.frame, s.ann, s.bob).clone();
+    while (state.keepRunning())
+        swapper.getFacePoints(small_frame);
+    state.setItemsProcessed(2);
+}
+BENCHMARK(BM_getFacePoints, FACE_SIZES);
+
+// Landmarks of both faces of a scene, predicted the way sfml does
+static void predictScene(const SwapScene &s, int target_width, dlib::full_object_detection shapes[2])
+{
+    // A fresh pyramid per frame, as every captured frame gets one
+    FramePyramid pyramid(s.frame);
+    const cv::Rect faces[2] = { s.ann, s.bob };
+    for (int i = 0; i < 2; i++)
+    {
+        dlib::rectangle r(faces[i].x, faces[i].y, faces[i].x + faces[i].width - 1, faces[i].y + faces[i].height - 1);
+        shapes[i] = predictLandmarks(landmarkModel, pyramid, r, target_width);
+    }
+}
+
+static void BM_predictLandmarksFull(BenchState &state)
+{
+    if (!haveLandmarkModel)
+    {
+        state.skip("needs --landmarks");
+        return;
+    }
+
+    SwapScene &s = scene(state.range());
+    dlib::full_object_detection shapes[2];
+    while (state.keepRunning())
+        predictScene(s, 0, shapes);
+    state.setItemsProcessed(2);
+}
+BENCHMARK(BM_predictLandmarksFull, FACE_SIZES, 320, 400);
+
+// Mean and largest distance of predicted landmarks to the full resolution
+// ones, in full resolution pixels and relative to the distance between the
+// eye corners
+struct LandmarkDeviation
+{
+    double sum = 0, largest = 0, eyes = 0;
+    unsigned long parts = 0, faces = 0;
+
+    void add(const dlib::full_object_detection &shape, const dlib::full_object_detection &full)
+    {
+        for (unsigned long p = 0; p < full.num_parts(); p++, parts++)
+        {
+            double d = std::sqrt((double)(shape.part(p) - full.part(p)).length_squared());
+            sum += d;
+            largest = std::max(largest, d);
+        }
+        // Outer eye corners of the 68 and of the 5 point layout
+        unsigned long a = full.num_parts() == Landmarks68::PARTS ? 36 : 2, b = a == 36 ? 45 : 0;
+        eyes += std::sqrt((double)(full.part(a) - full.part(b)).length_squared());
+        faces++;
+    }
+
+    void report(BenchState &state) const
+    {
+        double meanEyes = faces ? eyes / faces : 0;
+        state.setCounter("mean_deviation_px", parts ? sum / parts : 0);
+        state.setCounter("max_deviation_px", largest);
+        state.setCounter("mean_deviation_iod", parts && meanEyes > 0 ? sum / parts / meanEyes : 0);
+    }
+};
+
+static void BM_predictLandmarksScaled(BenchState &state)
+{
+    if (!haveLandmarkModel)
+    {
+        state.skip("needs --landmarks");
+        return;
+    }
+
+    SwapScene &s = scene(state.range());
+    dlib::full_object_detection shapes[2];
+    while (state.keepRunning())
+        predictScene(s, LANDMARK_FACE_WIDTH, shapes);
+    state.setItemsProcessed(2);
+
+    dlib::full_object_detection full[2];
+    predictScene(s, 0, full);
+    LandmarkDeviation deviation;
+    for (int i = 0; i < 2; i++)
+        deviation.add(shapes[i], full[i]);
+    state.setCounter("level", landmarkLevel(state.range(), LANDMARK_FACE_WIDTH));
+    deviation.report(state);
+}
+BENCHMARK(BM_predictLandmarksScaled, FACE_SIZES, 320, 400);
+
+// ----------------------------------------------------------------------------------------
+// Photos, with --images
+
+struct FaceImage
+{
+    cv::Mat bgr;
+    std::vector<dlib::rectangle> faces;
+};
+
+static std::vector<FaceImage> faceImages;
+
+static bool isImageFile(const string &name)
+{
+    size_t dot = name.rfind('.');
+    if (dot == string::npos)
+        return false;
+    string ext = name.substr(dot + 1);
+    std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+    return ext == "jpg" || ext == "jpeg" || ext == "png" || ext == "bmp";
+}
+
+// Reads the photos of dir and finds their faces once, the benchmark only predicts
+static bool loadFaceImages(const string &dir)
+{
+    DIR *d = opendir(dir.c_str());
+    if (!d)
+    {
+        cerr << "Unable to open " << dir << endl;
+        return false;
+    }
+    std::vector<string> paths;
+    while (struct dirent *entry = readdir(d))
+    {
+        string name(entry->d_name);
+        if (isImageFile(name))
+            paths.push_back(dir + "/" + name);
+    }
+    closedir(d);
+    std::sort(paths.begin(), paths.end());
+
+    dlib::frontal_face_detector detector = dlib::get_frontal_face_detector();
+    unsigned long faces = 0;
+    for (const string &path : paths)
+    {
+        FaceImage image;
+        image.bgr = cv::imread(path, cv::IMREAD_COLOR);
+        if (image.bgr.empty())
+        {
+            cerr << "Unable to read " << path << endl;
+            continue;
+        }
+        dlib::cv_image<dlib::bgr_pixel> img(image.bgr);
+        image.faces = detector(img);
+        faces += image.faces.size();
+        if (!image.faces.empty())
+            faceImages.push_back(std::move(image));
+    }
+    cerr << faces << " faces in " << faceImages.size() << " of " << paths.size() << " images in " << dir << endl;
+    return true;
+}
+
+// Every face of the photos predicted with target_width, in order
+static void predictImages(int target_width, std::vector<dlib::full_object_detection> &shapes)
+{
+    shapes.clear();
+    for (const FaceImage &image : faceImages)
+    {
+        FramePyramid pyramid(image.bgr);
+        for (const dlib::rectangle &face : image.faces)
+            shapes.push_back(predictLandmarks(landmarkModel, pyramid, face, target_width));
+    }
+}
+
+// The argument is the target face width, as for sfml's --landmark-width
+static void BM_predictLandmarksImages(BenchState &state)
+{
+    if (!haveLandmarkModel || faceImages.empty())
+    {
+        state.skip("needs --landmarks and --images with faces");
+        return;
+    }
+
+    std::vector<dlib::full_object_detection> shapes, full;
+    while (state.keepRunning())
+        predictImages(state.range(), shapes);
+
+    predictImages(0, full);
+    LandmarkDeviation deviation;
+    unsigned long shrunk = 0;
+    size_t i = 0;
+    for (const FaceImage &image : faceImages)
+    {
+        for (const dlib::rectangle &face : image.faces)
+        {
+            deviation.add(shapes[i], full[i]);
+            if (landmarkLevel((int)face.width(), state.range()) > 0)
+                shrunk++;
+            i++;
+        }
+    }
+    state.setItemsProcessed(full.size());
+    state.setCounter("faces", full.size());
+    state.setCounter("shrunk_faces", shrunk);
+    deviation.report(state);
+}
+BENCHMARK(BM_predictLandmarksImages, 64, 80, LANDMARK_FACE_WIDTH, 160);
+
+static void BM_getMasks(BenchState &state)
+{
+    SwapScene &s = scene(state.range());
+    while (state.keepRunning())
+        s.swapper.getMasks();
+}
+BENCHMARK(BM_getMasks, FACE_SIZES);
+
+static void BM_getWarppedMasks(BenchState &state)
+{
+    SwapScene &s = scene(state.range());
+    while (state.keepRunning())
+        s.swapper.getWarppedMasks();
+}
+BENCHMARK(BM_getWarppedMasks, FACE_SIZES);
+
+static void BM_getRefinedMasks(BenchState &state)
+{
+    SwapScene &s = scene(state.range());
+    cv::Mat refined;
+    while (state.keepRunning())
+        refined = s.swapper.getRefinedMasks();
+}
+BENCHMARK(BM_getRefinedMasks, FACE_SIZES);
+
+static void BM_extractFaces(BenchState &state)
+{
+    SwapScene &s = scene(state.range());
+    while (state.keepRunning())
+        s.swapper.extractFaces();
+}
+BENCHMARK(BM_extractFaces, FACE_SIZES);
+
+static void BM_getWarppedFaces(BenchState &state)
+{
+    SwapScene &s = scene(state.range());
+    cv::Mat warpped;
+    while (state.keepRunning())
+        warpped = s.swapper.getWarppedFaces();
+}
+BENCHMARK(BM_getWarppedFaces, FACE_SIZES);
+
+static void BM_specifiyHistogram(BenchState &state)
+{
+    SwapScene &s = scene(state.range());
+    FaceSwapper &f = s.swapper;
+    cv::Mat original = f.warpped_faces.clone();
+    while (state.keepRunning())
+    {
+        f.specifiyHistogram(f.small_frame(f.big_rect_ann), f.warpped_faces(f.big_rect_ann), f.warpped_mask_bob(f.big_rect_ann));
+
+        state.pauseTiming();
+        original.copyTo(f.warpped_faces);
+        state.resumeTiming();
+    }
+}
+BENCHMARK(BM_specifiyHistogram, FACE_SIZES);
+
+static void BM_featherMask(BenchState &state)
+{
+    SwapScene &s = scene(state.range());
+    FaceSwapper &f = s.swapper;
+    cv::Mat original = f.refined_masks.clone();
+    while (state.keepRunning())
+    {
+        f.featherMask(f.refined_masks(f.big_rect_ann));
+
+        state.pauseTiming();
+        original.copyTo(f.refined_masks);
+        state.resumeTiming();
+    }
+}
+BENCHMARK(BM_featherMask, FACE_SIZES);
+
+static void BM_pasteFacesOnFrame(BenchState &state)
+{
+    SwapScene &s = scene(state.range());
+    FaceSwapper &f = s.swapper;
+    cv::Mat original = f.small_frame.clone();
+    while (state.keepRunning())
+    {
+        f.pasteFacesOnFrame();
+
+        state.pauseTiming();
+        original.copyTo(f.small_frame);
+        state.resumeTiming();
+    }
+}
+BENCHMARK(BM_pasteFacesOnFrame, FACE_SIZES);
+
+// ----------------------------------------------------------------------------------------
+// Warp and blend helpers, on the float images sfml.cpp uses
+
+static void BM_warpTriangle(BenchState &state)
+{
+    SwapScene &s = scene(state.range());
+    cv::Mat source, warped;
+    s.frame.convertTo(source, CV_32F);
+    warped = source.clone();
+
+    std::vector<std::vector<int>> dt;
+    calculateDelaunayTriangles(cv::Rect(0, 0, s.frame.cols, s.frame.rows), s.ann_points, dt);
+
+    // All triangles of one face, like one face of a swap in sfml.cpp
+    while (state.keepRunning())
+    {
+        for (const std::vector<int> &triangle : dt)
+        {
+            std::vector<cv::Point2f> t1, t2;
+            for (int j = 0; j < 3; j++)
+            {
+                t1.push_back(s.ann_points[triangle[j]]);
+                t2.push_back(s.bob_points[triangle[j]]);
+            }
+            warpTriangle(source, warped, t1, t2);
+        }
+    }
+    state.setItemsProcessed(dt.size());
+}
+BENCHMARK(BM_warpTriangle, FACE_SIZES);
+
+static void BM_computeTriangleTransforms(BenchState &state)
+{
+    SwapScene &s = scene(state.range());
+    std::vector<std::vector<int>> dt;
+    calculateDelaunayTriangles(cv::Rect(0, 0, s.frame.cols, s.frame.rows), s.ann_points, dt);
+
+    TriangleBatch batch;
+    while (state.keepRunning())
+        computeTriangleTransforms(s.ann_points.data(), s.bob_points.data(), dt, batch);
+    state.setItemsProcessed(dt.size());
+}
+BENCHMARK(BM_computeTriangleTransforms, FACE_SIZES);
+
+// The batched counterpart of warpTriangle above, transforms included
+static void BM_warpTriangles(BenchState &state)
+{
+    SwapScene &s = scene(state.range());
+    cv::Mat source, warped;
+    s.frame.convertTo(source, CV_32F);
+    warped = source.clone();
+
+    std::vector<std::vector<int>> dt;
+    calculateDelaunayTriangles(cv::Rect(0, 0, s.frame.cols, s.frame.rows), s.ann_points, dt);
+
+    TriangleBatch batch;
+    while (state.keepRunning())
+    {
+        computeTriangleTransforms(s.ann_points.data(), s.bob_points.data(), dt, batch);
+        warpTriangles(source, warped, batch);
+    }
+    state.setItemsProcessed(dt.size());
+}
+BENCHMARK(BM_warpTriangles, FACE_SIZES);
+
+// The reduced mesh of FaceMesh, triangulation included as sfml does it per refresh
+static void BM_warpFeatureMesh(BenchState &state)
+{
+    SwapScene &s = scene(state.range());
+    cv::Mat source, warped;
+    s.frame.convertTo(source, CV_32F);
+    warped = source.clone();
+
+    const std::vector<std::vector<int>> &triangles = FaceMesh::featureTriangles();
+    TriangleBatch batch;
+    while (state.keepRunning())
+    {
+        computeTriangleTransforms(s.ann_points.data(), s.bob_points.data(), triangles, batch);
+        warpTriangles(source, warped, batch);
+    }
+    state.setItemsProcessed(triangles.size());
+}
+BENCHMARK(BM_warpFeatureMesh, FACE_SIZES);
+
+// The HULL level of FaceMesh, one affine warp of the face box in 8 bit
+static void BM_warpHull(BenchState &state)
+{
+    SwapScene &s = scene(state.range());
+    cv::Rect r = cv::boundingRect(s.bob_points) & cv::Rect(0, 0, s.frame.cols, s.frame.rows);
+    cv::Rect sourceRect = cv::boundingRect(s.ann_points) & cv::Rect(0, 0, s.frame.cols, s.frame.rows);
+    std::vector<cv::Point2f> src, dst;
+    for (const cv::Point2f &p : s.ann_points)
+        src.push_back(p - cv::Point2f(sourceRect.tl()));
+    for (const cv::Point2f &p : s.bob_points)
+        dst.push_back(p - cv::Point2f(r.tl()));
+
+    cv::Mat warped;
+    while (state.keepRunning())
+        cv::warpAffine(s.frame(sourceRect), warped, FaceMesh::hullTransform(src.data(), dst.data()), r.size(), cv::INTER_LINEAR, cv::BORDER_REFLECT_101);
+}
+BENCHMARK(BM_warpHull, FACE_SIZES);
+
+static void BM_calculateDelaunayTriangles(BenchState &state)
+{
+    SwapScene &s = scene(state.range());
+    cv::Rect rect(0, 0, s.frame.cols, s.frame.rows);
+    std::vector<cv::Point2f> points = s.ann_points;
+    std::vector<std::vector<int>> dt;
+    while (state.keepRunning())
+    {
+        dt.clear();
+        calculateDelaunayTriangles(rect, points, dt);
+    }
+}
+BENCHMARK(BM_calculateDelaunayTriangles, FACE_SIZES);
+
+static void BM_LaplacianBlend(BenchState &state)
+{
+    SwapScene &s = scene(state.range());
+
+    std::vector<cv::Point2f> hull;
+    cv::convexHull(s.ann_points, hull);
+    std::vector<cv::Point> hull8U(hull.begin(), hull.end());
+    cv::Rect r = cv::boundingRect(hull8U) & cv::Rect(0, 0, s.frame.cols, s.frame.rows);
+
+    cv::Mat mask(s.frame.size(), CV_8UC1, cv::Scalar(0));
+    cv::fillConvexPoly(mask, hull8U, cv::Scalar(255));
+    cv::Mat_<float> maskF;
+    mask.convertTo(maskF, CV_32F, 1.0 / 255.0);
+
+    cv::Mat_<cv::Vec3f> left, right;
+    s.frame.convertTo(right, CV_32F, 1.0 / 255.0);
+    cv::flip(right, left, 1);
+
+    cv::Mat_<cv::Vec3f> blend;
+    while (state.keepRunning())
+        blend = LaplacianBlend(left(r), right(r), maskF(r));
+}
+BENCHMARK(BM_LaplacianBlend, FACE_SIZES);
+
+// ----------------------------------------------------------------------------------------
+
+static string jsonEscape(const string &s)
+{
+    string out;
+    for (char c : s)
+    {
+        if (c == '"' || c == '\\')
+            out += '\\';
+        out += c;
+    }
+    return out;
+}
+
+static const char *architecture()
+{
+#if defined(__aarch64__)
+    return "aarch64";
+#elif defined(__arm__)
+    return "armhf";
+#elif defined(__x86_64__)
+    return "x86_64";
+#else
+    return "unknown";
+#endif
+}
+
+int main(int argc, char **argv)
+{
+    double minTime = 0.5;
+    string filter, outPath, kernelSpec = "auto";
+
+    for (int i = 1; i < argc; i++)
+    {
+        string arg(argv[i]);
+        if (arg.compare(0, 11, "--min-time=") == 0)
+            minTime = atof(arg.substr(11).c_str());
+        else if (arg.compare(0, 9, "--filter=") == 0)
+            filter = arg.substr(9);
+        else if (arg.compare(0, 6, "--out=") == 0)
+            outPath = arg.substr(6);
+        else if (arg.compare(0, 10, "--kernels=") == 0)
+            kernelSpec = arg.substr(10);
+        else if (arg.compare(0, 12, "--landmarks=") == 0)
+        {
+            dlib::deserialize(arg.substr(12)) >> landmarkModel;
+            haveLandmarkModel = true;
+        }
+        else if (arg.compare(0, 9, "--images=") == 0)
+        {
+            if (!loadFaceImages(arg.substr(9)))
+                return -1;
+        }
+        else
+        {
+            cout << "Usage: " << argv[0] << " [--filter=<substring>] [--min-time=<seconds>] [--out=<file.json>] [--landmarks=<model.dat>] [--images=<dir>] [--kernels=<auto|generic|sse42|avx2|neon>]" << endl;
+            return arg == "--help" ? 0 : -1;
+        }
+    }
+
+    if (!selectKernels(kernelSpec))
+    {
+        cout << "Image kernels " << kernelSpec << " are not available on this CPU" << endl;
+        return -1;
+    }
+
+    char host[256] = "";
+    gethostname(host, sizeof(host) - 1);
+    time_t now = time(nullptr);
+    char date[64];
+    strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", localtime(&now));
+
+    stringstream json;
+    json << "{\n  \"context\": {\n"
+         << "    \"date\": \"" << date << "\",\n"
+         << "    \"host_name\": \"" << jsonEscape(host) << "\",\n"
+         << "    \"executable\": \"" << jsonEscape(argv[0]) << "\",\n"
+         << "    \"num_cpus\": " << sysconf(_SC_NPROCESSORS_ONLN) << ",\n"
+         << "    \"architecture\": \"" << architecture() << "\",\n"
+         << "    \"kernels\": \"" << kernels().name << "\",\n"
+#ifdef NDEBUG
+         << "    \"library_build_type\": \"release\",\n"
+#else
+         << "    \"library_build_type\": \"debug\",\n"
+#endif
+         << "    \"opencv_version\": \"" << CV_VERSION << "\"\n"
+         << "  },\n  \"benchmarks\": [";
+
+    bool first = true;
+    for (const Benchmark &b : benchmarks())
+    {
+        for (int arg : b.args)
+        {
+            string name = b.name + "/" + to_string(arg);
+            if (!filter.empty() && name.find(filter) == string::npos)
+                continue;
+
+            // Grow the iteration count until one run takes long enough
+            size_t iterations = 1;
+            BenchState state(arg, iterations);
+            while (true)
+            {
+                state = BenchState(arg, iterations);
+                b.function(state);
+                if (!state.skipped.empty() || state.real >= minTime || iterations >= 1000000000)
+                    break;
+                double grow = state.real > 0 ? 1.4 * minTime / state.real : 10;
+                iterations = (size_t)std::ceil(iterations * std::min(10.0, std::max(1.5, grow)));
+            }
+            const BenchState *result = &state;
+
+            if (!result->skipped.empty())
+            {
+                cerr << name << " skipped, " << result->skipped << endl;
+                continue;
+            }
+
+            double realUs = result->real / result->iterations * 1e6;
+            double cpuUs = result->cpu / result->iterations * 1e6;
+            fprintf(stderr, "%-36s %12.2f us %12.2f us cpu %10zu iterations\n", name.c_str(), realUs, cpuUs, result->iterations);
+
+            json << (first ? "\n" : ",\n")
+                 << "    {\n"
+                 << "      \"name\": \"" << jsonEscape(name) << "\",\n"
+                 << "      \"run_name\": \"" << jsonEscape(name) << "\",\n"
+                 << "      \"run_type\": \"iteration\",\n"
+                 << "      \"iterations\": " << result->iterations << ",\n"
+                 << "      \"real_time\": " << realUs << ",\n"
+                 << "      \"cpu_time\": " << cpuUs << ",\n"
+                 << "      \"time_unit\": \"us\"";
+            if (result->items_processed)
+                json << ",\n      \"items_per_second\": " << result->items_processed * result->iterations / result->real;
+            for (const auto &counter : result->counters)
+                json << ",\n      \"" << jsonEscape(counter.first) << "\": " << counter.second;
+            json << "\n    }";
+            first = false;
+        }
+    }
+    json << "\n  ]\n}\n";
+
+    if (outPath.empty())
+        cout << json.str();
+    else
+    {
+        ofstream out(outPath);
+        out << json.str();
+        if (!out)
+        {
+            cerr << "Unable to write " << outPath << endl;
+            return -1;
+        }
+    }
+    return 0;
+}
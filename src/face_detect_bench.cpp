@@ -0,0 +1,151 @@
+/*
+
+    Compares the face detector backends on a replay clip.
+
+    Every frame is shrunk to one grayscale frame that all backends share, the
+    same way sfml.cpp feeds its detector. The reference faces of a frame are
+    what the dlib HOG detector finds on the full resolution frame; a detection
+    counts as a hit when it overlaps a reference face with an IoU of at least
+    0.3 (cascade boxes are framed differently from HOG boxes).
+
+    For every backend the mean and worst detection time per frame, the recall
+    against the reference and the number of unmatched detections are printed,
+    so the fastest backend that still finds the faces can be picked with
+    sfml --detector=<name>.
+
+*/
+
+#include <opencv2/highgui.hpp>
+#include <opencv2/imgproc.hpp>
+#include <opencv2/videoio.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "FaceDetector.h"
+
+using namespace std;
+
+struct BackendResult
+{
+    std::unique_ptr<FaceDetector> detector;
+    double total_ms = 0, worst_ms = 0;
+    unsigned long hits = 0, false_positives = 0;
+};
+
+static double overlap(const cv::Rect &a, const cv::Rect &b)
+{
+    double intersection = (a & b).area();
+    return intersection / (a.area() + b.area() - intersection);
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2)
+    {
+        cout << "Call this program like this:" << endl;
+        cout << "./face_detect_bench clip.avi [--backends=hog,haar,lbp] [--ratio=4] [--frames=n]" << endl;
+        return 0;
+    }
+
+    string backends = "hog,haar,lbp";
+    double ratio = 4;
+    unsigned long max_frames = 0;
+
+    for (int i = 2; i < argc; i++)
+    {
+        string arg(argv[i]);
+        if (arg.compare(0, 11, "--backends=") == 0)
+            backends = arg.substr(11);
+        else if (arg.compare(0, 8, "--ratio=") == 0)
+            ratio = stod(arg.substr(8));
+        else if (arg.compare(0, 9, "--frames=") == 0)
+            max_frames = stoul(arg.substr(9));
+        else
+        {
+            cout << "Unknown option " << arg << endl;
+            return 1;
+        }
+    }
+
+    std::vector<BackendResult> results;
+    stringstream ss(backends);
+    string spec;
+    while (getline(ss, spec, ','))
+    {
+        BackendResult result;
+        result.detector = FaceDetector::create(spec);
+        if (!result.detector)
+            return 1;
+        results.push_back(std::move(result));
+    }
+
+    cv::VideoCapture clip(argv[1]);
+    if (!clip.isOpened())
+    {
+        cout << "Unable to open " << argv[1] << endl;
+        return 1;
+    }
+
+    HogFaceDetector reference;
+    unsigned long frames = 0, reference_faces = 0;
+    cv::Mat frame, gray, gray_small;
+
+    while (clip.read(frame) && (max_frames == 0 || frames < max_frames))
+    {
+        cv::cvtColor(frame, gray, cv::COLOR_BGR2GRAY);
+        std::vector<cv::Rect> truth = reference.detect(gray, 1.0);
+        reference_faces += truth.size();
+
+        cv::resize(gray, gray_small, cv::Size(), 1.0 / ratio, 1.0 / ratio);
+
+        for (BackendResult &result : results)
+        {
+            auto start = chrono::steady_clock::now();
+            std::vector<cv::Rect> faces = result.detector->detect(gray_small, ratio);
+            double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+            result.total_ms += ms;
+            result.worst_ms = std::max(result.worst_ms, ms);
+
+            std::vector<bool> matched(faces.size(), false);
+            for (const cv::Rect &face : truth)
+            {
+                for (size_t k = 0; k < faces.size(); k++)
+                {
+                    if (!matched[k] && overlap(face, faces[k]) >= 0.3)
+                    {
+                        matched[k] = true;
+                        result.hits++;
+                        break;
+                    }
+                }
+            }
+            result.false_positives += std::count(matched.begin(), matched.end(), false);
+        }
+
+        frames++;
+    }
+
+    if (frames == 0)
+    {
+        cout << "No frames in " << argv[1] << endl;
+        return 1;
+    }
+
+    cout << frames << " frames, " << reference_faces << " reference faces, detection at 1/" << ratio << " size" << endl;
+    for (const BackendResult &result : results)
+    {
+        cout << result.detector->name()
+             << "\tmean " << result.total_ms / frames << " ms"
+             << "\tworst " << result.worst_ms << " ms"
+             << "\trecall " << (reference_faces ? 100.0 * result.hits / reference_faces : 100.0) << " %"
+             << "\tfalse positives " << result.false_positives << endl;
+    }
+
+    return 0;
+}
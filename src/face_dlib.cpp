@@ -36,6 +36,13 @@
 #include <dlib/image_processing.h>
 #include <dlib/image_io.h>
 #include <dlib/gui_widgets.h>
+#include "FaceWarp.h"
+#include "OutputSink.h"
+#include "TemplateAtlas.h"
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
 //#include <iostream>
 //#include <stdlib.h>
 //#include <fstream>
@@ -69,91 +76,6 @@ std::vector<Point2f> readPoints(string pointsFileName){
 	return points;
 }
 
-// Apply affine transform calculated using srcTri and dstTri to src
-void applyAffineTransform(Mat &warpImage, Mat &src, std::vector<Point2f> &srcTri, std::vector<Point2f> &dstTri)
-{
-    // Given a pair of triangles, find the affine transform.
-    Mat warpMat = getAffineTransform( srcTri, dstTri );
-
-    // Apply the Affine Transform just found to the src image
-    warpAffine( src, warpImage, warpMat, warpImage.size(), INTER_LINEAR, BORDER_REFLECT_101);
-}
-
-
-// Calculate Delaunay triangles for set of points
-// Returns the vector of indices of 3 points for each triangle
-static void calculateDelaunayTriangles(Rect rect, std::vector<Point2f> &points, std::vector< std::vector<int> > &delaunayTri){
-
-	// Create an instance of Subdiv2D
-    Subdiv2D subdiv(rect);
-
-	// Insert points into subdiv
-    for( std::vector<Point2f>::iterator it = points.begin(); it != points.end(); it++)
-        subdiv.insert(*it);
-
-	std::vector<Vec6f> triangleList;
-	subdiv.getTriangleList(triangleList);
-	std::vector<Point2f> pt(3);
-	std::vector<int> ind(3);
-
-	for( size_t i = 0; i < triangleList.size(); i++ )
-	{
-		Vec6f t = triangleList[i];
-		pt[0] = Point2f(t[0], t[1]);
-		pt[1] = Point2f(t[2], t[3]);
-		pt[2] = Point2f(t[4], t[5 ]);
-
-		if ( rect.contains(pt[0]) && rect.contains(pt[1]) && rect.contains(pt[2])){
-			for(int j = 0; j < 3; j++)
-				for(size_t k = 0; k < points.size(); k++)
-					if(abs(pt[j].x - points[k].x) < 1.0 && abs(pt[j].y - points[k].y) < 1)
-						ind[j] = k;
-
-			delaunayTri.push_back(ind);
-		}
-	}
-
-}
-
-
-// Warps and alpha blends triangular regions from img1 and img2 to img
-void warpTriangle(Mat &img1, Mat &img2, std::vector<Point2f> &t1, std::vector<Point2f> &t2)
-{
-
-    Rect r1 = boundingRect(t1);
-    Rect r2 = boundingRect(t2);
-
-    // Offset points by left top corner of the respective rectangles
-    std::vector<Point2f> t1Rect, t2Rect;
-    std::vector<Point> t2RectInt;
-    for(int i = 0; i < 3; i++)
-    {
-
-        t1Rect.push_back( Point2f( t1[i].x - r1.x, t1[i].y -  r1.y) );
-        t2Rect.push_back( Point2f( t2[i].x - r2.x, t2[i].y - r2.y) );
-        t2RectInt.push_back( Point(t2[i].x - r2.x, t2[i].y - r2.y) ); // for fillConvexPoly
-
-    }
-
-    // Get mask by filling triangle
-    Mat mask = Mat::zeros(r2.height, r2.width, CV_32FC3);
-    fillConvexPoly(mask, t2RectInt, Scalar(1.0, 1.0, 1.0), 16, 0);
-
-    // Apply warpImage to small rectangular patches
-    Mat img1Rect;
-    img1(r1).copyTo(img1Rect);
-
-    Mat img2Rect = Mat::zeros(r2.height, r2.width, img1Rect.type());
-
-    applyAffineTransform(img2Rect, img1Rect, t1Rect, t2Rect);
-
-    multiply(img2Rect,mask, img2Rect);
-    multiply(img2(r2), Scalar(1.0,1.0,1.0) - mask, img2(r2));
-    img2(r2) = img2(r2) + img2Rect;
-
-
-}
-
 std::vector <cv::Point2f> get_points(const dlib::full_object_detection& d)
 {
     std::vector <cv::Point2f> points;
@@ -198,26 +120,129 @@ void render_face (cv::Mat &img, const dlib::full_object_detection& d)
 
 }
 
-int capture(cv::VideoCapture cap, cv::Mat spook,  std::vector<Point2f> spookpoints, frontal_face_detector detector, shape_predictor pose_model){
+// Warps a triangle of img1 onto a template triangle of img2 whose bounding box
+// and anti-aliased mask come precomputed from the atlas
+void warpTemplateTriangle(Mat &img1, Mat &img2, std::vector<Point2f> &t1, std::vector<Point2f> &t2, const Rect &r2, const Mat &mask8)
+{
+    Rect r1 = boundingRect(t1);
+
+    std::vector<Point2f> t1Rect, t2Rect;
+    for(int i = 0; i < 3; i++)
+    {
+        t1Rect.push_back( Point2f( t1[i].x - r1.x, t1[i].y - r1.y) );
+        t2Rect.push_back( Point2f( t2[i].x - r2.x, t2[i].y - r2.y) );
+    }
+
+    Mat mask;
+    mask8.convertTo(mask, CV_32F, 1.0 / 255.0);
+    cvtColor(mask, mask, COLOR_GRAY2BGR);
+
+    Mat img1Rect;
+    img1(r1).copyTo(img1Rect);
+
+    Mat img2Rect = Mat::zeros(r2.height, r2.width, img1Rect.type());
+
+    applyAffineTransform(img2Rect, img1Rect, t1Rect, t2Rect);
+
+    multiply(img2Rect,mask, img2Rect);
+    multiply(img2(r2), Scalar(1.0,1.0,1.0) - mask, img2(r2));
+    img2(r2) = img2(r2) + img2Rect;
+}
+
+// Templates come from the atlas when one is open, otherwise the single built in one is used
+struct TemplateSource
+{
+    TemplateAtlas atlas;
+    std::vector<TemplateAtlas::Template> builtIn;
+
+    size_t size() const { return builtIn.empty() ? atlas.size() : builtIn.size(); }
+    const TemplateAtlas::Template &get(size_t i) { return builtIn.empty() ? atlas.get(i) : builtIn[i]; }
+};
+
+void reportTemplate(TemplateSource &templates, size_t current)
+{
+    cout << "Template " << templates.get(current).name << " (" << current + 1 << " of " << templates.size() << ")";
+    if (templates.builtIn.empty())
+    {
+        TemplateAtlas::Stats stats = templates.atlas.stats();
+        cout << ", atlas " << stats.mapped / 1048576.0 << " MB mapped, " << stats.resident / 1048576.0 << " MB resident"
+             << ", " << stats.opened << " of " << stats.templates << " templates opened";
+    }
+    cout << endl;
+}
+
+int capture(cv::VideoCapture cap, TemplateSource &templates, double rotateSeconds, frontal_face_detector detector, shape_predictor pose_model, OutputSink *sink){
 	#define FACE_DOWNSAMPLE_RATIO 4
 
     std::vector<dlib::rectangle> faces;
     cv::Mat im;
     cv::Mat im_small;
 
+    cap.set(CV_CAP_PROP_FRAME_WIDTH,1920);   // width pixels
+    cap.set(CV_CAP_PROP_FRAME_HEIGHT,1080);   // height pixels
+    if(!cap.isOpened()){   // connect to the camera
+             cout << "Failed to connect to the camera." << endl;
+             return 1;
+    }
+
+    // Any key moves on to the next template, so does the timer. Switching
+    // only changes the index, the template's pages are read ahead of time.
+    std::unique_ptr<dlib::image_window> win;
+    std::thread keys;
+    std::atomic<size_t> requested(0);
+    if (!sink)
+    {
+        win.reset(new dlib::image_window());
+        keys = std::thread([&win, &requested]()
+        {
+            unsigned long key;
+            bool printable;
+            while (win->get_next_keypress(key, printable))
+                requested++;
+        });
+    }
+
+    // However the loop ends, the window goes and the key thread is joined,
+    // an exception must not meet a joinable thread
+    struct WindowGuard
+    {
+        std::unique_ptr<dlib::image_window> &win;
+        std::thread &keys;
+        ~WindowGuard()
+        {
+            if (win)
+                win->close_window();
+            if (keys.joinable())
+                keys.join();
+        }
+    } guard{win, keys};
+    size_t current = 0;
+    auto switched = std::chrono::steady_clock::now();
+    templates.atlas.prefetch(1);
+    reportTemplate(templates, current);
+
     // Grab and process frames until the main window is closed by the user.
-    	cout << "Grabbing a frame..." << endl;
-    	cap.set(CV_CAP_PROP_FRAME_WIDTH,1920);   // width pixels
-    	cap.set(CV_CAP_PROP_FRAME_HEIGHT,1080);   // height pixels
-    	if(!cap.isOpened()){   // connect to the camera
-    	         cout << "Failed to connect to the camera." << endl;
-    	         return 1;
+    while (!win || !win->is_closed())
+    {
+        auto now = std::chrono::steady_clock::now();
+        if (rotateSeconds > 0 && std::chrono::duration<double>(now - switched).count() >= rotateSeconds)
+        {
+            requested++;
+            switched = now;
         }
+        if (requested.load() % templates.size() != current)
+        {
+            current = requested.load() % templates.size();
+            switched = now;
+            templates.atlas.prefetch((current + 1) % templates.size());
+            reportTemplate(templates, current);
+        }
+        const TemplateAtlas::Template &spook = templates.get(current);
+
         // Grab a frame
         cap >> im;
-        //im=spook;
-
-        cout << "Image size: " << im.cols << " x " << im.rows << endl;
+        if (im.empty())
+            break;
 
         // Resize image for face detection
         cv::resize(im, im_small, cv::Size(), 1.0/FACE_DOWNSAMPLE_RATIO, 1.0/FACE_DOWNSAMPLE_RATIO);
@@ -227,207 +252,156 @@ int capture(cv::VideoCapture cap, cv::Mat spook,  std::vector<Point2f> spookpoin
         // to reallocate the memory which stores the image as that will make cimg
         // contain dangling pointers.  This basically means you shouldn't modify temp
         // while using cimg.
-        //cv_image<bgr_pixel> cimg(temp);
-        //array2d<rgb_pixel> cimg;
-        //assign_image(cimg, cv_image<bgr_pixel>(im));
         cv_image<bgr_pixel> cimg_small(im_small);
         cv_image<bgr_pixel> cimg(im);
-        //array2d<rgb_pixel> c2img;
-        //assign_image(c2img, cv_image<bgr_pixel>(cimg));
-        // Make the image larger so we can detect small faces.
-        //pyramid_up(cimg);
 
-        cout << "Detecting faces..." << endl;
         // Detect faces
         faces = detector(cimg_small);
-        // Find the pose of each face.
-        std::vector<full_object_detection> shapes;
         if (faces.size() == 0)
-        {
-        	cout << "No faces detected." << endl;
-            return capture(cap, spook, spookpoints, detector, pose_model);
-        }
-        full_object_detection shape;
-        cout << "There were " << faces.size() << " faces detected." << endl;
-        for (unsigned long i = 0; i < faces.size(); ++i)
-        {
-        	// Resize obtained rectangle for full resolution image.
-        	     dlib::rectangle r(
-        	                   (long)(faces[i].left() * FACE_DOWNSAMPLE_RATIO),
-        	                   (long)(faces[i].top() * FACE_DOWNSAMPLE_RATIO),
-        	                   (long)(faces[i].right() * FACE_DOWNSAMPLE_RATIO),
-        	                   (long)(faces[i].bottom() * FACE_DOWNSAMPLE_RATIO)
-        	                );
-
-        	// Landmark detection on full sized image
-        	shape = pose_model(cimg, r);
-            //shapes.push_back(pose_model(cimg, faces[i]));
-            shapes.push_back(shape);
-
-        }
+            continue;
 
-        Mat img1 = im;
-        Mat img2 = spook;
-        Mat img1Warped = img2.clone();
-
-        /*
-        dlib::image_window win_imcv;
-        cv_image<bgr_pixel> imcv(im);
-        win_imcv.set_image(imcv);
-        while(!win_imcv.is_closed()){}
-		*/
-
-        cout << "Finding facial landmarks." << endl;
+        // Landmark detection on full sized image, the last face found is swapped
+        dlib::rectangle r(
+                   (long)(faces.back().left() * FACE_DOWNSAMPLE_RATIO),
+                   (long)(faces.back().top() * FACE_DOWNSAMPLE_RATIO),
+                   (long)(faces.back().right() * FACE_DOWNSAMPLE_RATIO),
+                   (long)(faces.back().bottom() * FACE_DOWNSAMPLE_RATIO)
+                );
+        full_object_detection shape = pose_model(cimg, r);
 
         //Read points
-        std::vector<Point2f> points1, points2;
-        points1 = get_points(shape);
-        points2 = spookpoints;
+        std::vector<Point2f> points1 = get_points(shape);
 
         //calculate forehead left
         points1.push_back(cv::Point2f((points1[5].x+points1[18].x)/2,points1[18].y-0.25*(points1[5].y-points1[18].y)));
-        points2.push_back(cv::Point2f((points2[5].x+points2[18].x)/2,points2[18].y-0.25*(points2[5].y-points2[18].y)));
-
         //calculate forehead middle
         points1.push_back(cv::Point2f((points1[8].x+points1[27].x)/2,points1[27].y-0.25*(points1[8].y-points1[27].y)));
-        points2.push_back(cv::Point2f((points2[8].x+points2[27].x)/2,points2[27].y-0.25*(points2[8].y-points2[27].y)));
-
         //calculate forehead right
         points1.push_back(cv::Point2f((points1[11].x+points1[25].x)/2,points1[25].y-0.25*(points1[11].y-points1[25].y)));
-        points2.push_back(cv::Point2f((points2[11].x+points2[25].x)/2,points2[25].y-0.25*(points2[11].y-points2[25].y)));
 
-        //convert Mat to float data type
-        img1.convertTo(img1, CV_32F);
-        img1Warped.convertTo(img1Warped, CV_32F);
-
-        // Find convex hull
-        std::vector<Point2f> hull1;
-        std::vector<Point2f> hull2;
-        std::vector<int> hullIndex;
-
-        cout << "Finding convex hull." << endl;
-
-        convexHull(points2, hullIndex, false, false);
-
-        for(int i = 0; i < (int)hullIndex.size(); i++)
+        // Hull, triangulation and triangle masks of the template come from the atlas
+        std::vector<Point2f> hull1, hull2;
+        for (int index : spook.hull)
         {
-            hull1.push_back(points1[hullIndex[i]]);
-            hull2.push_back(points2[hullIndex[i]]);
+            hull1.push_back(points1[index]);
+            hull2.push_back(spook.points[index]);
         }
 
-        cout << "Finding delaunay triangulation." << endl;
-
-        // Find delaunay triangulation for points on the convex hull
-        std::vector< std::vector<int> > dt;
-        Rect rect(0, 0, img1Warped.cols, img1Warped.rows);
-        calculateDelaunayTriangles(rect, hull2, dt);
+        // Every triangle lies in the hull's box, a face that reaches out of
+        // the frame, its forehead most likely, is left for a later frame
+        Rect hullBox = boundingRect(hull1);
+        if ((hullBox & Rect(0, 0, im.cols, im.rows)) != hullBox)
+            continue;
 
-        cout << "Applying affine transformation." << endl;
+        //convert Mat to float data type, the template itself is never written to
+        Mat img1, img1Warped;
+        im.convertTo(img1, CV_32F);
+        spook.image.convertTo(img1Warped, CV_32F);
 
         // Apply affine transformation to Delaunay triangles
-        for(size_t i = 0; i < dt.size(); i++)
+        for(size_t i = 0; i < spook.triangles.size(); i++)
         {
            std::vector<Point2f> t1, t2;
            // Get points for img1, img2 corresponding to the triangles
-           for(size_t j = 0; j < 3; j++)
+           for(int j = 0; j < 3; j++)
            {
-        	  t1.push_back(hull1[dt[i][j]]);
-        	  t2.push_back(hull2[dt[i][j]]);
-        	}
-                warpTriangle(img1, img1Warped, t1, t2);
-       	}
-
-        img1Warped.convertTo(img1Warped, CV_8UC3);
-
-        cout << "Calculating mask." << endl;
-
-        // Calculate mask
-        std::vector<Point> hull8U;
-        for(int i = 0; i < (int)hull2.size(); i++)
-        {
-            Point pt(hull2[i].x, hull2[i].y);
-            hull8U.push_back(pt);
+        	  t1.push_back(hull1[spook.triangles[i][j]]);
+        	  t2.push_back(hull2[spook.triangles[i][j]]);
+           }
+           warpTemplateTriangle(img1, img1Warped, t1, t2, spook.triangle_rects[i], spook.triangle_masks[i]);
         }
 
-        Mat mask = Mat::zeros(img2.rows, img2.cols, img2.depth());
-        fillConvexPoly(mask,&hull8U[0], hull8U.size(), Scalar(255,255,255));
-
-        // Clone seamlessly.
-        Rect r = boundingRect(hull2);
-        //Point center = (r.tl() + r.br()) / 2;
-
-        cv::Mat imgtest1, imgtest2, masktest, output;
-        imgtest1 = img2(r);
-        imgtest2 = img1Warped(r);
-        masktest = mask(r);
-
-        //dlib::image_window win_r1, win_r2;
-        //cv_image<bgr_pixel> o_1(imgtest1);
-        //cv_image<bgr_pixel> o_2(imgtest2);
-        //win_r1.set_image(o_1);
-        //win_r2.set_image(o_2);
-        //while(!win_r1.is_closed()){}
-        //while(!win_r2.is_closed()){}
-
-        Point centertest = Point(imgtest1.cols / 2,imgtest1.rows / 2);
-
-        cv::seamlessClone(imgtest2,imgtest1, masktest, centertest, output, MONOCHROME_TRANSFER);
-
-		output.copyTo(img1Warped(r));
-
-        /*
         img1Warped.convertTo(img1Warped, CV_8UC3);
 
-        cout << "Applying seamless clone." << endl;
-
+        // Clone seamlessly.
+        Rect rect = spook.hull_rect;
         cv::Mat output;
-        cv::seamlessClone(img1Warped,img2, mask, center, output, NORMAL_CLONE);
-        */
-
-        //imshow("Face Swapped", output);
-        //waitKey(0);
-        //destroyAllWindows();
+        Point centertest = Point(rect.width / 2, rect.height / 2);
+        cv::seamlessClone(img1Warped(rect), spook.image(rect), spook.hull_mask, centertest, output, MONOCHROME_TRANSFER);
+		output.copyTo(img1Warped(rect));
 
+        if (sink)
+        {
+            // Headless: hand the result to the sink and wait until it is written
+            sink->push(img1Warped);
+            sink->stop();
+            cout << "Result written to " << sink->name() << " sink." << endl;
+            return 0;
+        }
 
-        //cout << "Merging back with original spook." << endl;
-
-        //cv::addWeighted( output, 0.75, spook, 0.25, 0.0, output);
+        cv_image<bgr_pixel> outputcv2(img1Warped);
+        win->set_image(outputcv2);
+    }
 
+    reportTemplate(templates, current);
+    return 0;
+}
 
-        dlib::image_window win_result2;
-        cv_image<bgr_pixel> outputcv2(img1Warped);
-        win_result2.set_image(outputcv2);
-        while(!win_result2.is_closed()){}
-
-        /*
-        cout << "Displaying on screen..." << endl;
-        // Custom Face Render
-        render_face(im, shape);
-        // Display it all on the screen
-        //win.clear_overlay();
-        //win.set_image(cimg);
-        //win.add_overlay(render_face_detections(shapes));
-        // We can also extract copies of each face that are cropped, rotated upright,
-        // and scaled to a standard size as shown here:
-        dlib::array<array2d<rgb_pixel> > face_chips;
-        extract_image_chips(cimg, get_face_chip_details(shapes), face_chips);
-        image_window win_faces;
-        win_faces.set_image(tile_images(face_chips));
-
-        while(!win_faces.is_closed()){} */
-        return 0;
+// Packs template images with their landmark files (name.png and name.txt) into an atlas
+int buildAtlas(const std::string &path, const std::vector<std::string> &images)
+{
+    std::vector<TemplateAtlas::Template> templates;
+    for (const std::string &image : images)
+    {
+        std::string base = image.substr(0, image.find_last_of('.'));
+        std::string name = base.substr(base.find_last_of('/') + 1);
+        TemplateAtlas::Template t;
+        if (!TemplateAtlas::prepare(name, cv::imread(image, CV_LOAD_IMAGE_COLOR), readPoints(base + ".txt"), t))
+        {
+            cout << "Unable to read the template " << image << " with 68 landmarks in " << base << ".txt" << endl;
+            return -1;
+        }
+        cout << "Template " << name << ": " << t.triangles.size() << " triangles, " << t.bytes() / 1024 << " kB" << endl;
+        templates.push_back(t);
+    }
+    if (!TemplateAtlas::write(path, templates))
+        return -1;
+    cout << "Wrote " << templates.size() << " templates to " << path << endl;
+    return 0;
 }
 
 int main(int argc, char** argv)
 {
 	try
     {
-		if (argc != 2)
+		if (argc >= 2 && std::string(argv[1]).compare(0, 14, "--build-atlas=") == 0)
+			return buildAtlas(std::string(argv[1]).substr(14), std::vector<std::string>(argv + 2, argv + argc));
+
+		if (argc < 2)
 		        {
-		            cout << "Call this program with a number 0 or 1 to indicate the /dev/video(x) input to use." << endl;
+		            cout << "Call this program with a number 0 or 1 to indicate the /dev/video(x) input to use," << endl;
+		            cout << "optionally followed by --sink=<spec> to write the result instead of showing it," << endl;
+		            cout << "--atlas=<file> to swap into the templates of an atlas instead of spook.png" << endl;
+		            cout << "and --rotate=<seconds> to move on to the next template on a timer, any key does it too." << endl;
+		            cout << "Build an atlas with --build-atlas=<file> <template.png>..., each next to its <template>.txt." << endl;
 		            return 0;
 		        }
 
+		std::unique_ptr<OutputSink> sink;
+		std::string atlasPath;
+		double rotateSeconds = 0;
+		for (int i = 2; i < argc; i++)
+		{
+			std::string arg(argv[i]);
+			if (arg.compare(0, 7, "--sink=") == 0)
+			{
+				if (!(sink = OutputSink::create(arg.substr(7))))
+				{
+					cout << "Invalid sink " << arg << endl;
+					return 0;
+				}
+			}
+			else if (arg.compare(0, 8, "--atlas=") == 0)
+				atlasPath = arg.substr(8);
+			else if (arg.compare(0, 9, "--rotate=") == 0)
+				rotateSeconds = atof(arg.substr(9).c_str());
+			else
+			{
+				cout << "Unknown option " << arg << endl;
+				return 0;
+			}
+		}
+
 		std::vector<std::string> args(argv, argv+argc);
 		cv::VideoCapture cap;
 
@@ -450,11 +424,26 @@ int main(int argc, char** argv)
         deserialize("shape_predictor_68_face_landmarks.dat") >> pose_model;
         cout << "Done reading in shape predictor ..." << endl;
 
-        cout << "Reading in spook..." << endl;
-        cv::Mat spook = cv::imread("spook.png", CV_LOAD_IMAGE_COLOR);
-        std::vector<Point2f> spookpoints = readPoints("spook.txt");
+        TemplateSource templates;
+        if (!atlasPath.empty())
+        {
+            cout << "Opening template atlas " << atlasPath << "..." << endl;
+            if (!templates.atlas.open(atlasPath) || templates.atlas.size() == 0)
+                return 1;
+        }
+        else
+        {
+            cout << "Reading in spook..." << endl;
+            TemplateAtlas::Template spook;
+            if (!TemplateAtlas::prepare("spook", cv::imread("spook.png", CV_LOAD_IMAGE_COLOR), readPoints("spook.txt"), spook))
+            {
+                cout << "Unable to read spook.png with its 68 landmarks in spook.txt" << endl;
+                return 1;
+            }
+            templates.builtIn.push_back(spook);
+        }
 
-        return capture(cap, spook, spookpoints, detector, pose_model);
+        return capture(cap, templates, rotateSeconds, detector, pose_model, sink.get());
 
         // Release the cam
         cap.release();
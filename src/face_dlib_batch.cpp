@@ -0,0 +1,273 @@
+/*
+
+    Batch version of face_dlib_default.cpp for pre-annotating large photo sets.
+
+    Images are taken from a directory, a text file with one path per line or
+    the command line, and are decoded, detected and landmarked on all cores
+    through a work stealing WorkerPool. There is no GUI. Small images can be
+    upsampled with pyramid_up so small faces are still found; large images
+    are used as they are, which is where most of the time went before.
+
+    Landmarks are streamed to a CSV file:
+        path,face,left,top,right,bottom,x0,y0,...,xN,yN
+    or to a compact binary file (--out ending in .bin), little endian:
+        "LMK1"
+        per image: uint16 path length, path, uint16 face count,
+        per face:  int32 left, top, right, bottom, uint16 part count,
+                   int16 x, y per part
+
+*/
+
+#include <dlib/image_processing/frontal_face_detector.h>
+#include <dlib/image_processing.h>
+#include <dlib/image_io.h>
+
+#include <dirent.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "WorkerPool.h"
+
+using namespace dlib;
+using namespace std;
+
+// ----------------------------------------------------------------------------------------
+
+static bool isImageFile(const string &path)
+{
+    size_t dot = path.rfind('.');
+    if (dot == string::npos)
+        return false;
+
+    string ext = path.substr(dot + 1);
+    std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+    return ext == "jpg" || ext == "jpeg" || ext == "png" || ext == "bmp";
+}
+
+// Expands a directory, a list file or a single image into image paths
+static void collectImages(const string &arg, std::vector<string> &paths)
+{
+    DIR *dir = opendir(arg.c_str());
+    if (dir)
+    {
+        std::vector<string> entries;
+        while (struct dirent *entry = readdir(dir))
+        {
+            string name(entry->d_name);
+            if (isImageFile(name))
+                entries.push_back(arg + "/" + name);
+        }
+        closedir(dir);
+        std::sort(entries.begin(), entries.end());
+        paths.insert(paths.end(), entries.begin(), entries.end());
+    }
+    else if (arg.size() > 4 && arg.compare(arg.size() - 4, 4, ".txt") == 0)
+    {
+        ifstream list(arg);
+        string line;
+        while (getline(list, line))
+            if (!line.empty())
+                paths.push_back(line);
+    }
+    else
+    {
+        paths.push_back(arg);
+    }
+}
+
+// Writes the landmarks of one image, called from the workers under a lock
+class LandmarkWriter
+{
+public:
+    LandmarkWriter(const string &filename) : binary(filename.size() > 4 && filename.compare(filename.size() - 4, 4, ".bin") == 0)
+    {
+        out.open(filename, binary ? ios::out | ios::binary : ios::out);
+        if (binary)
+            out.write("LMK1", 4);
+    }
+
+    bool isOpen() const { return out.is_open(); }
+
+    void write(const string &path, const std::vector<full_object_detection> &shapes)
+    {
+        std::lock_guard<std::mutex> l(mutex);
+
+        if (binary)
+        {
+            put<uint16_t>(path.size());
+            out.write(path.data(), path.size());
+            put<uint16_t>(shapes.size());
+            for (const auto &shape : shapes)
+            {
+                put<int32_t>(shape.get_rect().left());
+                put<int32_t>(shape.get_rect().top());
+                put<int32_t>(shape.get_rect().right());
+                put<int32_t>(shape.get_rect().bottom());
+                put<uint16_t>(shape.num_parts());
+                for (unsigned long k = 0; k < shape.num_parts(); k++)
+                {
+                    put<int16_t>(shape.part(k).x());
+                    put<int16_t>(shape.part(k).y());
+                }
+            }
+            return;
+        }
+
+        for (size_t j = 0; j < shapes.size(); j++)
+        {
+            const rectangle &r = shapes[j].get_rect();
+            out << path << ',' << j << ',' << r.left() << ',' << r.top() << ',' << r.right() << ',' << r.bottom();
+            for (unsigned long k = 0; k < shapes[j].num_parts(); k++)
+                out << ',' << shapes[j].part(k).x() << ',' << shapes[j].part(k).y();
+            out << '\n';
+        }
+    }
+
+private:
+    template <typename T> void put(T value)
+    {
+        out.write(reinterpret_cast<const char *>(&value), sizeof(value));
+    }
+
+    bool binary;
+    ofstream out;
+    std::mutex mutex;
+};
+
+// ----------------------------------------------------------------------------------------
+
+int main(int argc, char** argv)
+{
+    try
+    {
+        if (argc < 3)
+        {
+            cout << "Call this program like this:" << endl;
+            cout << "./face_dlib_batch shape_predictor_68_face_landmarks.dat <dir|list.txt|image>... [options]" << endl;
+            cout << "  --out=<file.csv|file.bin>   landmark output, default landmarks.csv" << endl;
+            cout << "  --threads=<n>               worker threads, default one per core" << endl;
+            cout << "  --upsample-below=<pixels>   pyramid_up images whose longest side is below this, default 800, 0 disables" << endl;
+            return 0;
+        }
+
+        string out_name = "landmarks.csv";
+        unsigned int threads = 0;
+        long upsample_below = 800;
+        std::vector<string> paths;
+
+        for (int i = 2; i < argc; ++i)
+        {
+            string arg(argv[i]);
+            if (arg.compare(0, 6, "--out=") == 0)
+                out_name = arg.substr(6);
+            else if (arg.compare(0, 10, "--threads=") == 0)
+                threads = stoul(arg.substr(10));
+            else if (arg.compare(0, 17, "--upsample-below=") == 0)
+                upsample_below = stol(arg.substr(17));
+            else
+                collectImages(arg, paths);
+        }
+
+        if (paths.empty())
+        {
+            cout << "No images found." << endl;
+            return 0;
+        }
+
+        LandmarkWriter writer(out_name);
+        if (!writer.isOpen())
+        {
+            cout << "Unable to open " << out_name << endl;
+            return 1;
+        }
+
+        // The shape_predictor is only read while predicting and can be shared,
+        // the detector keeps scratch buffers so every worker gets its own copy.
+        shape_predictor sp;
+        deserialize(argv[1]) >> sp;
+
+        WorkerPool pool(threads);
+        std::vector<frontal_face_detector> detectors(pool.size(), get_frontal_face_detector());
+
+        cout << "Processing " << paths.size() << " images on " << pool.size() << " threads..." << endl;
+
+        std::atomic_ulong images_done(0), faces_found(0), failures(0);
+        auto start = chrono::steady_clock::now();
+
+        for (const string &path : paths)
+        {
+            pool.submit([&, path](unsigned int worker)
+            {
+                // Any failure, a broken file or an image too large to upsample,
+                // costs only this image and not the whole batch
+                try
+                {
+                    array2d<rgb_pixel> img;
+                    load_image(img, path);
+
+                    // Only small images need upsampling to find small faces
+                    bool upsampled = std::max(img.nc(), img.nr()) < upsample_below;
+                    if (upsampled)
+                        pyramid_up(img);
+
+                    std::vector<rectangle> dets = detectors[worker](img);
+                    std::vector<full_object_detection> shapes;
+                    shapes.reserve(dets.size());
+                    for (const rectangle &det : dets)
+                    {
+                        full_object_detection shape = sp(img, det);
+                        if (upsampled)
+                        {
+                            // Report in the coordinates of the image on disk
+                            std::vector<point> parts(shape.num_parts());
+                            for (unsigned long k = 0; k < shape.num_parts(); k++)
+                                parts[k] = point(shape.part(k).x() / 2, shape.part(k).y() / 2);
+                            const rectangle &r = shape.get_rect();
+                            shape = full_object_detection(rectangle(r.left() / 2, r.top() / 2, r.right() / 2, r.bottom() / 2), parts);
+                        }
+                        shapes.push_back(shape);
+                    }
+
+                    writer.write(path, shapes);
+                    faces_found += shapes.size();
+                }
+                catch (exception &e)
+                {
+                    cerr << "Unable to process " << path << " : " << e.what() << endl;
+                    failures++;
+                    return;
+                }
+
+                unsigned long done = ++images_done;
+                if (done % 100 == 0)
+                {
+                    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+                    cerr << done << " / " << paths.size() << " images, " << done / seconds << " images/s" << endl;
+                }
+            });
+        }
+
+        pool.wait();
+
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        cout << "Processed " << images_done.load() << " images (" << failures.load() + pool.tasksFailed() << " failed), "
+             << faces_found.load() << " faces in " << seconds << " s: "
+             << images_done.load() / seconds << " images/s, "
+             << pool.tasksStolen() << " tasks stolen." << endl;
+    }
+    catch (exception& e)
+    {
+        cout << "\nexception thrown!" << endl;
+        cout << e.what() << endl;
+    }
+}
+
+// ----------------------------------------------------------------------------------------
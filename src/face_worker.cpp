@@ -0,0 +1,221 @@
+/*
+
+    Face swap worker process for sfml --remote.
+
+    Listens on a Unix or TCP socket and swaps the faces of the jobs the
+    capture host sends (FrameProtocol.h): the pixels around the faces of one
+    frame, the faces found by the host with their track ids and which of them
+    want a new patch. The landmark, warp, colour and blend stages of sfml run
+    here through FaceProcessor and the patches go back in frame coordinates.
+    Colour tables are kept per camera and track as on the host.
+
+    Every connection is served by its own thread, the jobs of a connection
+    one after the other; run one worker per core to use a host. Everything
+    can be tried on one machine:
+
+        ./face_worker --listen=unix:/tmp/faceswap-0.sock &
+        ./face_worker --listen=unix:/tmp/faceswap-1.sock &
+        ./sfml 0 --remote=unix:/tmp/faceswap-0.sock,unix:/tmp/faceswap-1.sock \
+                 --workers=4 --frames-in-flight=4 --stats=5
+
+    Killing a worker moves its jobs to the others, starting it again brings
+    it back within a second. --landmark-width, --mesh-detail and the --lut-*
+    options should match the host's.
+
+*/
+
+#include <opencv2/core.hpp>
+
+#include <dlib/image_processing.h>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "FaceLandmarks.h"
+#include "FaceMesh.h"
+#include "FaceProcessor.h"
+#include "FramePyramid.h"
+#include "FrameProtocol.h"
+#include "ImageKernels.h"
+
+using namespace std;
+
+// Colour tables of every camera the host sends, shared by all connections
+static std::mutex colors_mutex;
+static std::map<uint32_t, std::unique_ptr<FaceColorCache>> colors_by_camera;
+
+// Colour table settings, the same options as sfml's
+static int lutRefresh = 15;
+static double lutDrift = 6, lutSmoothing = 0.3;
+
+static FaceColorCache &colorsFor(uint32_t camera)
+{
+    std::unique_lock<std::mutex> l(colors_mutex);
+    std::unique_ptr<FaceColorCache> &colors = colors_by_camera[camera];
+    if (!colors)
+        colors.reset(new FaceColorCache(lutRefresh, lutDrift, lutSmoothing));
+    return *colors;
+}
+
+static void swapJob(const FaceProcessor &processor, const FrameJob &job, FrameResult &result)
+{
+    // Faces and patches are in frame coordinates, the pixels only cover the crop
+    FaceProcessor::Plan plan;
+    for (size_t i = 0; i < job.faces.size(); i++)
+    {
+        plan.faces.push_back(job.faces[i] - job.crop.tl());
+        plan.tracks.push_back(job.tracks[i]);
+        plan.actions.push_back(job.refresh[i] ? FaceBudget::REFRESH : FaceBudget::REUSE);
+    }
+
+    FramePyramid pyramid(job.pixels);
+    FaceColorCache &colors = colorsFor(job.camera);
+    processor.swap(pyramid, plan, colors, nullptr, result.patches);
+    for (FacePatch &patch : result.patches)
+        patch.rect += job.crop.tl();
+
+    // The host tracks the faces, the tables of the ones it no longer sends are dropped here
+    colors.endFrame(job.tracks);
+}
+
+static void serve(const FaceProcessor *processor, int socket)
+{
+    FrameMessageType type;
+    uint64_t seq;
+    uint32_t camera;
+    std::vector<uint8_t> payload, answer;
+
+    while (receiveMessage(socket, type, seq, camera, payload))
+    {
+        FrameJob job;
+        FrameResult result;
+        if (type != FRAME_JOB || !decodeJob(payload, job))
+        {
+            cerr << "Bad job from the host, closing the connection" << endl;
+            break;
+        }
+        job.seq = seq;
+        job.camera = camera;
+
+        auto start = std::chrono::steady_clock::now();
+        try
+        {
+            swapJob(*processor, job, result);
+        }
+        catch (const std::exception &e)
+        {
+            cerr << "Job " << seq << " failed: " << e.what() << endl;
+            result.status = 1;
+            result.patches.clear();
+        }
+        result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        answer.clear();
+        encodeResult(result, answer);
+        if (!sendMessage(socket, FRAME_RESULT, seq, camera, answer))
+            break;
+    }
+    ::close(socket);
+}
+
+int main(int argc, char **argv)
+{
+    string endpoint, landmarksPath = "shape_predictor_68_face_landmarks.dat", kernelSpec = "auto";
+    int landmarkWidth = LANDMARK_FACE_WIDTH;
+    FaceMesh mesh;
+
+    for (int i = 1; i < argc; i++)
+    {
+        string arg(argv[i]);
+        if (arg.compare(0, 9, "--listen=") == 0)
+            endpoint = arg.substr(9);
+        else if (arg.compare(0, 12, "--landmarks=") == 0)
+            landmarksPath = arg.substr(12);
+        else if (arg.compare(0, 17, "--landmark-width=") == 0)
+            landmarkWidth = std::max(0, atoi(arg.substr(17).c_str()));
+        else if (arg.compare(0, 14, "--mesh-detail=") == 0)
+        {
+            int full = 0, features = 0;
+            if (sscanf(arg.c_str() + 14, "%d,%d", &full, &features) != 2 || full < features)
+            {
+                cout << "Option --mesh-detail needs <full>,<features> with full >= features." << endl;
+                return -1;
+            }
+            mesh = FaceMesh(full, features);
+        }
+        else if (arg.compare(0, 14, "--lut-refresh=") == 0)
+            lutRefresh = std::max(0, atoi(arg.substr(14).c_str()));
+        else if (arg.compare(0, 12, "--lut-drift=") == 0)
+            lutDrift = atof(arg.substr(12).c_str());
+        else if (arg.compare(0, 16, "--lut-smoothing=") == 0)
+            lutSmoothing = atof(arg.substr(16).c_str());
+        else if (arg.compare(0, 10, "--kernels=") == 0)
+            kernelSpec = arg.substr(10);
+        else
+        {
+            cout << "Usage: " << argv[0] << " --listen=<unix:/path|tcp:[host]:port> [--landmarks=<model.dat>]" << endl
+                 << "       [--landmark-width=<px>] [--mesh-detail=<full>,<features>] [--kernels=<auto|generic|sse42|avx2|neon>]" << endl
+                 << "       [--lut-refresh=<frames>] [--lut-drift=<levels>] [--lut-smoothing=<0..1>]" << endl;
+            return arg == "--help" ? 0 : -1;
+        }
+    }
+
+    if (endpoint.empty())
+    {
+        cout << "Give the socket to listen on with --listen=unix:/path or --listen=tcp:[host]:port." << endl;
+        return -1;
+    }
+    if (!selectKernels(kernelSpec))
+    {
+        cout << "Image kernels " << kernelSpec << " are not available on this CPU" << endl;
+        return -1;
+    }
+
+    dlib::shape_predictor model;
+    try
+    {
+        dlib::deserialize(landmarksPath) >> model;
+    }
+    catch (const std::exception &e)
+    {
+        cout << "Unable to read the landmark model " << landmarksPath << ": " << e.what() << endl;
+        return -1;
+    }
+    FaceProcessor processor(model, landmarkWidth, mesh);
+
+    // A host that goes away must not kill the worker with SIGPIPE
+    signal(SIGPIPE, SIG_IGN);
+
+    int listener = listenEndpoint(endpoint);
+    if (listener < 0)
+        return -1;
+    cout << "Face worker listening on " << endpoint << ", kernels " << kernels().name << endl;
+
+    while (true)
+    {
+        int socket = ::accept(listener, nullptr, nullptr);
+        if (socket < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            // Out of descriptors or memory, connections are served again once some are freed
+            cerr << "Unable to accept a connection: " << std::strerror(errno) << endl;
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            continue;
+        }
+        std::thread(serve, &processor, socket).detach();
+    }
+}
@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <atomic>
 #include <iostream>
 #include <string>
@@ -6,6 +7,9 @@
 #include <mutex>
 #include <condition_variable>
 #include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <sstream>
 #include <SFML/Graphics.hpp>
 #include <SFML/Audio.hpp>
 #include <opencv2/highgui.hpp>
@@ -21,174 +25,52 @@
 #include <opencv2/imgproc.hpp>
 #include <opencv2/photo.hpp>
 
+#include "Camera.h"
+#include "FaceBudget.h"
+#include "FaceColorCache.h"
+#include "FaceDetector.h"
+#include "FaceLandmarks.h"
+#include "FaceMesh.h"
+#include "FaceProcessor.h"
 #include "FaceSwapper.h"
+#include "FaceWarp.h"
+#include "FramePool.h"
+#include "FramePyramid.h"
+#include "ImageKernels.h"
+#include "JpegFrame.h"
+#include "MatTrace.h"
+#include "MjpegCapture.h"
+#include "FrameScheduler.h"
+#include "OutputSink.h"
+#include "RemoteWorkerPool.h"
+#include "ThreadConfig.h"
 
 using namespace sf;
 using namespace cv;
 using namespace dlib;
 using namespace std;
 
-#define FACE_DOWNSAMPLE_RATIO 4
-
-std::atomic_int initct(0),initmt(0),stopping(0);
-cv::Mat frameBGR;
-cv::Mat frameRGB;
-std::mutex m;
+std::atomic_int stopping(0);
 shape_predictor pose_model;
+// Faces are shrunk towards this width for the landmark predictor, 0 keeps full resolution
+int landmarkWidth = LANDMARK_FACE_WIDTH;
+// Mesh level of detail by face size
+FaceMesh faceMesh;
 int source_hist_int[3][256];
 int target_hist_int[3][256];
 float source_histogram[3][256];
 float target_histogram[3][256];
-
-class LaplacianBlending {
-private:
-    Mat_<Vec3f> left;
-    Mat_<Vec3f> right;
-    Mat_<float> blendMask;
-
-    std::vector<Mat_<Vec3f> > leftLapPyr,rightLapPyr,resultLapPyr;
-    Mat leftSmallestLevel, rightSmallestLevel, resultSmallestLevel;
-    std::vector<Mat_<Vec3f> > maskGaussianPyramid; //masks are 3-channels for easier multiplication with RGB
-
-    int levels;
-
-
-    void buildPyramids() {
-        buildLaplacianPyramid(left,leftLapPyr,leftSmallestLevel);
-        buildLaplacianPyramid(right,rightLapPyr,rightSmallestLevel);
-        buildGaussianPyramid();
-    }
-
-    void buildGaussianPyramid() {
-        assert(leftLapPyr.size()>0);
-
-        maskGaussianPyramid.clear();
-        Mat currentImg;
-        cvtColor(blendMask, currentImg, CV_GRAY2BGR);
-        maskGaussianPyramid.push_back(currentImg); //highest level
-
-        currentImg = blendMask;
-        for (unsigned int l=1; l<levels+1; l++) {
-            Mat _down;
-            if (leftLapPyr.size() > l) {
-                pyrDown(currentImg, _down, leftLapPyr[l].size());
-            } else {
-                pyrDown(currentImg, _down, leftSmallestLevel.size()); //smallest level
-            }
-
-            Mat down;
-            cvtColor(_down, down, CV_GRAY2BGR);
-            maskGaussianPyramid.push_back(down);
-            currentImg = _down;
-        }
-    }
-
-    void buildLaplacianPyramid(const Mat& img, std::vector<Mat_<Vec3f> >& lapPyr, Mat& smallestLevel) {
-        lapPyr.clear();
-        Mat currentImg = img;
-        for (int l=0; l<levels; l++) {
-            Mat down,up;
-            pyrDown(currentImg, down);
-            pyrUp(down, up, currentImg.size());
-            Mat lap = currentImg - up;
-            lapPyr.push_back(lap);
-            currentImg = down;
-        }
-        currentImg.copyTo(smallestLevel);
-    }
-
-    Mat_<Vec3f> reconstructImgFromLapPyramid() {
-        Mat currentImg = resultSmallestLevel;
-        for (int l=levels-1; l>=0; l--) {
-            Mat up;
-
-            pyrUp(currentImg, up, resultLapPyr[l].size());
-            currentImg = up + resultLapPyr[l];
-        }
-        return currentImg;
-    }
-
-    void blendLapPyrs() {
-        resultSmallestLevel = leftSmallestLevel.mul(maskGaussianPyramid.back()) +
-                                    rightSmallestLevel.mul(Scalar(1.0,1.0,1.0) - maskGaussianPyramid.back());
-        for (int l=0; l<levels; l++) {
-            Mat A = leftLapPyr[l].mul(maskGaussianPyramid[l]);
-            Mat antiMask = Scalar(1.0,1.0,1.0) - maskGaussianPyramid[l];
-            Mat B = rightLapPyr[l].mul(antiMask);
-            Mat_<Vec3f> blendedLevel = A + B;
-
-            resultLapPyr.push_back(blendedLevel);
-        }
-    }
-
-public:
-    LaplacianBlending(const Mat_<Vec3f>& _left, const Mat_<Vec3f>& _right, const Mat_<float>& _blendMask, int _levels):
-    left(_left),right(_right),blendMask(_blendMask),levels(_levels)
-    {
-        assert(_left.size() == _right.size());
-        assert(_left.size() == _blendMask.size());
-        buildPyramids();
-        blendLapPyrs();
-    };
-
-    Mat_<Vec3f> blend() {
-        return reconstructImgFromLapPyramid();
-    }
-};
-
-Mat_<Vec3f> LaplacianBlend(const Mat_<Vec3f>& l, const Mat_<Vec3f>& r, const Mat_<float>& m) {
-    LaplacianBlending lb(l,r,m,4);
-    return lb.blend();
-}
-
-// Apply affine transform calculated using srcTri and dstTri to src
-void applyAffineTransform(Mat &warpImage, Mat &src, std::vector<Point2f> &srcTri, std::vector<Point2f> &dstTri)
-{
-    // Given a pair of triangles, find the affine transform.
-    Mat warpMat = getAffineTransform( srcTri, dstTri );
-
-    // Apply the Affine Transform just found to the src image
-    warpAffine( src, warpImage, warpMat, warpImage.size(), INTER_LINEAR, BORDER_REFLECT_101);
-}
-
-// Warps and alpha blends triangular regions from img1 and img2 to img
-void warpTriangle(Mat &img1, Mat &img2, std::vector<Point2f> &t1, std::vector<Point2f> &t2)
-{
-
-    cv::Rect r1 = boundingRect(t1);
-    cv::Rect r2 = boundingRect(t2);
-
-    // Offset points by left top corner of the respective rectangles
-    std::vector<Point2f> t1Rect, t2Rect;
-    std::vector<Point> t2RectInt;
-    for(int i = 0; i < 3; i++)
-    {
-
-        t1Rect.push_back( Point2f( t1[i].x - r1.x, t1[i].y -  r1.y) );
-        t2Rect.push_back( Point2f( t2[i].x - r2.x, t2[i].y - r2.y) );
-        t2RectInt.push_back( Point(t2[i].x - r2.x, t2[i].y - r2.y) ); // for fillConvexPoly
-
-    }
-
-    // Get mask by filling triangle
-    Mat mask = Mat::zeros(r2.height, r2.width, CV_32FC3);
-    fillConvexPoly(mask, t2RectInt, Scalar(1.0, 1.0, 1.0), 16, 0);
-
-    // Apply warpImage to small rectangular patches
-    Mat img1Rect;
-    img1(r1).copyTo(img1Rect);
-
-    Mat img2Rect = Mat::zeros(r2.height, r2.width, img1Rect.type());
-
-    applyAffineTransform(img2Rect, img1Rect, t1Rect, t2Rect);
-
-    multiply(img2Rect,mask, img2Rect);
-    multiply(img2(r2), Scalar(1.0,1.0,1.0) - mask, img2(r2));
-    img2(r2) = img2(r2) + img2Rect;
-
-
-}
-
+std::vector<std::unique_ptr<Camera>> cameras;
+std::unique_ptr<FrameScheduler> scheduler;
+bool rendering = true;
+// Frames of one camera processed at once by different workers
+unsigned int framesInFlight = 1;
+// The face swap of a frame, run here or handed to face_worker processes
+std::unique_ptr<FaceProcessor> processor;
+std::unique_ptr<RemoteWorkerPool> remoteWorkers;
+// Cameras are captured in MJPEG at this size when it is set
+cv::Size mjpegSize;
+double mjpegFps = 30;
 
 void draw_polyline(cv::Mat &img, const dlib::full_object_detection& d, const int start, const int end, bool isClosed = false)
 {
@@ -222,65 +104,220 @@ void renderFace(cv::Mat &img, const dlib::full_object_detection& d)
 
 }
 
-std::vector <cv::Point2f> get_points(const dlib::full_object_detection& d)
+// Converts the BGR pixels of src into the same sized region of the RGBA image dst,
+// only where mask is set when there is one
+static void convertToRgba(const cv::Mat &src, cv::Mat dst, const cv::Mat &mask = cv::Mat())
 {
-    std::vector <cv::Point2f> points;
-    for (int i = 0; i < 68; ++i)
-    {
-    	points.push_back(cv::Point2f(d.part(i).x(), d.part(i).y()));
-    }
+	auto convert = kernels().bgrToRgba;
+	if (mask.empty())
+	{
+		for (int y = 0; y < src.rows; y++)
+			convert(src.ptr<uint8_t>(y), dst.ptr<uint8_t>(y), src.cols);
+	}
+	else
+	{
+		std::vector<cv::Vec4b> row(src.cols);
+		for (int y = 0; y < src.rows; y++)
+		{
+			convert(src.ptr<uint8_t>(y), reinterpret_cast<uint8_t *>(row.data()), src.cols);
+			const uint8_t *m = mask.ptr<uint8_t>(y);
+			cv::Vec4b *out = dst.ptr<cv::Vec4b>(y);
+			for (int x = 0; x < src.cols; x++)
+				if (m[x])
+					out[x] = row[x];
+		}
+	}
+	matTrace.converted(dst.total() * dst.elemSize());
+}
+
+// Hands the captured BGR frame with the swapped face patches on top to the camera's
+// sinks and, when there is a window, to the renderer. Sinks keep a reference, so
+// frame must not be written to afterwards.
+void publishFrame(Camera &cam, const cv::Mat &frame, const std::vector<FacePatch> &patches, Camera::clock::time_point captureTime)
+{
+	MatTrace::Stage stage("publish");
+	if (!cam.sinks.empty())
+	{
+		// Sinks need whole frames, only they pay for compositing one
+		cv::Mat output;
+		if (patches.empty())
+			output = frame;
+		else
+		{
+			framePool.attach(output);
+			tracedCopy(frame, output);
+			for (const FacePatch &patch : patches)
+				tracedCopy(patch.pixels, output(patch.rect), patch.mask);
+		}
+		for (auto &sink : cam.sinks)
+			sink->push(output);
+	}
+
+	if (rendering)
+	{
+		// The background goes straight from the captured frame into the render
+		// buffer in one conversion, the faces are converted over it
+		std::unique_lock<std::mutex> l(cam.mutex);
+		cam.frameRGB.create(frame.rows, frame.cols, CV_8UC4);
+		convertToRgba(frame, cam.frameRGB);
+		for (const FacePatch &patch : patches)
+			convertToRgba(patch.pixels, cam.frameRGB(patch.rect), patch.mask);
+		cam.outputSeq++;
+	}
 
-    return points;
+	unsigned long latency = std::chrono::duration_cast<std::chrono::microseconds>(Camera::clock::now() - captureTime).count();
+	cam.latencyMicros += latency;
+	// Several workers publish at once, a larger maximum must not be overwritten by a smaller one
+	unsigned long latencyMax = cam.latencyMaxMicros.load();
+	while (latency > latencyMax && !cam.latencyMaxMicros.compare_exchange_weak(latencyMax, latency))
+		;
+	cam.processed++;
 }
 
-// Calculate Delaunay triangles for set of points
-// Returns the vector of indices of 3 points for each triangle
-static void calculateDelaunayTriangles(cv::Rect rect, std::vector<Point2f> &points, std::vector< std::vector<int> > &delaunayTri){
+void signalHandler(int signum)
+{
+	stopping.store(1);
+}
+
+void printStats(double seconds)
+{
+	static std::vector<unsigned long> lastCaptured(cameras.size(), 0), lastProcessed(cameras.size(), 0);
+
+	for (auto &camera : cameras)
+	{
+		Camera &cam = *camera;
+		unsigned long captured = cam.captured.load(), processed = cam.processed.load();
+		unsigned long latency = cam.latencyMicros.exchange(0), latencyMax = cam.latencyMaxMicros.exchange(0);
+		unsigned long done = processed - lastProcessed[cam.index];
+
+		cerr << "Camera " << cam.index << ": capture " << (captured - lastCaptured[cam.index]) / seconds << " fps"
+		     << ", processed " << done / seconds << " fps"
+		     << ", latency " << (done ? latency / done / 1000.0 : 0.0) << " ms (max " << latencyMax / 1000.0 << " ms)"
+		     << ", skipped " << cam.skipped.load();
+		if (cam.targetFps > 0)
+			cerr << ", limited to " << cam.targetFps << " fps";
+		if (framesInFlight > 1)
+		{
+			ReorderBuffer::Stats reorder = cam.reorder->stats();
+			cerr << ", " << framesInFlight << " in flight, reorder wait " << reorder.wait_mean * 1000 << " ms (max " << reorder.wait_max * 1000 << " ms)"
+			     << " held " << reorder.held << " late " << reorder.late;
+		}
+		cerr << ", " << (cam.gate->state() == PresenceGate::IDLE ? "idle" : "active")
+		     << " (active " << cam.gate->secondsIn(PresenceGate::ACTIVE) << " s, idle " << cam.gate->secondsIn(PresenceGate::IDLE) << " s)";
+		FaceColorCache::Stats colors = cam.colors->stats();
+		cerr << ", faces tracked " << colors.tracks << ", colour tables rebuilt " << colors.rebuilds << "/" << colors.lookups;
+		FaceBudget::Stats budget = cam.budget->stats();
+		cerr << ", faces refreshed " << budget.refreshed << " reused " << budget.reused << " skipped " << budget.skipped << " culled " << budget.culled
+		     << ", staleness " << budget.staleness_mean << " frames (max " << budget.staleness_max << ")";
+		if (!budget.faces.empty())
+		{
+			cerr << " [";
+			for (size_t f = 0; f < budget.faces.size(); f++)
+				cerr << (f ? " " : "") << "face " << budget.faces[f].first << ": " << budget.faces[f].second;
+			cerr << "]";
+		}
+		for (auto &sink : cam.sinks)
+			cerr << " | " << sink->name() << " written " << sink->framesWritten()
+			     << " dropped " << sink->framesDropped() << " queued " << sink->queueDepth() << " (max " << sink->queueHighWatermark() << ")";
+		cerr << endl;
+
+		lastCaptured[cam.index] = captured;
+		lastProcessed[cam.index] = processed;
+	}
+
+	FramePool::Stats pool = framePool.stats();
+	unsigned long requests = pool.hits + pool.misses;
+	cerr << "Frame pool: hit rate " << (requests ? 100.0 * pool.hits / requests : 0.0) << " %"
+	     << ", in use " << pool.in_use / 1048576.0 << " MB (peak " << pool.peak_in_use / 1048576.0 << " MB)"
+	     << ", cached " << pool.cached / 1048576.0 << " MB";
+	if (pool.budget)
+		cerr << ", budget " << pool.budget / 1048576.0 << " MB, rejected " << pool.rejected;
+	cerr << " | RSS " << FramePool::currentRss() / 1048576.0 << " MB (peak " << FramePool::peakRss() / 1048576.0 << " MB)" << endl;
+
+	if (remoteWorkers)
+	{
+		RemoteWorkerPool::Stats remote = remoteWorkers->stats();
+		cerr << "Remote workers: " << remote.connected << "/" << remote.workers << " connected"
+		     << ", jobs " << remote.jobs << " resubmitted " << remote.resubmitted << " rejected " << remote.rejected << " timed out " << remote.timed_out << " failed " << remote.failed
+		     << ", round trip " << remote.round_trip * 1000 << " ms, processing " << remote.processing * 1000 << " ms"
+		     << ", efficiency " << remote.efficiency * 100 << " % [";
+		for (size_t w = 0; w < remote.per_worker.size(); w++)
+			cerr << (w ? " " : "") << remote.per_worker[w];
+		cerr << "]" << endl;
+	}
 
-	// Create an instance of Subdiv2D
-    Subdiv2D subdiv(rect);
+	if (mjpegSize.area() > 0)
+	{
+		JpegFrame::Stats jpeg = JpegFrame::stats();
+		cerr << "JPEG decode:";
+		for (const auto &d : jpeg.bgr)
+			cerr << " | BGR 1/" << (1 << d.first) << " " << d.second.frames / seconds << " fps " << d.second.seconds * 1000 / d.second.frames << " ms";
+		for (const auto &d : jpeg.gray)
+			cerr << " | gray 1/" << (1 << d.first) << " " << d.second.frames / seconds << " fps " << d.second.seconds * 1000 / d.second.frames << " ms";
+		cerr << " | failed " << jpeg.failed << endl;
+	}
 
-	// Insert points into subdiv
-    for( std::vector<Point2f>::iterator it = points.begin(); it != points.end(); it++)
-    	if(rect.contains(Point2f(it.base()->x, it.base()->y)))
-    	   subdiv.insert(*it);
+	threadConfig.report(cerr);
+	matTrace.report(cerr);
+}
 
-	std::vector<Vec6f> triangleList;
-	subdiv.getTriangleList(triangleList);
-	std::vector<Point2f> pt(3);
-	std::vector<int> ind(3);
+// Capture of a camera in MJPEG. Frames are handed on compressed, the model
+// workers decode what they need of the frames they actually get to.
+void captureMjpeg(Camera *cam){
 
-	for( size_t i = 0; i < triangleList.size(); i++ )
+	MjpegCapture cap;
+	if (!cap.open(cam->devnum, mjpegSize, mjpegFps))
 	{
-		Vec6f t = triangleList[i];
-		pt[0] = Point2f(t[0], t[1]);
-		pt[1] = Point2f(t[2], t[3]);
-		pt[2] = Point2f(t[4], t[5]);
-
-		if ( rect.contains(pt[0]) && rect.contains(pt[1]) && rect.contains(pt[2])){
-			for(int j = 0; j < 3; j++)
-				for(size_t k = 0; k < points.size(); k++)
-         			if(abs(pt[j].x - points[k].x) < 1.0 && abs(pt[j].y - points[k].y) < 1.0)
-     					ind[j] = k;
-
-			delaunayTri.push_back(ind);
+		cam->state.store(2);
+		return;
+	}
+	std::cout << "MJPEG size " << cap.size().width << " x " << cap.size().height << " at " << cap.fps() << " fps." << endl;
+
+	std::vector<uint8_t> data;
+	while(!stopping.load())
+	{
+		if (!cap.read(data))
+			break;
+		std::shared_ptr<const JpegFrame> jpeg = std::make_shared<JpegFrame>(std::move(data), true);
+		data.clear();
+		// Incomplete frames are dropped here, before anybody waits for them
+		if (jpeg->size().area() == 0)
+		{
+			cam->skipped++;
+			continue;
+		}
+		{
+			std::unique_lock<std::mutex> l(cam->mutex);
+			cam->frameJpeg = jpeg;
+			cam->frameSeq++;
+			cam->frameTime = Camera::clock::now();
 		}
+		cam->captured++;
+		cam->state.store(1);
+		scheduler->frameCaptured(*cam);
 	}
+	std::cout << "Capturethread ending! " << std::endl;
 }
 
-void captureThread(int devnum){
+void captureThread(Camera *cam){
 
-	cout << "Entering captureThread." << endl;
-	cv::VideoCapture cap(devnum); // open the video file for reading
+	cout << "Entering captureThread for /dev/video" << cam->devnum << "." << endl;
+	threadConfig.apply("capture", "capture" + std::to_string(cam->index));
+	MatTrace::Stage stage("capture");
+	if (mjpegSize.area() > 0)
+	{
+		captureMjpeg(cam);
+		return;
+	}
+	cv::VideoCapture cap(cam->devnum); // open the video file for reading
 
 	//cv::Size size(1600, 900);
     cv::Size size(800, 600);
 	cv::Mat capBGROrig;
-	cv::Mat capBGR;
 
     if(!cap.isOpened())
 	{
-    	initct.store(2);
+    	cam->state.store(2);
         return;
 	}
 	//cap.set(CV_CAP_PROP_FRAME_WIDTH,1920);   // width pixels
@@ -295,43 +332,98 @@ void captureThread(int devnum){
 	while(!stopping.load())
     {
 		cap >> capBGROrig;
-		cv::flip(capBGROrig, capBGROrig, 1);
-        cv::resize(capBGROrig, capBGR, size);
-        if(capBGR.empty())
+        if(capBGROrig.empty())
         {
             break;
         }
-        std::unique_lock<std::mutex> l(m);
-        frameBGR = capBGR.clone();
-        initct.store(1);
+        // Every frame gets a buffer of its own from the pool, the previous one
+        // goes back to the pool once the workers and sinks let go of it.
+        // Mirroring writes straight into it, resizing only happens when the
+        // camera did not accept the requested size.
+        cv::Mat capBGR;
+        framePool.attach(capBGR);
+        try
+        {
+            if (capBGROrig.size() == size)
+                cv::flip(capBGROrig, capBGR, 1);
+            else
+            {
+                cv::flip(capBGROrig, capBGROrig, 1);
+                cv::resize(capBGROrig, capBGR, size);
+            }
+        }
+        catch (const cv::Exception &e)
+        {
+            // Over the memory budget the frame is dropped, the next one may fit again
+            if (e.code != cv::Error::StsNoMem)
+                throw;
+            cam->skipped++;
+            cam->state.store(1);
+            continue;
+        }
+        {
+            std::unique_lock<std::mutex> l(cam->mutex);
+            cam->frameBGR = capBGR;
+            cam->frameSeq++;
+            cam->frameTime = Camera::clock::now();
+        }
+        cam->captured++;
+        cam->state.store(1);
+        scheduler->frameCaptured(*cam);
     }
 	std::cout << "Capturethread ending! " << std::endl;
 }
 
 void renderingThread(sf::RenderWindow *window)
 {
-	sf::Image image;
-	sf::Texture texture;
-	sf::Sprite sprite;
+	threadConfig.apply("render", "render");
+
+	// Cameras are tiled in a grid, a single camera is shown as it is
+	unsigned int columns = (unsigned int)std::ceil(std::sqrt((double)cameras.size()));
+	unsigned int rows = (cameras.size() + columns - 1) / columns;
+	float tileWidth = (float)window->getSize().x / columns;
+	float tileHeight = (float)window->getSize().y / rows;
+
+	std::vector<sf::Texture> textures(cameras.size());
+	std::vector<sf::Sprite> sprites(cameras.size());
+	std::vector<unsigned long> shownSeq(cameras.size(), 0);
 
     // the rendering loop
     while (window->isOpen())
     {
+    	for (size_t i = 0; i < cameras.size(); i++)
     	{
-    	  std::unique_lock<std::mutex> l(m);
-    	  image.create(frameRGB.cols, frameRGB.rows, frameRGB.ptr());
+    	  Camera &cam = *cameras[i];
+    	  std::unique_lock<std::mutex> l(cam.mutex);
+    	  if (cam.outputSeq == shownSeq[i] || cam.frameRGB.empty())
+    		  continue;
+
+    	  if (textures[i].getSize() != sf::Vector2u(cam.frameRGB.cols, cam.frameRGB.rows))
+    	  {
+    		  if (!textures[i].create(cam.frameRGB.cols, cam.frameRGB.rows))
+    			  continue;
+    		  sprites[i].setTexture(textures[i], true);
+    		  if (cameras.size() > 1)
+    		  {
+    			  float scale = std::min(tileWidth / cam.frameRGB.cols, tileHeight / cam.frameRGB.rows);
+    			  sprites[i].setScale(scale, scale);
+    			  sprites[i].setPosition((i % columns) * tileWidth, (i / columns) * tileHeight);
+    		  }
+    	  }
+    	  // Every published frame has a new background, the whole buffer goes up
+    	  textures[i].update(cam.frameRGB.data);
+    	  shownSeq[i] = cam.outputSeq;
     	}
 
-        if (!texture.loadFromImage(image))
-        {
-            break;
-        }
-
-        sprite.setTexture(texture);
-
-        window->draw(sprite);
+    	window->clear();
+    	for (size_t i = 0; i < sprites.size(); i++)
+    		if (shownSeq[i])
+    			window->draw(sprites[i]);
         window->display();
 
+		if (stopping.load())
+			window->close();
+
 		sf::Event event;
 		/* Some workload may be here */
         while (window->pollEvent(event))
@@ -351,281 +443,505 @@ void renderingThread(sf::RenderWindow *window)
     }
 }
 
-void modelThread(){
-  // Load face detection and pose estimation models.
-  frontal_face_detector detector = get_frontal_face_detector();
-
-  while(!stopping.load())
-  {
-    try
+// A worker's result may only paste inside the frame, with pixels and a mask of
+// its rectangle, over a face the plan refreshes and showing the face the plan
+// gives it
+static bool fitsPlan(const FrameResult &result, const FaceProcessor::Plan &plan, const cv::Rect &frameRect)
+{
+	for (const FacePatch &patch : result.patches)
 	{
+		if (patch.rect.area() <= 0 || (patch.rect & frameRect) != patch.rect)
+			return false;
+		if (patch.pixels.type() != CV_8UC3 || patch.pixels.size() != patch.rect.size() ||
+		    patch.mask.type() != CV_8UC1 || patch.mask.size() != patch.rect.size())
+			return false;
+
+		bool planned = false;
+		for (size_t k = 0; k < plan.faces.size() && !planned; k++)
+		{
+			size_t s = (k + plan.faces.size() - 1) % plan.faces.size();
+			planned = plan.tracks[k] == patch.track && plan.tracks[s] == patch.source_track && plan.actions[k] == FaceBudget::REFRESH;
+		}
+		if (!planned)
+			return false;
+	}
+	return true;
+}
 
-	  std::vector<dlib::rectangle> faces;
-      cv::Mat modelBGR;
-      cv::Mat modelBGRWarped;
-      cv::Mat modelBGRsmall;
+// Has one of the face_worker processes swap the planned faces of a frame. Only
+// the pixels around the faces are sent, faces that are not refreshed reuse
+// their last patch here. False when no worker could take the job, the caller
+// then swaps the frame itself.
+bool swapRemotely(Camera &cam, const cv::Mat &frame, const FaceProcessor::Plan &plan, std::vector<FacePatch> &patches){
 
-	  {
-    	  std::unique_lock<std::mutex> l(m);
-		  modelBGR = frameBGR.clone();
-		  modelBGRWarped = frameBGR.clone();
-	  }
+	if (plan.faces.size() < 2)
+		return true;
 
-	  cv::resize(modelBGR, modelBGRsmall, cv::Size(), 1.0/FACE_DOWNSAMPLE_RATIO, 1.0/FACE_DOWNSAMPLE_RATIO);
-	  cv_image<bgr_pixel> cimg(modelBGRsmall);
-	  cv_image<bgr_pixel> img(modelBGR);
+	// Every face with half a face around it, the hulls reach past the detections
+	cv::Rect frameRect(0, 0, frame.cols, frame.rows);
+	FrameJob job;
+	job.camera = cam.index;
+	for (size_t k = 0; k < plan.faces.size(); k++)
+	{
+		const cv::Rect &face = plan.faces[k];
+		cv::Rect around(face.x - face.width / 2, face.y - face.height / 2, face.width * 2, face.height * 2);
+		job.crop = job.crop.area() ? (job.crop | around) : around;
+		job.faces.push_back(face);
+		job.tracks.push_back(plan.tracks[k]);
+		job.refresh.push_back(plan.actions[k] == FaceBudget::REFRESH);
+	}
+	job.crop &= frameRect;
+	job.pixels = frame(job.crop);
+
+	FrameResult result;
+	auto fits = [&](const FrameResult &r) { return fitsPlan(r, plan, frameRect); };
+	if (!remoteWorkers->process(job, result, fits) || result.status != 0)
+		return false;
+
+	MatTrace::Stage stage("reuse");
+	FaceBudget &budget = *cam.budget;
+	double refreshedArea = 0;
+	for (size_t k = 0; k < plan.faces.size(); k++)
+	{
+		size_t s = (k + plan.faces.size() - 1) % plan.faces.size();
+		FacePatch patch;
+		if (plan.actions[k] == FaceBudget::REUSE && budget.reusePatch(plan.tracks[k], plan.tracks[s], plan.faces[k], frameRect, patch))
+			patches.push_back(patch);
+	}
+	for (const FacePatch &patch : result.patches)
+	{
+		for (size_t k = 0; k < plan.faces.size(); k++)
+		{
+			if (plan.tracks[k] != patch.track)
+				continue;
+			// The landmarks stay on the worker, only where the face was is kept
+			// so its patch can follow it
+			budget.storeLandmarks(patch.track, plan.faces[k], std::vector<Point2f>(), std::vector<std::vector<int>>());
+			refreshedArea += plan.faces[k].area();
+		}
+		budget.storePatch(patch.track, patch.source_track, patch);
+		patches.push_back(patch);
+	}
+	budget.refreshed(result.seconds, refreshedArea);
+	return true;
+}
 
-      // Detect faces
-	  faces = detector(cimg);
-	  if (faces.size() == 0)
-	  {
-	   	//cout << "No faces detected." << endl;
-		std::unique_lock<std::mutex> l(m);
-	   	cv::cvtColor(modelBGR, frameRGB, cv::COLOR_BGR2RGBA);
-	   	initmt.store(1);
-	   	continue;
-	  }
+// One of the shared model workers, takes due frames from any camera
+void modelThread(std::string detectorSpec){
 
-      std::vector<full_object_detection> shapes;
-      std::vector<std::vector<Point2f>> points;
-      std::vector<std::vector<Point2f>> hulls;
-      std::vector<std::vector< std::vector<int> >> dts;
-
-      //cout << "There were " << faces.size() << " faces detected." << endl;
-
-      //convert to float
-      //cv::Mat imgOrig;
-      //frameRGB.convertTo(imgOrig, CV_32F);
-      //cv::Mat imgNew = imgOrig.clone();
-
-      for (unsigned long i = 0; i < faces.size(); ++i)
-      {
-    	full_object_detection shape;
-    	std::vector<Point2f> point;
-    	std::vector<Point2f> hull;
-    	std::vector<int> hullIndex;
-    	std::vector<std::vector<int>> dt;
-
-       	// Resize obtained rectangle for full resolution image.
-        dlib::rectangle r(
-         (long)(faces[i].left() * FACE_DOWNSAMPLE_RATIO),
-         (long)(faces[i].top() * FACE_DOWNSAMPLE_RATIO),
-         (long)(faces[i].right() * FACE_DOWNSAMPLE_RATIO),
-         (long)(faces[i].bottom() * FACE_DOWNSAMPLE_RATIO)
-        );
-      	// Landmark detection on full sized image
-      	shape = pose_model(img, r);
-      	point = get_points(shape);
-
-      	/*
-      	//calculate forehead left
-    	point.push_back(cv::Point2f((point[5].x+point[18].x)/2,point[18].y-0.25*(point[5].y-point[18].y)));
-        //calculate forehead middle
-        point.push_back(cv::Point2f((point[8].x+point[27].x)/2,point[27].y-0.25*(point[8].y-point[27].y)));
-        //calculate forehead right
-        point.push_back(cv::Point2f((point[11].x+point[25].x)/2,point[25].y-0.25*(point[11].y-point[25].y)));
-		*/
-
-      	//find convex hull
-        convexHull(point, hullIndex, false, false);
-
-        for(int i = 0; i < (int)hullIndex.size(); i++)
-        {
-            hull.push_back(point[hullIndex[i]]);
-        }
+  threadConfig.apply("model", "model");
 
-        cv::Rect rect(0, 0, modelBGR.cols, modelBGR.rows);
-
-        calculateDelaunayTriangles(rect, point, dt);
-
-        //save
-        hulls.push_back(hull);
-        points.push_back(point);
-      	shapes.push_back(shape);
-      	dts.push_back(dt);
-      }
-
-      /*
-
-      for (unsigned long i = 0; i < shapes.size(); i++){
-               	 renderFace(modelBGR, shapes[i]);
-      }
-
-      std::vector<cv::Point> hullpoint;
-
-      for (unsigned long i = 0; i < hulls.size(); i++){
-             hullpoint.clear();
-             hullpoint.resize(hulls[i].size());
-       	     //transform point2f to point2i
-    	     std::transform(hulls[i].begin(),hulls[i].end(),hullpoint.begin(),[](Point2f point2f){return (Point) point2f;});
-    	     cv::polylines(modelBGR, hullpoint, true, cv::Scalar(255,0,0), 4, CV_AA);
-      }
-
-      Scalar delaunay_color(255,255,255);
-
-      for (unsigned long i = 0; i < dts.size(); i++)
-      {
-    	  for (unsigned long k = 0; k < dts[i].size(); k++)
-              {
-                  cv::line(modelBGR,
-                		   points[i][dts[i][k][0]],
-						   points[i][dts[i][k][1]],
-                		   delaunay_color, 1, CV_AA, 0);
-                  cv::line(modelBGR,
-                		   points[i][dts[i][k][1]],
-						   points[i][dts[i][k][2]],
-                		   delaunay_color, 1, CV_AA, 0);
-                  cv::line(modelBGR,
-                		   points[i][dts[i][k][2]],
-						   points[i][dts[i][k][0]],
-                		   delaunay_color, 1, CV_AA, 0);
-
-              }
-      }
-	  */
-      //convert Mat to float data type
-      modelBGR.convertTo(modelBGR, CV_32F);
-      modelBGRWarped.convertTo(modelBGRWarped, CV_32F);
-
-      // Apply affine transformation to Delaunay triangles
-      if (dts.size() > 1)
-      {
-    	for(unsigned int i = 0; i < dts.size(); i++)
-    	{
-      	  for(unsigned int k = 0; k < dts[i].size(); k++)
-            {
-              std::vector<Point2f> t1, t2;
-              // Get points for img1, img2 corresponding to the triangles
-      		  for(size_t j = 0; j < 3; j++)
-                {
-      			  t1.push_back(points[i][dts[i][k][j]]);
-       		      t2.push_back(points[((i+1) % dts.size())][dts[i][k][j]]);
-      		    }
+  // Detectors keep scratch buffers, so every worker has its own
+  std::unique_ptr<FaceDetector> detector = FaceDetector::create(detectorSpec);
 
-              warpTriangle(modelBGR, modelBGRWarped, t1, t2);
-            }
-      	}
-      }
-      else
-      {
-    	  modelBGRWarped = modelBGR.clone();
-      }
-
-      modelBGRWarped.convertTo(modelBGRWarped, CV_8UC3);
-      modelBGR.convertTo(modelBGR, CV_8UC3);
-      FaceSwapper face_swapper;
-
-      if (hulls.size() > 1)
-      // Calculate mask
-      for(unsigned int i = 0; i < hulls.size(); i++)
-      {
-    	  std::vector<Point> hull8U;
-    	  hull8U.clear();
-          cv::Rect r = boundingRect(hulls[i]);
-
-          for(unsigned int k = 0; k < hulls[i].size(); k++)
-          {
-        	  Point pt(hulls[i][k].x, hulls[i][k].y);
-              hull8U.push_back(pt);
-          }
-
-          Mat mask = Mat::zeros(modelBGR.rows, modelBGR.cols, modelBGR.depth());
-
-          fillConvexPoly(mask,&hull8U[0], hull8U.size(), Scalar(255,0,0));
-          Mat output;
-          face_swapper.specifiyHistogram(modelBGR(r), modelBGRWarped(r), mask(r));
-
-          mask.convertTo(mask,CV_32F,1.0/255.0);
-          Mat_<Vec3f> left; modelBGRWarped.convertTo(left,CV_32F,1.0/255.0);
-          Mat_<Vec3f> right; modelBGR.convertTo(right,CV_32F,1.0/255.0);
-          Mat_<Vec3f> blend = LaplacianBlend(left(r), right(r), mask(r));
-          modelBGRWarped.convertTo(modelBGRWarped, CV_32F, 1.0/255.0);
-          blend.copyTo(modelBGRWarped(r));
-          modelBGRWarped.convertTo(modelBGRWarped,CV_8UC3,255);
-
-          /*
-          seamlessClone(modelBGRWarped(r),modelBGR(r), mask(r),
-        		  Point(modelBGR(r).cols / 2, modelBGR(r).rows / 2), output, NORMAL_CLONE);
-          output.copyTo(modelBGRWarped(r));
-          */
-      }
-
-      std::unique_lock<std::mutex> l(m);
-      	  cv::cvtColor(modelBGRWarped, frameRGB, cv::COLOR_BGR2RGBA);
-
-      initmt.store(1);
-	}
+  Camera *cam;
+  cv::Mat frame;
+  std::shared_ptr<const JpegFrame> jpeg;
+  unsigned long seq;
+  Camera::clock::time_point captureTime;
 
+  while(scheduler->next(cam, frame, jpeg, seq, captureTime))
+  {
+	auto start = Camera::clock::now();
+	ReorderBuffer::Frame done;
+	done.seq = seq;
+	done.captureTime = captureTime;
+	bool processed = false;
+    try
+	{
+	  MatTrace::Stage stage("gate");
+	  // MJPEG frames are decoded at full resolution only once they go out,
+	  // the gate and the detector get their smaller levels from the scaled IDCT
+	  FramePyramid pyramid = jpeg ? FramePyramid(jpeg) : FramePyramid(frame);
+	  // Idle frames, nobody in front of the camera, go out without patches
+	  if (cam->gate->needsModel(pyramid))
+	  {
+		size_t faces;
+		if (remoteWorkers)
+		{
+			// Detection and planning need the camera's state and stay here,
+			// the swap itself goes to a worker process when one is reachable
+			FaceProcessor::Plan plan;
+			faces = processor->plan(pyramid, *detector, *cam->colors, *cam->budget, plan);
+			if (!swapRemotely(*cam, pyramid.bgr(0), plan, done.patches))
+			{
+				done.patches.clear();
+				processor->swap(pyramid, plan, *cam->colors, cam->budget.get(), done.patches);
+			}
+		}
+		else
+			faces = processor->process(pyramid, *detector, *cam->colors, *cam->budget, done.patches);
+		cam->gate->facesFound(faces);
+	  }
+	  done.frame = pyramid.bgr(0);
+	  processed = true;
+	}
 	catch(const std::exception& e)
 	{
 	   cout << "Exception : " << e.what() << endl;
 	}
 
-
-   }
+	// Frames of a camera go out in capture order, whichever worker finishes first
+	try
+	{
+	  Camera &c = *cam;
+	  auto publish = [&c](const ReorderBuffer::Frame &f) { publishFrame(c, f.frame, f.patches, f.captureTime); };
+	  if (processed)
+		cam->reorder->finished(std::move(done), publish);
+	  else
+		cam->reorder->abandoned(seq, publish);
+	}
+	catch(const std::exception& e)
+	{
+	   cout << "Exception : " << e.what() << endl;
+	}
+	matTrace.frameDone();
+	scheduler->finished(*cam, std::chrono::duration<double>(Camera::clock::now() - start).count());
+  }
 
 }
 
 int main(int argc, char** argv){
 
-	if (argc != 2)
+	if (argc < 2)
 	{
-	  cout << "Call this program with a single digit number to indicate the /dev/video(x) input to use." << endl;
+	  cout << "Call this program with a single digit number to indicate the /dev/video(x) input to use," << endl;
+	  cout << "or a comma separated list like 0,1 to run several cameras." << endl;
+	  cout << "Options: --sink=<type[:target][,queue=N][,drop=oldest|newest|block]> (repeatable, runs without a window)," << endl;
+	  cout << "         --window (keep the window when sinks are given), --stats=<seconds>," << endl;
+	  cout << "         --detector=<hog|haar|lbp>[:cascade.xml] (default hog)," << endl;
+	  cout << "         --workers=<n> (model threads shared by all cameras, default one per core)," << endl;
+	  cout << "         --frames-in-flight=<n> (frames of one camera processed at once, put back in capture order, default 1)," << endl;
+	  cout << "         --reorder-wait=<ms> (longest a frame waits for earlier ones, which are dropped when they come later, default 100)," << endl;
+	  cout << "         --memory-budget=<MB> (limit for pooled frame buffers, frames over it are dropped)," << endl;
+	  cout << "         --thread=<main|capture|model|render|audio|sink>:[cpu=N][,policy=other|fifo][,prio=N][,nice=N] (repeatable)," << endl;
+	  cout << "         --idle-after=<seconds> (go idle without faces, default 10, 0 never), --idle-motion-hz=<n> (default 4)," << endl;
+	  cout << "         --lut-refresh=<frames> (rebuild colour tables at least this often, default 15, 0 every frame)," << endl;
+	  cout << "         --lut-drift=<levels> (rebuild earlier when a channel mean or deviation moves this much, default 6)," << endl;
+	  cout << "         --lut-smoothing=<0..1> (weight of a rebuilt colour table, 1 disables smoothing, default 0.3)," << endl;
+	  cout << "         --kernels=<auto|generic|sse42|avx2|neon> (pixel loop variant, default auto picks the best the CPU supports)," << endl;
+	  cout << "         --face-budget=<ms> (face refresh time per frame, other faces reuse their last swap, default 40, 0 unlimited)," << endl;
+	  cout << "         --face-min-size=<px> (smaller faces are not swapped, default 40)," << endl;
+	  cout << "         --face-max-stale=<frames> (oldest swap shown before a face is left alone, default 5)," << endl;
+	  cout << "         --landmark-width=<px> (larger faces get their landmarks on a smaller pyramid level, default 100, 0 full resolution)," << endl;
+	  cout << "         --mesh-detail=<full>,<features> (faces of at least full² pixels are warped with all triangles, of at least features²" << endl;
+	  cout << "         with the reduced mesh and smaller ones in one piece, default 120,60, 0,0 always all triangles)," << endl;
+	  cout << "         --mjpeg=<width>x<height>[@<fps>] (capture compressed frames, the detector's levels are decoded at 1/2 to 1/8 scale," << endl;
+	  cout << "         full resolution only for frames that are shown, default off)," << endl;
+	  cout << "         --remote=<endpoint>[,<endpoint>...] (swap faces in face_worker processes at unix:/path or tcp:host:port," << endl;
+	  cout << "         detection stays here, keep --workers and --frames-in-flight at least the number of worker cores busy)," << endl;
+	  cout << "         --remote-timeout=<ms> (a job not answered in time is sent to another worker, default 2000)," << endl;
+	  cout << "         --mat-trace[=<trace.json>] (count image allocations, copies and conversions per stage, shown with --stats," << endl;
+	  cout << "         and written per frame as counters for chrome://tracing or Perfetto)." << endl;
+	  cout << "Sink types: null, raw-bgr, raw-rgba, y4m (target is a file, FIFO or - for stdout, [,fps=N]), png, jpg (target is a file pattern or directory)," << endl;
+	  cout << "            record (target is a video file, [,codec=mjpg|ffv1][,fps=N]), mjpeg (target is [address:]port, [,quality=N])," << endl;
+	  cout << "            shm (target is a shared memory name like /faceswap, [,slots=N], read it with shm_reader_example)," << endl;
+	  cout << "            record, mjpeg and shm keep the window." << endl;
+	  cout << "With several cameras {cam} in a sink target is replaced by the camera index." << endl;
 	  return 0;
     }
 
-	if (!(isdigit(argv[1][0])))
+	std::stringstream devices(argv[1]);
+	std::string device;
+	while (std::getline(devices, device, ','))
+	{
+		if (device.empty() || !(isdigit(device[0])))
+		{
+	      cout << "Parameter " << device << " is not a number." << endl;
+	      return 0;
+		}
+		cameras.emplace_back(new Camera(cameras.size(), atoi(device.c_str())));
+	}
+
+	bool forceWindow = false;
+	int statsInterval = 0;
+	std::string detectorSpec = "hog";
+	std::vector<std::string> sinkSpecs;
+	unsigned int workers = std::max(1u, std::thread::hardware_concurrency());
+	double idleAfter = 10, idleMotionHz = 4;
+	int lutRefresh = 15;
+	double lutDrift = 6, lutSmoothing = 0.3;
+	std::string kernelSpec = "auto";
+	double faceBudgetMs = 40;
+	int faceMinSize = 40, faceMaxStale = 5;
+	double reorderWaitMs = 100;
+	std::vector<std::string> remoteEndpoints;
+	double remoteTimeoutMs = 2000;
+
+	for (int i = 2; i < argc; i++)
+	{
+		std::string arg(argv[i]);
+		if (arg.compare(0, 7, "--sink=") == 0)
+			sinkSpecs.push_back(arg.substr(7));
+		else if (arg == "--window")
+			forceWindow = true;
+		else if (arg.compare(0, 11, "--detector=") == 0)
+			detectorSpec = arg.substr(11);
+		else if (arg.compare(0, 10, "--workers=") == 0)
+			workers = std::max(1, atoi(arg.substr(10).c_str()));
+		else if (arg.compare(0, 19, "--frames-in-flight=") == 0)
+			framesInFlight = std::max(1, atoi(arg.substr(19).c_str()));
+		else if (arg.compare(0, 15, "--reorder-wait=") == 0)
+			reorderWaitMs = atof(arg.substr(15).c_str());
+		else if (arg.compare(0, 8, "--stats=") == 0)
+			statsInterval = atoi(arg.substr(8).c_str());
+		else if (arg.compare(0, 13, "--idle-after=") == 0)
+			idleAfter = atof(arg.substr(13).c_str());
+		else if (arg.compare(0, 17, "--idle-motion-hz=") == 0)
+			idleMotionHz = atof(arg.substr(17).c_str());
+		else if (arg.compare(0, 14, "--lut-refresh=") == 0)
+			lutRefresh = std::max(0, atoi(arg.substr(14).c_str()));
+		else if (arg.compare(0, 12, "--lut-drift=") == 0)
+			lutDrift = atof(arg.substr(12).c_str());
+		else if (arg.compare(0, 16, "--lut-smoothing=") == 0)
+			lutSmoothing = atof(arg.substr(16).c_str());
+		else if (arg.compare(0, 10, "--kernels=") == 0)
+			kernelSpec = arg.substr(10);
+		else if (arg == "--mat-trace" || arg.compare(0, 12, "--mat-trace=") == 0)
+		{
+			if (!matTrace.enable(arg.size() > 12 ? arg.substr(12) : ""))
+			{
+				cout << "Unable to write the trace to " << arg.substr(12) << endl;
+				return -1;
+			}
+		}
+		else if (arg.compare(0, 14, "--face-budget=") == 0)
+			faceBudgetMs = atof(arg.substr(14).c_str());
+		else if (arg.compare(0, 16, "--face-min-size=") == 0)
+			faceMinSize = atoi(arg.substr(16).c_str());
+		else if (arg.compare(0, 17, "--face-max-stale=") == 0)
+			faceMaxStale = atoi(arg.substr(17).c_str());
+		else if (arg.compare(0, 17, "--landmark-width=") == 0)
+			landmarkWidth = std::max(0, atoi(arg.substr(17).c_str()));
+		else if (arg.compare(0, 14, "--mesh-detail=") == 0)
+		{
+			int full = 0, features = 0;
+			if (sscanf(arg.c_str() + 14, "%d,%d", &full, &features) != 2 || full < features)
+			{
+				cout << "Option --mesh-detail needs <full>,<features> with full >= features." << endl;
+				return -1;
+			}
+			faceMesh = FaceMesh(full, features);
+		}
+		else if (arg.compare(0, 8, "--mjpeg=") == 0)
+		{
+			int width = 0, height = 0;
+			if (sscanf(arg.c_str() + 8, "%dx%d@%lf", &width, &height, &mjpegFps) < 2 || width <= 0 || height <= 0)
+			{
+				cout << "Option --mjpeg needs <width>x<height>[@<fps>]." << endl;
+				return -1;
+			}
+			mjpegSize = cv::Size(width, height);
+		}
+		else if (arg.compare(0, 9, "--remote=") == 0)
+		{
+			std::stringstream endpoints(arg.substr(9));
+			std::string endpoint;
+			while (std::getline(endpoints, endpoint, ','))
+				if (!endpoint.empty())
+					remoteEndpoints.push_back(endpoint);
+		}
+		else if (arg.compare(0, 17, "--remote-timeout=") == 0)
+			remoteTimeoutMs = atof(arg.substr(17).c_str());
+		else if (arg.compare(0, 9, "--thread=") == 0)
+		{
+			if (!threadConfig.parse(arg.substr(9)))
+				return -1;
+		}
+		else if (arg.compare(0, 16, "--memory-budget=") == 0)
+			framePool.setBudget((size_t)atoi(arg.substr(16).c_str()) * 1048576);
+		else
+		{
+			cout << "Unknown option " << arg << endl;
+			return -1;
+		}
+	}
+
+	// Every camera gets its own instance of each sink
+	for (auto &camera : cameras)
+	{
+		camera->gate.reset(new PresenceGate(idleAfter, idleMotionHz));
+		camera->colors.reset(new FaceColorCache(lutRefresh, lutDrift, lutSmoothing));
+		camera->budget.reset(new FaceBudget(faceBudgetMs / 1000.0, faceMinSize, faceMaxStale));
+		camera->reorder.reset(new ReorderBuffer(reorderWaitMs / 1000.0));
+
+		for (std::string spec : sinkSpecs)
+		{
+			size_t placeholder = spec.find("{cam}");
+			if (placeholder != std::string::npos)
+				spec.replace(placeholder, 5, std::to_string(camera->index));
+			else if (cameras.size() > 1 && spec.compare(0, 4, "null") != 0)
+			{
+				cout << "Sink " << spec << " needs {cam} in its target when there are several cameras." << endl;
+				return -1;
+			}
+
+			// Sinks that write a frame rate get the one the cameras are opened with
+			std::unique_ptr<OutputSink> sink = OutputSink::create(spec, mjpegSize.area() > 0 ? mjpegFps : 30);
+			if (!sink)
+				return -1;
+			camera->sinks.push_back(std::move(sink));
+		}
+	}
+
+	// Recording, the preview server and shared memory go along with the live view, any other sink replaces it
+	auto keepsWindow = [](const std::string &spec)
+	{
+		return spec.compare(0, 6, "record") == 0 || spec.compare(0, 5, "mjpeg") == 0 || spec.compare(0, 3, "shm") == 0;
+	};
+	rendering = forceWindow || std::all_of(sinkSpecs.begin(), sinkSpecs.end(), keepsWindow);
+
+	// Frames written to stdout must not get mixed up with log output
+	for (auto &camera : cameras)
+		for (auto &sink : camera->sinks)
+			if (sink->usesStdout())
+				cout.rdbuf(cerr.rdbuf());
+
+	threadConfig.apply("main", "sfml");
+
+	std::signal(SIGINT, signalHandler);
+	std::signal(SIGTERM, signalHandler);
+	// A FIFO reader going away must not kill the process
+	std::signal(SIGPIPE, SIG_IGN);
+
+	{
+		std::unique_ptr<FaceDetector> detector = FaceDetector::create(detectorSpec);
+		if (!detector)
+			return -1;
+		cout << "Using the " << detector->name() << " face detector on " << workers << " model threads";
+		if (framesInFlight > 1)
+			cout << ", up to " << framesInFlight << " frames per camera at once";
+		cout << "." << endl;
+		if (framesInFlight > workers)
+			cout << "Only " << workers << " of the " << framesInFlight << " frames in flight can be processed at once, raise --workers." << endl;
+	}
+
 	{
-      cout << "Parameter " << argv[1][0] << " is not a number." << endl;
-      return 0;
+		std::string available;
+		for (const std::string &name : availableKernels())
+			available += (available.empty() ? "" : " ") + name;
+		if (!selectKernels(kernelSpec))
+		{
+			cout << "Image kernels " << kernelSpec << " are not available on this CPU, choose from: " << available << endl;
+			return -1;
+		}
+		cout << "Image kernels: " << kernels().name << " (available: " << available << ")" << endl;
 	}
 
 	cout << "Reading in shape predictor..." << endl;
 	deserialize("shape_predictor_68_face_landmarks.dat") >> pose_model;
 	cout << "Done reading in shape predictor..." << endl;
+	processor.reset(new FaceProcessor(pose_model, landmarkWidth, faceMesh));
 
-    std::thread ct = std::thread(captureThread, atoi(argv[1]));
+	if (!remoteEndpoints.empty())
+	{
+		remoteWorkers.reset(new RemoteWorkerPool(remoteEndpoints, remoteTimeoutMs / 1000.0));
+		RemoteWorkerPool::Stats remote = remoteWorkers->stats();
+		cout << "Swapping faces in " << remote.connected << " of " << remote.workers << " remote workers"
+		     << ", frames are swapped here while none is connected." << endl;
+	}
 
-	while(!initct.load());
-    if (initct.load() == 2)
-			{
-			   cout << "Unable to open webcam /dev/video" << argv[1][0] << endl;
-               ct.join();
-			   return -1;
-			}
+	std::vector<Camera *> scheduled;
+	for (auto &camera : cameras)
+		scheduled.push_back(camera.get());
+	scheduler.reset(new FrameScheduler(scheduled, workers, framesInFlight));
 
-    std::thread mt = std::thread(modelThread);
+	for (auto &camera : cameras)
+		camera->thread = std::thread(captureThread, camera.get());
 
-	while(!initmt.load());
+	bool opened = true;
+	for (auto &camera : cameras)
+	{
+		while(!camera->state.load());
+		if (camera->state.load() == 2)
+		{
+			cout << "Unable to open webcam /dev/video" << camera->devnum << endl;
+			opened = false;
+		}
+	}
+	if (!opened)
+	{
+		stopping.store(1);
+		for (auto &camera : cameras)
+			camera->thread.join();
+		return -1;
+	}
+
+	std::vector<std::thread> mt;
+	for (unsigned int i = 0; i < workers; i++)
+		mt.push_back(std::thread(modelThread, detectorSpec));
 
-	//sf::RenderWindow window(sf::VideoMode(1600, 900), "RenderWindow",sf::Style::Fullscreen);
-	sf::RenderWindow window(sf::VideoMode(640, 480), "RenderWindow");
-    window.setMouseCursorVisible(false);
-	window.setActive(false);
+	auto lastStats = std::chrono::steady_clock::now();
 
-	sf::Music music;
-	if (!music.openFromFile("BennyHill.ogg"))
+	if (!rendering)
 	{
-	   cout << "Unable to load music. " << endl;
+		cout << "Running without a window, stop with Ctrl-C." << endl;
+		while (!stopping.load())
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(100));
+			auto now = std::chrono::steady_clock::now();
+			if (statsInterval > 0 && now - lastStats >= std::chrono::seconds(statsInterval))
+			{
+				printStats(std::chrono::duration<double>(now - lastStats).count());
+				lastStats = now;
+			}
+		}
 	}
 	else
 	{
-       music.play();
-	   music.setLoop(true);
-	}
+		//sf::RenderWindow window(sf::VideoMode(1600, 900), "RenderWindow",sf::Style::Fullscreen);
+		sf::RenderWindow window(sf::VideoMode(640, 480), "RenderWindow");
+	    window.setMouseCursorVisible(false);
+		window.setActive(false);
+
+		// The music stream thread and the OpenAL mixer thread inherit the
+		// scheduling of the thread that creates them
+		threadConfig.apply("audio", "audio");
+		sf::Music music;
+		if (!music.openFromFile("BennyHill.ogg"))
+		{
+		   cout << "Unable to load music. " << endl;
+		}
+		else
+		{
+	       music.play();
+		   music.setLoop(true);
+		}
+		threadConfig.apply("main", "sfml");
 
-	std::thread rt = std::thread(renderingThread,&window);
+		std::thread rt = std::thread(renderingThread,&window);
 
-	while (window.isOpen())
-	{
-		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+		while (window.isOpen())
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(100));
+			auto now = std::chrono::steady_clock::now();
+			if (statsInterval > 0 && now - lastStats >= std::chrono::seconds(statsInterval))
+			{
+				printStats(std::chrono::duration<double>(now - lastStats).count());
+				lastStats = now;
+			}
+		}
+
+		music.stop();
+		rt.join();
 	}
 
-	music.stop();
 	stopping.store(1);
+	scheduler->stop();
+
+	for (auto &camera : cameras)
+		camera->thread.join();
+	for (auto &t : mt)
+		t.join();
+
+	for (auto &camera : cameras)
+		for (auto &sink : camera->sinks)
+			sink->stop();
+
+	if (statsInterval > 0)
+		printStats(std::chrono::duration<double>(std::chrono::steady_clock::now() - lastStats).count());
 
-	ct.join();
-	mt.join();
-	rt.join();
+	// Release the pooled frames while the pool is still around
+	cameras.clear();
 
 }
@@ -0,0 +1,146 @@
+/*
+
+    Minimal reader of the shared memory frame ring that sfml publishes with
+    --sink=shm:/name. It maps the ring, follows the newest frame and prints
+    its sequence number, size and age; with --dump=<file> the last consistent
+    frame is written as a binary PPM. Nothing is copied except for the dump.
+
+    It only needs ShmFrameRing.cpp, no OpenCV:
+
+        g++ -std=c++14 -O2 shm_reader_example.cpp ShmFrameRing.cpp -lrt -o shm_reader
+
+    Readers never hold up the producer. When the producer overwrote a frame
+    while it was being read, valid() says so and the frame is skipped.
+
+*/
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <string>
+#include <thread>
+
+#include "ShmFrameRing.h"
+
+using namespace std;
+
+static int64_t monotonicNanos()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Sums the frame, stands in for whatever a real reader does with the pixels
+static unsigned long checksum(const ShmFrame &frame)
+{
+    unsigned long sum = 0;
+    for (uint32_t i = 0; i < frame.size; i += 64)
+        sum += frame.data[i];
+    return sum;
+}
+
+static bool dumpPpm(const ShmFrame &frame, const string &path)
+{
+    if (frame.format != SHM_BGR24)
+        return false;
+
+    FILE *f = fopen(path.c_str(), "wb");
+    if (!f)
+        return false;
+
+    fprintf(f, "P6\n%u %u\n255\n", frame.width, frame.height);
+    unsigned char row[3 * 4096];
+    for (uint32_t y = 0; y < frame.height; y++)
+    {
+        const unsigned char *p = frame.data + (size_t)y * frame.stride;
+        uint32_t w = frame.width < 4096 ? frame.width : 4096;
+        for (uint32_t x = 0; x < w; x++)
+        {
+            row[3 * x] = p[3 * x + 2];
+            row[3 * x + 1] = p[3 * x + 1];
+            row[3 * x + 2] = p[3 * x];
+        }
+        fwrite(row, 3, w, f);
+    }
+    fclose(f);
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        cout << "Call this program with the shared memory name given to sfml --sink=shm:<name>, like /faceswap." << endl;
+        cout << "Options: --frames=<n> (stop after n frames), --dump=<file.ppm> (write the last frame)." << endl;
+        return 0;
+    }
+
+    string name = argv[1];
+    unsigned long maxFrames = 0;
+    string dumpPath;
+    for (int i = 2; i < argc; i++)
+    {
+        string arg(argv[i]);
+        if (arg.compare(0, 9, "--frames=") == 0)
+            maxFrames = stoul(arg.substr(9));
+        else if (arg.compare(0, 7, "--dump=") == 0)
+            dumpPath = arg.substr(7);
+        else
+        {
+            cout << "Unknown option " << arg << endl;
+            return -1;
+        }
+    }
+
+    ShmFrameReader reader;
+    while (!reader.open(name))
+    {
+        cerr << "Waiting for " << name << endl;
+        this_thread::sleep_for(chrono::seconds(1));
+    }
+
+    uint64_t last = 0;
+    unsigned long frames = 0, torn = 0, missed = 0;
+    auto lastFrameTime = chrono::steady_clock::now();
+
+    while (maxFrames == 0 || frames < maxFrames)
+    {
+        ShmFrame frame;
+        if (!reader.latest(frame) || frame.sequence == last)
+        {
+            // The producer restarted and made a new ring, pick that one up
+            if (chrono::steady_clock::now() - lastFrameTime > chrono::seconds(2))
+            {
+                reader.open(name);
+                lastFrameTime = chrono::steady_clock::now();
+            }
+            this_thread::sleep_for(chrono::milliseconds(1));
+            continue;
+        }
+
+        unsigned long sum = checksum(frame);
+        bool dumped = !dumpPath.empty() && dumpPpm(frame, dumpPath);
+
+        if (!reader.valid(frame))
+        {
+            torn++;
+            continue;
+        }
+
+        if (last && frame.sequence > last + 1)
+            missed += frame.sequence - last - 1;
+        last = frame.sequence;
+        frames++;
+        lastFrameTime = chrono::steady_clock::now();
+
+        cout << "Frame " << frame.sequence << " " << frame.width << "x" << frame.height
+             << " format " << frame.format << " age " << (monotonicNanos() - frame.timestamp_ns) / 1000 << " us"
+             << " checksum " << sum << (dumped ? " dumped" : "") << endl;
+    }
+
+    cout << frames << " frames read, " << missed << " skipped, " << torn << " torn" << endl;
+    return 0;
+}